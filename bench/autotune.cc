@@ -0,0 +1,333 @@
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/trace/trace_replay.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "workloads.h"
+
+//////////////////////////////////////////////////////////////////////
+// Compile time configuration auto-tuner. Instantiates every
+// fixed_slab_manager / dynamic_slab_manager configuration in tuned_configs
+// below for objects of AUTOTUNE_OBJ_SIZE bytes, runs each against a
+// workload from workloads.h (or replays a trace recorded with
+// traced_manager) and writes the fastest configuration that never failed an
+// allocation as a header:
+//
+//     template<typename T> using tuned_slab_manager = ...;
+//
+// The build target run_autotune writes
+// lib/allocator/slab_layout/TUNED_SLAB_CONFIG.h. Set AUTOTUNE_OBJ_SIZE with
+// cmake -DAUTOTUNE_OBJ_SIZE=<bytes>.
+
+#ifndef AUTOTUNE_OBJ_SIZE
+#define AUTOTUNE_OBJ_SIZE 64
+#endif
+
+struct tuned_obj {
+    uint8_t bytes[AUTOTUNE_OBJ_SIZE];
+};
+
+static constexpr const uint32_t MAX_NAME_LEN = 64;
+
+//////////////////////////////////////////////////////////////////////
+// configurations. name() is used in the table, decl() is what gets written to
+// the header (with T as the object type)
+template<uint32_t levels, uint32_t... per_level_nvec>
+struct fixed_cfg {
+    template<typename T>
+    using manager_t = fixed_slab_manager<T, levels, per_level_nvec...>;
+
+    static void
+    name(char * const buf) {
+        uint32_t off = snprintf(buf, MAX_NAME_LEN, "fixed-%u:", levels);
+        ((off += snprintf(buf + off, MAX_NAME_LEN - off, "%u,", per_level_nvec)),
+         ...);
+        buf[off - 1] = '\0';
+    }
+
+    static void
+    decl(FILE * const fp) {
+        fprintf(fp, "fixed_slab_manager<T, %u", levels);
+        ((fprintf(fp, ", %u", per_level_nvec)), ...);
+        fprintf(fp, ">");
+    }
+};
+
+template<reclaim_policy rp, uint32_t levels, uint32_t... per_level_nvec>
+struct dynamic_cfg {
+    template<typename T>
+    using manager_t = dynamic_slab_manager<T, levels, rp, per_level_nvec...>;
+
+    static const char *
+    policy_name() {
+        return rp == reclaim_policy::SHARED ? "shared" : "percpu";
+    }
+
+    static void
+    name(char * const buf) {
+        uint32_t off = snprintf(buf,
+                                MAX_NAME_LEN,
+                                "dynamic-%s-%u:",
+                                policy_name(),
+                                levels);
+        ((off += snprintf(buf + off, MAX_NAME_LEN - off, "%u,", per_level_nvec)),
+         ...);
+        buf[off - 1] = '\0';
+    }
+
+    static void
+    decl(FILE * const fp) {
+        fprintf(fp,
+                "dynamic_slab_manager<T, %u, reclaim_policy::%s",
+                levels,
+                rp == reclaim_policy::SHARED ? "SHARED" : "PERCPU");
+        ((fprintf(fp, ", %u", per_level_nvec)), ...);
+        fprintf(fp, ">");
+    }
+};
+
+template<typename... cfgs>
+struct config_list {
+    static constexpr const uint32_t size = sizeof...(cfgs);
+};
+
+// the search space. Every entry is a separate instantiation so keep this to
+// shapes that are plausible for the sizes we care about
+using tuned_configs =
+    config_list<fixed_cfg<1, 1, 8>,
+                fixed_cfg<1, 4, 8>,
+                fixed_cfg<1, 8, 8>,
+                fixed_cfg<2, 1, 1, 1>,
+                fixed_cfg<2, 1, 1, 2>,
+                fixed_cfg<2, 1, 2, 1>,
+                fixed_cfg<2, 2, 1, 1>,
+                fixed_cfg<2, 1, 1, 8>,
+                dynamic_cfg<reclaim_policy::SHARED, 1, 1, 8>,
+                dynamic_cfg<reclaim_policy::PERCPU, 1, 1, 8>,
+                dynamic_cfg<reclaim_policy::SHARED, 1, 4, 8>,
+                dynamic_cfg<reclaim_policy::PERCPU, 1, 4, 8>>;
+
+//////////////////////////////////////////////////////////////////////
+// results
+struct config_result {
+    char     name[MAX_NAME_LEN];
+    double   score;  // geomean Mops/sec over the selected workloads
+    uint64_t nfailed;
+    void (*decl)(FILE *);
+};
+
+uint32_t nthreads       = sysi::runtime_nprocs();
+uint32_t ops_per_thread = (1 << 18);
+uint32_t nruns          = 3;
+char *   workload_name  = NULL;
+char *   trace_prefix   = NULL;
+char *   out_file       = NULL;
+
+static bool
+selected(const char * const choice, const char * const name) {
+    return choice == NULL || (!strcmp(choice, "all")) || (!strcmp(choice, name));
+}
+
+// best of nruns for each selected workload, combined with a geomean so no
+// single workload dominates
+template<typename allocator_t>
+static void
+score_workloads(config_result * const r) {
+    double   log_sum = 0.0;
+    uint32_t nscored = 0;
+    for (uint32_t w = 0; w < NWORKLOADS; ++w) {
+        if (!selected(workload_name, workload_names[w])) {
+            continue;
+        }
+        double best = 0.0;
+        for (uint32_t i = 0; i < nruns; ++i) {
+            workload_bench<allocator_t> wb;
+            const workload_result       res =
+                wb.run((workload)w, nthreads, ops_per_thread);
+            best = cmath::max<double>(best, res.mops());
+            r->nfailed += res.nfailed;
+        }
+        lowv_print("\t%-12s %-24s %12.3f\n", workload_names[w], r->name, best);
+        log_sum += log(best);
+        ++nscored;
+    }
+    DIE_ASSERT(nscored, "Unknown workload: %s\n", workload_name);
+    r->score = exp(log_sum / nscored);
+}
+
+template<typename allocator_t>
+static void
+score_trace(config_result * const r, replay_trace * const trace) {
+    double best = 0.0;
+    for (uint32_t i = 0; i < nruns; ++i) {
+        replayer<allocator_t> * rp  = new replayer<allocator_t>();
+        const replay_result     res = rp->run(trace, false);
+        delete rp;
+        best = cmath::max<double>(best, res.mops());
+        r->nfailed += res.nfailed;
+    }
+    r->score = best;
+}
+
+template<typename cfg_t>
+static void
+score_config(config_result * const r, replay_trace * const trace) {
+    using allocator_t = typename cfg_t::template manager_t<tuned_obj>;
+
+    cfg_t::name(r->name);
+    r->decl    = &cfg_t::decl;
+    r->nfailed = 0;
+    if (trace) {
+        score_trace<allocator_t>(r, trace);
+    }
+    else {
+        score_workloads<allocator_t>(r);
+    }
+
+    fprintf(stdout,
+            "%-28s %10u %12.3f %10lu\n",
+            r->name,
+            allocator_t::capacity,
+            r->score,
+            r->nfailed);
+}
+
+template<typename... cfgs>
+static void
+score_all(config_list<cfgs...>,
+          config_result * const results,
+          replay_trace * const  trace) {
+    uint32_t i = 0;
+    ((score_config<cfgs>(results + (i++), trace)), ...);
+}
+
+// fastest config that never failed. If they all failed (workload needs more
+// objects than any config has) take the one that failed least
+static config_result *
+pick_best(config_result * const results, const uint32_t n) {
+    config_result * best = results;
+    for (uint32_t i = 1; i < n; ++i) {
+        config_result * const r = results + i;
+        if (r->nfailed < best->nfailed ||
+            (r->nfailed == best->nfailed && r->score > best->score)) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+static void
+write_header(const config_result * const best, const char * const source) {
+    FILE * fp = stdout;
+    if (out_file != NULL && strcmp(out_file, "")) {
+        fp = fopen(out_file, "w+");
+        ERROR_ASSERT(fp != NULL, "Error unable to open file at:\n\"%s\"\n", out_file);
+    }
+
+    fprintf(fp, "#ifndef _TUNED_SLAB_CONFIG_H_\n");
+    fprintf(fp, "#define _TUNED_SLAB_CONFIG_H_\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "// Generated by bench/autotune.cc (make run_autotune)\n");
+    fprintf(fp, "// Tuned with: %s\n", source);
+    fprintf(fp, "// Threads: %u, Score: %.3f Mops/sec\n", nthreads, best->score);
+    fprintf(fp, "\n");
+    fprintf(fp, "#include <allocator/slab_layout/dynamic_slab_manager.h>\n");
+    fprintf(fp, "#include <allocator/slab_layout/fixed_slab_manager.h>\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "// Object size and processor count the config was tuned for\n");
+    fprintf(fp, "#define TUNED_OBJ_SIZE %u\n", AUTOTUNE_OBJ_SIZE);
+    fprintf(fp, "#define TUNED_NPROCS %u\n", (uint32_t)NPROCS);
+    fprintf(fp, "#define TUNED_SLAB_CONFIG_NAME \"%s\"\n", best->name);
+    fprintf(fp, "\n");
+    fprintf(fp, "template<typename T>\n");
+    fprintf(fp, "using tuned_slab_manager = ");
+    best->decl(fp);
+    fprintf(fp, ";\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "#endif\n");
+
+    if (fp != stdout) {
+        fclose(fp);
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s",
+            "--size",
+            false,
+            Int,
+            ops_per_thread,
+            "Allocator calls PER THREAD");
+    ADD_ARG("-r", "--runs", false, Int, nruns, "Runs per config (best is used)");
+    ADD_ARG("-w",
+            "--workload",
+            false,
+            String,
+            workload_name,
+            "threadtest, larson, prodcon, shbench or all");
+    ADD_ARG("-p",
+            "--prefix",
+            false,
+            String,
+            trace_prefix,
+            "Tune against a recorded trace instead of a workload");
+    ADD_ARG("-o",
+            "--out",
+            false,
+            String,
+            out_file,
+            "File to write the tuned header to (stdout if not set)");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads && nruns, "Need at least 1 thread and 1 run\n");
+
+    replay_trace   trace;
+    replay_trace * tp = NULL;
+    char           source[256];
+    if (trace_prefix != NULL) {
+        trace.load(trace_prefix);
+        if (trace.obj_size > AUTOTUNE_OBJ_SIZE) {
+            fprintf(stderr,
+                    "Warning: trace object size (%u) > AUTOTUNE_OBJ_SIZE (%u)\n",
+                    trace.obj_size,
+                    AUTOTUNE_OBJ_SIZE);
+        }
+        tp       = &trace;
+        nthreads = trace.threads.size();
+        snprintf(source, 256, "trace %s", trace_prefix);
+    }
+    else {
+        snprintf(source,
+                 256,
+                 "workload %s",
+                 workload_name ? workload_name : "all");
+    }
+
+    fprintf(stdout,
+            "%-28s %10s %12s %10s\n",
+            "config",
+            "capacity",
+            "Mops/sec",
+            "failed");
+
+    config_result results[tuned_configs::size];
+    score_all(tuned_configs{}, results, tp);
+
+    const config_result * const best = pick_best(results, tuned_configs::size);
+    fprintf(stdout, "Best: %s\n", best->name);
+    write_header(best, source);
+}
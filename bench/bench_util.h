@@ -0,0 +1,219 @@
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+#include <util/rand_utils.h>
+
+//////////////////////////////////////////////////////////////////////
+// shared helpers for the benchmarks in bench/. Everything here is meant to
+// stay out of the timed region (or be cheap enough not to matter).
+
+namespace bench {
+
+static uint64_t ALWAYS_INLINE
+get_cycles() {
+    return __rdtsc();
+}
+
+static uint64_t ALWAYS_INLINE
+get_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000UL * 1000UL * 1000UL * ts.tv_sec + ts.tv_nsec;
+}
+
+// cpus this process is actually allowed to run on. Pinning to a cpu outside
+// of this set makes pthread_create fail
+uint32_t
+allowed_cpus(uint32_t * const cpus, const uint32_t max_cpus) {
+    cpu_set_t cset;
+    CPU_ZERO(&cset);
+    ERROR_ASSERT(!sched_getaffinity(0, sizeof(cpu_set_t), &cset));
+
+    uint32_t ncpus = 0;
+    for (uint32_t i = 0; i < CPU_SETSIZE && ncpus < max_cpus; ++i) {
+        if (CPU_ISSET(i, &cset)) {
+            cpus[ncpus++] = i;
+        }
+    }
+    return ncpus;
+}
+
+//////////////////////////////////////////////////////////////////////
+// per thread hardware counter. perf_event_open is often unavailable
+// (containers, perf_event_paranoid) in which case valid() is false and
+// stop() always returns 0 so callers only need to check once when reporting
+struct perf_counter {
+    int32_t fd;
+
+    void
+    init(const uint32_t type, const uint64_t config) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.type           = type;
+        pe.size           = sizeof(struct perf_event_attr);
+        pe.config         = config;
+        pe.disabled       = 1;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv     = 1;
+
+        // this thread, any cpu
+        fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+    }
+
+    void
+    init_cache_misses() {
+        init(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    }
+
+    bool
+    valid() const {
+        return fd >= 0;
+    }
+
+    void
+    start() {
+        if (valid()) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t
+    stop() {
+        uint64_t count = 0;
+        if (valid()) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(fd, &count, sizeof(uint64_t)) != sizeof(uint64_t)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+    void
+    destroy() {
+        if (valid()) {
+            close(fd);
+            fd = -1;
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////
+// spawns nthreads, pinning the first ones (1 per allowed cpu) so that all
+// cpus are used at least once if there are sufficient threads
+struct thread_group {
+    pthread_t * tids;
+    uint32_t    nthreads;
+
+    void
+    spawn(const uint32_t   _nthreads,
+          void *           (*tfunc)(void *),
+          void * const     args,
+          const uint64_t   arg_size,
+          const bool       pin = true) {
+        nthreads = _nthreads;
+        tids     = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+        ERROR_ASSERT(tids);
+
+        // NPROCS is the build host's, this may run on a bigger one
+        uint32_t * const cpus =
+            (uint32_t *)calloc(sysi::runtime_nprocs(), sizeof(uint32_t));
+        ERROR_ASSERT(cpus);
+        const uint32_t ncpus = allowed_cpus(cpus, sysi::runtime_nprocs());
+
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            pthread_attr_t attr;
+            ERROR_ASSERT(!pthread_attr_init(&attr));
+
+            // seriously decreases overhead of thread spawn
+            ERROR_ASSERT(!pthread_attr_setstacksize(&attr, (1 << 16)));
+            if (pin && i < ncpus) {
+                cpu_set_t cset;
+                CPU_ZERO(&cset);
+                CPU_SET(cpus[i], &cset);
+                ERROR_ASSERT(!pthread_attr_setaffinity_np(&attr,
+                                                          sizeof(cpu_set_t),
+                                                          &cset));
+            }
+            ERROR_ASSERT(!pthread_create(tids + i,
+                                         &attr,
+                                         tfunc,
+                                         ((uint8_t *)args) + i * arg_size));
+            pthread_attr_destroy(&attr);
+        }
+        free(cpus);
+    }
+
+    void
+    join() {
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        free(tids);
+        tids = NULL;
+    }
+};
+
+// results each thread reports back
+struct thread_result {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t nops;
+    uint64_t nfailed;
+    uint64_t cache_misses;
+    bool     has_perf;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+uint64_t
+elapsed_ns(const thread_result * const results, const uint32_t nthreads) {
+    uint64_t start = ~(0UL), end = 0;
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        start = results[i].start_ns < start ? results[i].start_ns : start;
+        end   = results[i].end_ns > end ? results[i].end_ns : end;
+    }
+    return end > start ? end - start : 1;
+}
+
+}  // namespace bench
+
+//////////////////////////////////////////////////////////////////////
+// glibc malloc behind the same interface as the slab managers so the
+// benchmarks can treat it as just another allocator_t
+template<typename T>
+struct glibc_allocator {
+    static constexpr const uint32_t capacity = (~(0U));
+
+    glibc_allocator() = default;
+
+    void
+    reset() {}
+
+    T *
+    _allocate() {
+        return (T *)malloc(sizeof(T));
+    }
+
+    void
+    _free(T * addr) {
+        free(addr);
+    }
+};
+
+#endif
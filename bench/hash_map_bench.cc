@@ -0,0 +1,265 @@
+// counters for rseq aborts etc... must be enabled before the allocator
+// headers are included
+#define ALLOC_STATS
+
+#include <allocator/common/alloc_stats.h>
+#include <concurrency/epoch_domain.h>
+#include <concurrency/lockfree_hash_map.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+#include <unordered_map>
+
+#include "bench_util.h"
+
+//////////////////////////////////////////////////////////////////////
+// lockfree_hash_map (nodes from dynamic_slab_manager) against
+// std::unordered_map sharded behind mutexes. Each thread does a random mix
+// of find / insert / erase over a shared key space that starts half full,
+// so inserts and erases stay balanced and most erases free a node another
+// cpu allocated (the remote free path). Reports throughput and, for the
+// lock free map, remote frees per erase.
+
+static constexpr const uint32_t nshards_locked = 64;
+
+uint32_t nthreads       = sysi::runtime_nprocs();
+uint32_t ops_per_thread = (1 << 20);
+uint32_t log_nkeys      = 16;
+uint32_t find_pct       = 80;
+char *   map_name       = NULL;
+
+// keeps the finds from being optimized out
+volatile uint64_t find_sink;
+
+struct locked_shard {
+    std::mutex                             lock;
+    std::unordered_map<uint64_t, uint64_t> map;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+struct sharded_locked_map {
+    locked_shard shards[nshards_locked];
+
+    locked_shard &
+    shard_of(const uint64_t key) {
+        return shards[mixed_hash<uint64_t>{}(key) % nshards_locked];
+    }
+
+    uint32_t
+    find(const uint64_t key, uint64_t * const val_out) {
+        locked_shard &              s = shard_of(key);
+        std::lock_guard<std::mutex> g(s.lock);
+        auto                        it = s.map.find(key);
+        if (it == s.map.end()) {
+            return 0;
+        }
+        *val_out = it->second;
+        return 1;
+    }
+
+    uint32_t
+    insert(const uint64_t key, const uint64_t val) {
+        locked_shard &              s = shard_of(key);
+        std::lock_guard<std::mutex> g(s.lock);
+        return s.map.emplace(key, val).second;
+    }
+
+    uint32_t
+    erase(const uint64_t key) {
+        locked_shard &              s = shard_of(key);
+        std::lock_guard<std::mutex> g(s.lock);
+        return s.map.erase(key);
+    }
+};
+
+struct lockfree_map {
+    epoch_domain                          dom;
+    lockfree_hash_map<uint64_t, uint64_t> hmap;
+
+    lockfree_map() : dom(), hmap(&dom, log_nkeys) {}
+
+    uint32_t
+    find(const uint64_t key, uint64_t * const val_out) {
+        return hmap.find(key, val_out);
+    }
+
+    uint32_t
+    insert(const uint64_t key, const uint64_t val) {
+        return hmap.insert(key, val);
+    }
+
+    uint32_t
+    erase(const uint64_t key) {
+        return hmap.erase(key);
+    }
+};
+
+struct thread_stats {
+    bench::thread_result r;
+    uint64_t             counters[astats::NCOUNTERS];
+    uint64_t             nerased;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename map_t>
+struct hash_map_bench;
+
+template<typename map_t>
+struct thread_arg {
+    hash_map_bench<map_t> * hb;
+    uint32_t                tid;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename map_t>
+struct hash_map_bench {
+    map_t *           map;
+    pthread_barrier_t b;
+    thread_stats *    stats;
+
+    void
+    run_thread(const uint32_t tid) {
+        thread_stats * const s     = stats + tid;
+        const uint64_t       nkeys = (1UL) << log_nkeys;
+        uint64_t             state = tid + 1;
+        uint64_t             val = 0, sink = 0;
+
+        astats::reset_thread_counters();
+        pthread_barrier_wait(&b);
+        s->r.start_ns = bench::get_ns();
+        for (uint32_t i = 0; i < ops_per_thread; ++i) {
+            const uint64_t r   = rutil::next_rand(&state);
+            const uint64_t key = r & (nkeys - 1);
+            const uint32_t op  = (r >> 32) % 100;
+            if (op < find_pct) {
+                if (map->find(key, &val)) {
+                    sink += val;
+                }
+            }
+            else if (op & 0x1) {
+                s->r.nfailed += !map->insert(key, key);
+            }
+            else {
+                s->nerased += map->erase(key);
+            }
+        }
+        s->r.end_ns = bench::get_ns();
+        s->r.nops   = ops_per_thread;
+        memcpy(s->counters, astats::thread_counters, sizeof(s->counters));
+        find_sink += sink;
+    }
+
+    static void *
+    run_thread_wrapper(void * targ) {
+        init_thread();
+        thread_arg<map_t> * const arg = (thread_arg<map_t> *)targ;
+        arg->hb->run_thread(arg->tid);
+        return NULL;
+    }
+
+    void
+    run(const char * const name) {
+        map = new map_t();
+        // start half full so inserts and erases both mostly succeed
+        for (uint64_t key = 0; key < ((1UL) << log_nkeys); key += 2) {
+            map->insert(key, key);
+        }
+
+        stats = (thread_stats *)aligned_alloc(CACHE_LINE_SIZE,
+                                              nthreads * sizeof(thread_stats));
+        thread_arg<map_t> * targs = (thread_arg<map_t> *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            nthreads * sizeof(thread_arg<map_t>));
+        ERROR_ASSERT(stats && targs);
+        memset(stats, 0, nthreads * sizeof(thread_stats));
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            targs[i].hb  = this;
+            targs[i].tid = i;
+        }
+
+        ERROR_ASSERT(!pthread_barrier_init(&b, NULL, nthreads));
+        bench::thread_group tg;
+        tg.spawn(nthreads,
+                 &hash_map_bench<map_t>::run_thread_wrapper,
+                 (void *)targs,
+                 sizeof(thread_arg<map_t>));
+        tg.join();
+        pthread_barrier_destroy(&b);
+
+        uint64_t nops = 0, nerased = 0, remote_frees = 0;
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            nops += stats[i].r.nops;
+            nerased += stats[i].nerased;
+            remote_frees += stats[i].counters[astats::REMOTE_FREES];
+        }
+        uint64_t start = ~(0UL), end = 0;
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            start = cmath::min<uint64_t>(start, stats[i].r.start_ns);
+            end   = cmath::max<uint64_t>(end, stats[i].r.end_ns);
+        }
+        const uint64_t elapsed = end > start ? end - start : 1;
+
+        fprintf(stdout,
+                "%-10s %8u %8u %12.3f %10.2f %14.3f\n",
+                name,
+                nthreads,
+                find_pct,
+                ((double)nops * 1000.0) / ((double)elapsed),
+                ((double)elapsed) /
+                    ((double)cmath::max<uint64_t>(nops / nthreads, 1)),
+                ((double)remote_frees) /
+                    ((double)cmath::max<uint64_t>(nerased, 1)));
+
+        free(targs);
+        free(stats);
+        delete map;
+    }
+};
+
+template<typename map_t>
+static void
+run_map(const char * const name) {
+    if (map_name && strcmp(map_name, "all") && strcmp(map_name, name)) {
+        return;
+    }
+    hash_map_bench<map_t> hb;
+    hb.run(name);
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s",
+            "--size",
+            false,
+            Int,
+            ops_per_thread,
+            "Operations PER THREAD");
+    ADD_ARG("-k", "--log-keys", false, Int, log_nkeys, "Log2 of key space");
+    ADD_ARG("-f", "--find", false, Int, find_pct, "Percent of ops that are finds");
+    ADD_ARG("-m", "--map", false, String, map_name, "lockfree, locked or all");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+    DIE_ASSERT(find_pct <= 100, "find percent must be <= 100\n");
+
+    fprintf(stdout,
+            "%-10s %8s %8s %12s %10s %14s\n",
+            "map",
+            "threads",
+            "find %",
+            "Mops/sec",
+            "ns/op",
+            "remote/erase");
+
+    run_map<lockfree_map>("lockfree");
+    run_map<sharded_locked_map>("locked");
+}
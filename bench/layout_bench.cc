@@ -0,0 +1,312 @@
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/vec_layout/vec_manager.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+
+//////////////////////////////////////////////////////////////////////
+// Runs identical workloads over many hierarchy shapes for both the
+// slab_layout (super_slab -> obj_slab) and vec_layout (obj_vec) families.
+// This replaces hand toggling OBJ_VEC / SUPER_SLAB / SUPER_DUPER_SLAB in
+// tests/obj_slab_test.cc. For each shape reports throughput, cache misses per
+// op (if perf_event_open is available) and metadata bytes per object.
+
+enum workload { ALLOC_FREE = 0, BATCH_ALLOC_FREE = 1, ALLOC = 2, NWORKLOADS = 3 };
+static const char * const workload_names[NWORKLOADS] = { "alloc_free",
+                                                         "batch_alloc_free",
+                                                         "alloc" };
+
+static constexpr const uint32_t max_batch_size = 128;
+
+uint32_t nthreads       = sysi::runtime_nprocs();
+uint32_t ops_per_thread = (1 << 20);
+char *   family         = NULL;
+
+
+template<typename allocator_t>
+struct layout_bench;
+
+template<typename allocator_t>
+struct thread_arg {
+    layout_bench<allocator_t> * lb;
+    uint32_t                    tid;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename allocator_t>
+struct layout_bench {
+    using obj_t = uint64_t;
+
+    allocator_t               allocator;
+    workload                  w;
+    pthread_barrier_t         b;
+    bench::thread_result *    results;
+    thread_arg<allocator_t> * targs;
+
+    void
+    alloc_free(bench::thread_result * const r) {
+        for (uint32_t i = 0; i < ops_per_thread; ++i) {
+            obj_t * const p = allocator._allocate();
+            if (BRANCH_UNLIKELY(p == NULL)) {
+                ++r->nfailed;
+                continue;
+            }
+            allocator._free(p);
+        }
+        r->nops = 2UL * ops_per_thread;
+    }
+
+    void
+    batch_alloc_free(bench::thread_result * const r) {
+        // in worst case all threads are on 1 cpu so keep total live objects
+        // below a single cpu's capacity
+        const uint32_t batch_size = cmath::max<uint32_t>(
+            cmath::min<uint32_t>(allocator.capacity / nthreads, max_batch_size),
+            1);
+        obj_t *  ptrs[max_batch_size];
+        uint32_t nptrs = 0;
+
+        for (uint32_t i = 0; i < ops_per_thread; ++i) {
+            obj_t * const p = allocator._allocate();
+            if (BRANCH_UNLIKELY(p == NULL)) {
+                ++r->nfailed;
+                continue;
+            }
+            ptrs[nptrs++] = p;
+            if (nptrs == batch_size) {
+                for (uint32_t j = 0; j < batch_size; ++j) {
+                    allocator._free(ptrs[j]);
+                }
+                nptrs = 0;
+            }
+        }
+        for (uint32_t j = 0; j < nptrs; ++j) {
+            allocator._free(ptrs[j]);
+        }
+        r->nops = 2UL * ops_per_thread;
+    }
+
+    void
+    alloc(bench::thread_result * const r) {
+        // cap so that we measure allocation, not the allocator reporting
+        // full
+        const uint32_t nallocs = cmath::min<uint32_t>(
+            ops_per_thread,
+            cmath::max<uint32_t>(allocator.capacity / nthreads, 1));
+        for (uint32_t i = 0; i < nallocs; ++i) {
+            if (BRANCH_UNLIKELY(allocator._allocate() == NULL)) {
+                ++r->nfailed;
+            }
+        }
+        r->nops = nallocs;
+    }
+
+    static void *
+    run_thread(void * targ) {
+        init_thread();
+        thread_arg<allocator_t> * const arg = (thread_arg<allocator_t> *)targ;
+        layout_bench<allocator_t> * const lb = arg->lb;
+        bench::thread_result * const      r  = lb->results + arg->tid;
+
+        bench::perf_counter pc;
+        pc.init_cache_misses();
+        r->has_perf = pc.valid();
+
+        pthread_barrier_wait(&(lb->b));
+        r->start_ns = bench::get_ns();
+        pc.start();
+        switch (lb->w) {
+            case ALLOC_FREE:
+                lb->alloc_free(r);
+                break;
+            case BATCH_ALLOC_FREE:
+                lb->batch_alloc_free(r);
+                break;
+            case ALLOC:
+                lb->alloc(r);
+                break;
+            default:
+                DIE("Unknown workload: %d\n", lb->w);
+        }
+        r->cache_misses = pc.stop();
+        r->end_ns       = bench::get_ns();
+        pc.destroy();
+        return NULL;
+    }
+
+    void
+    run(const char * const name, const uint64_t metadata_bytes) {
+        results = (bench::thread_result *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            nthreads * sizeof(bench::thread_result));
+        targs = (thread_arg<allocator_t> *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            nthreads * sizeof(thread_arg<allocator_t>));
+        ERROR_ASSERT(results && targs);
+
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            targs[i].lb  = this;
+            targs[i].tid = i;
+        }
+
+        for (uint32_t _w = 0; _w < NWORKLOADS; ++_w) {
+            w = (workload)_w;
+            memset(results, 0, nthreads * sizeof(bench::thread_result));
+            ERROR_ASSERT(!pthread_barrier_init(&b, NULL, nthreads));
+
+            bench::thread_group tg;
+            tg.spawn(nthreads,
+                     &layout_bench<allocator_t>::run_thread,
+                     (void *)targs,
+                     sizeof(thread_arg<allocator_t>));
+            tg.join();
+            pthread_barrier_destroy(&b);
+
+            uint64_t nops = 0, nfailed = 0, cache_misses = 0;
+            bool     has_perf = true;
+            for (uint32_t i = 0; i < nthreads; ++i) {
+                nops += results[i].nops;
+                nfailed += results[i].nfailed;
+                cache_misses += results[i].cache_misses;
+                has_perf &= results[i].has_perf;
+            }
+            const uint64_t ns = bench::elapsed_ns(results, nthreads);
+
+            fprintf(stdout,
+                    "%-20s %-18s %10u %12.3f %10.2f ",
+                    name,
+                    workload_names[w],
+                    allocator.capacity,
+                    ((double)nops * 1000.0) / ((double)ns),
+                    ((double)ns * nthreads) / ((double)nops));
+            if (has_perf) {
+                fprintf(stdout,
+                        "%12.4f ",
+                        ((double)cache_misses) / ((double)nops));
+            }
+            else {
+                fprintf(stdout, "%12s ", "n/a");
+            }
+            fprintf(stdout,
+                    "%12.4f %8lu\n",
+                    ((double)metadata_bytes) / ((double)allocator.capacity),
+                    nfailed);
+
+            allocator.reset();
+        }
+        free(targs);
+        free(results);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////
+// naming "slab L:n0,n1,..." so shapes are easy to grep out of the results
+template<uint32_t... per_level_nvec>
+static void
+config_name(char * const      buf,
+            const uint32_t    buf_len,
+            const char * const prefix,
+            const uint32_t    levels) {
+    const uint32_t nvecs[]   = { per_level_nvec... };
+    uint32_t       len       = snprintf(buf, buf_len, "%s %u:", prefix, levels);
+    for (uint32_t i = 0; i < sizeof(nvecs) / sizeof(uint32_t); ++i) {
+        len += snprintf(buf + len,
+                        buf_len - len,
+                        i ? ",%u" : "%u",
+                        nvecs[i]);
+    }
+}
+
+template<uint32_t levels, uint32_t... per_level_nvec>
+static void
+run_slab() {
+    using manager_t = fixed_slab_manager<uint64_t, levels, per_level_nvec...>;
+    if (family && strcmp(family, "all") && strcmp(family, "slab")) {
+        return;
+    }
+    char name[64];
+    config_name<per_level_nvec...>(name, 64, "slab", levels);
+
+    layout_bench<manager_t> * lb = new layout_bench<manager_t>();
+    lb->run(name,
+            sizeof(typename manager_t::slab_t) -
+                manager_t::capacity * sizeof(uint64_t));
+    delete lb;
+}
+
+template<uint32_t levels, uint32_t... per_level_nvec>
+static void
+run_vec() {
+    using manager_t = fixed_vec_manager<uint64_t, levels, per_level_nvec...>;
+    if (family && strcmp(family, "all") && strcmp(family, "vec")) {
+        return;
+    }
+    char name[64];
+    config_name<per_level_nvec...>(name, 64, "vec", levels);
+
+    layout_bench<manager_t> * lb = new layout_bench<manager_t>();
+    lb->run(name,
+            sizeof(typename manager_t::vec_t) -
+                manager_t::capacity * sizeof(uint64_t));
+    delete lb;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s",
+            "--size",
+            false,
+            Int,
+            ops_per_thread,
+            "Allocator calls PER THREAD");
+    ADD_ARG("-f",
+            "--family",
+            false,
+            String,
+            family,
+            "slab, vec or all");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    fprintf(stdout,
+            "%-20s %-18s %10s %12s %10s %12s %12s %8s\n",
+            "layout",
+            "workload",
+            "capacity",
+            "Mops/sec",
+            "ns/op",
+            "misses/op",
+            "meta B/obj",
+            "failed");
+
+    // same shapes for both families so rows can be compared directly
+    run_slab<0, 1>();
+    run_slab<0, 8>();
+    run_slab<1, 1, 2>();
+    run_slab<1, 1, 8>();
+    run_slab<1, 4, 8>();
+    run_slab<2, 1, 1, 2>();
+    run_slab<2, 1, 2, 1>();
+    run_slab<2, 2, 1, 1>();
+
+    run_vec<0, 1>();
+    run_vec<0, 8>();
+    run_vec<1, 1, 2>();
+    run_vec<1, 1, 8>();
+    run_vec<1, 4, 8>();
+    run_vec<2, 1, 1, 2>();
+    run_vec<2, 1, 2, 1>();
+    run_vec<2, 2, 1, 1>();
+}
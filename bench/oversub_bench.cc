@@ -0,0 +1,283 @@
+// counters for rseq aborts etc... must be enabled before the allocator
+// headers are included
+#define ALLOC_STATS
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+
+//////////////////////////////////////////////////////////////////////
+// Runs alloc/free with many more threads than cpus (and optionally forces
+// migrations by hopping each thread between cpus with sched_setaffinity) to
+// measure how the FAILED_RSEQ / WAS_PREEMPTED retry loops behave when
+// preemption and migration are common. Reports throughput, rseq aborts per
+// allocation and tail latency of individual alloc + free pairs.
+
+static constexpr const uint32_t batch_size = 16;
+
+// latency of every sample_rate'th alloc/free pair is recorded
+static constexpr const uint32_t sample_rate = 16;
+
+uint32_t mult_min       = 2;
+uint32_t mult_max       = 64;
+uint32_t ops_per_thread = (1 << 16);
+uint32_t hop_interval   = 0;
+char *   allocator_name = NULL;
+
+struct thread_stats {
+    bench::thread_result r;
+    uint64_t             counters[astats::NCOUNTERS];
+    uint64_t             nhops;
+    uint64_t *           lat_samples;
+    uint32_t             nsamples;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename allocator_t>
+struct oversub_bench;
+
+template<typename allocator_t>
+struct thread_arg {
+    oversub_bench<allocator_t> * ob;
+    uint32_t                     tid;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename allocator_t>
+struct oversub_bench {
+    using obj_t = uint64_t;
+
+    allocator_t       allocator;
+    pthread_barrier_t b;
+    uint32_t          nthreads;
+    uint32_t          ncpus;
+    uint32_t          cpus[CPU_SETSIZE];
+    thread_stats *    stats;
+
+    // move to the next allowed cpu. Returns 1 if the hop succeeded
+    uint32_t
+    hop(const uint32_t tid, const uint32_t nth_hop) {
+        cpu_set_t cset;
+        CPU_ZERO(&cset);
+        CPU_SET(cpus[(tid + nth_hop) % ncpus], &cset);
+        return !sched_setaffinity(0, sizeof(cpu_set_t), &cset);
+    }
+
+    void
+    run_thread(const uint32_t tid) {
+        thread_stats * const s = stats + tid;
+        obj_t *              ptrs[batch_size];
+        const uint32_t       nbatches =
+            cmath::max<uint32_t>(ops_per_thread / batch_size, 1);
+
+        s->nsamples = 0;
+        s->lat_samples =
+            (uint64_t *)calloc((nbatches * batch_size) / sample_rate + 1,
+                               sizeof(uint64_t));
+        ERROR_ASSERT(s->lat_samples);
+
+        astats::reset_thread_counters();
+        pthread_barrier_wait(&b);
+        s->r.start_ns = bench::get_ns();
+
+        uint32_t nth_hop = 0;
+        for (uint32_t i = 0; i < nbatches; ++i) {
+            if (hop_interval && (i % hop_interval) == (hop_interval - 1)) {
+                s->nhops += hop(tid, ++nth_hop);
+            }
+            for (uint32_t j = 0; j < batch_size; ++j) {
+                const uint32_t op_idx = i * batch_size + j;
+                if ((op_idx % sample_rate) == 0) {
+                    const uint64_t start = bench::get_cycles();
+                    obj_t * const  p     = allocator._allocate();
+                    if (BRANCH_LIKELY(p != NULL)) {
+                        allocator._free(p);
+                    }
+                    s->lat_samples[s->nsamples++] =
+                        bench::get_cycles() - start;
+                }
+                ptrs[j] = allocator._allocate();
+            }
+            for (uint32_t j = 0; j < batch_size; ++j) {
+                if (BRANCH_LIKELY(ptrs[j] != NULL)) {
+                    allocator._free(ptrs[j]);
+                }
+            }
+        }
+        s->r.end_ns = bench::get_ns();
+        memcpy(s->counters, astats::thread_counters, sizeof(s->counters));
+        s->r.nops = s->counters[astats::ALLOCS] + s->counters[astats::FREES];
+    }
+
+    static void *
+    run_thread_wrapper(void * targ) {
+        init_thread();
+        thread_arg<allocator_t> * const arg = (thread_arg<allocator_t> *)targ;
+        arg->ob->run_thread(arg->tid);
+        return NULL;
+    }
+
+    void
+    run(const char * const name, const uint32_t mult) {
+        ncpus    = bench::allowed_cpus(cpus, CPU_SETSIZE);
+        nthreads = mult * ncpus;
+
+        stats = (thread_stats *)aligned_alloc(CACHE_LINE_SIZE,
+                                              nthreads * sizeof(thread_stats));
+        thread_arg<allocator_t> * targs =
+            (thread_arg<allocator_t> *)aligned_alloc(
+                CACHE_LINE_SIZE,
+                nthreads * sizeof(thread_arg<allocator_t>));
+        ERROR_ASSERT(stats && targs);
+        memset(stats, 0, nthreads * sizeof(thread_stats));
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            targs[i].ob  = this;
+            targs[i].tid = i;
+        }
+
+        ERROR_ASSERT(!pthread_barrier_init(&b, NULL, nthreads));
+        bench::thread_group tg;
+
+        // only pin when we are not going to be hopping anyways
+        tg.spawn(nthreads,
+                 &oversub_bench<allocator_t>::run_thread_wrapper,
+                 (void *)targs,
+                 sizeof(thread_arg<allocator_t>),
+                 hop_interval == 0);
+        tg.join();
+        pthread_barrier_destroy(&b);
+
+        uint64_t counters[astats::NCOUNTERS];
+        uint64_t nops = 0, nhops = 0, nsamples = 0;
+        memset(counters, 0, sizeof(counters));
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            nops += stats[i].r.nops;
+            nhops += stats[i].nhops;
+            nsamples += stats[i].nsamples;
+            for (uint32_t c = 0; c < astats::NCOUNTERS; ++c) {
+                counters[c] += stats[i].counters[c];
+            }
+        }
+
+        uint64_t * all_samples = (uint64_t *)calloc(nsamples, sizeof(uint64_t));
+        ERROR_ASSERT(all_samples);
+        for (uint32_t i = 0, off = 0; i < nthreads; ++i) {
+            memcpy(all_samples + off,
+                   stats[i].lat_samples,
+                   stats[i].nsamples * sizeof(uint64_t));
+            off += stats[i].nsamples;
+            free(stats[i].lat_samples);
+        }
+        std::sort(all_samples, all_samples + nsamples);
+
+        uint64_t start = ~(0UL), end = 0;
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            start = cmath::min<uint64_t>(start, stats[i].r.start_ns);
+            end   = cmath::max<uint64_t>(end, stats[i].r.end_ns);
+        }
+        const uint64_t elapsed = end > start ? end - start : 1;
+
+        fprintf(stdout,
+                "%-8s %5ux %8u %8lu %12.3f %12.6f %10lu %10lu %10lu %10lu\n",
+                name,
+                mult,
+                nthreads,
+                nhops,
+                ((double)nops * 1000.0) / ((double)elapsed),
+                ((double)counters[astats::RSEQ_ABORTS]) /
+                    ((double)cmath::max<uint64_t>(counters[astats::ALLOCS], 1)),
+                nsamples ? all_samples[nsamples / 2] : 0,
+                nsamples ? all_samples[(nsamples * 99) / 100] : 0,
+                nsamples ? all_samples[(nsamples * 999) / 1000] : 0,
+                nsamples ? all_samples[nsamples - 1] : 0);
+
+        free(all_samples);
+        free(targs);
+        free(stats);
+        allocator.reset();
+    }
+};
+
+template<typename allocator_t>
+static void
+run_all_mults(const char * const name) {
+    if (allocator_name && strcmp(allocator_name, "all") &&
+        strcmp(allocator_name, name)) {
+        return;
+    }
+    oversub_bench<allocator_t> * ob = new oversub_bench<allocator_t>();
+    for (uint32_t mult = mult_min; mult <= mult_max; mult *= 2) {
+        ob->run(name, mult);
+    }
+    delete ob;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-mmin",
+            "--mult-min",
+            false,
+            Int,
+            mult_min,
+            "Starting threads per cpu (goes up by powers of 2)");
+    ADD_ARG("-mmax",
+            "--mult-max",
+            false,
+            Int,
+            mult_max,
+            "Ending (inclusive) threads per cpu");
+    ADD_ARG("-s",
+            "--size",
+            false,
+            Int,
+            ops_per_thread,
+            "Allocations PER THREAD");
+    ADD_ARG("-hop",
+            "--hop-interval",
+            false,
+            Int,
+            hop_interval,
+            "Migrate to next cpu every N batches (0 to disable)");
+    ADD_ARG("-a",
+            "--allocator",
+            false,
+            String,
+            allocator_name,
+            "fixed, dynamic or all");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(mult_min, "Need at least 1 thread per cpu\n");
+
+    fprintf(stdout,
+            "%-8s %6s %8s %8s %12s %12s %10s %10s %10s %10s\n",
+            "alloc",
+            "mult",
+            "threads",
+            "hops",
+            "Mops/sec",
+            "aborts/alloc",
+            "p50 cyc",
+            "p99 cyc",
+            "p99.9 cyc",
+            "max cyc");
+
+    run_all_mults<fixed_slab_manager<uint64_t, 2, 1, 1, 2>>("fixed");
+    run_all_mults<
+        dynamic_slab_manager<uint64_t, 1, reclaim_policy::SHARED, 1, 8>>(
+        "dynamic");
+}
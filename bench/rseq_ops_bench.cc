@@ -0,0 +1,468 @@
+#include <allocator/common/safe_atomics.h>
+#include <allocator/common/vec_constants.h>
+#include <allocator/rseq/rseq_base.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+
+//////////////////////////////////////////////////////////////////////
+// Cycles / ns per op for every op in rseq_ops.h next to its lock prefixed
+// atomic equivalent. Each is run:
+//  uncontended : 1 thread, its own cache line
+//  same_cpu    : nthreads pinned to one cpu sharing that cpu's line (so
+//                preemption / rseq aborts but no coherence traffic)
+//  cross_cpu   : 1 thread per cpu all hitting the same line (coherence
+//                traffic, for the rseq ops this is not a correct use and only
+//                measures the cost of the line bouncing). rseq_any_cpu_* ops
+//                always use their own cpu's line which is the point of them.
+//
+// Conditional ops are paired with their inverse (or_if_unset / xor_if_set,
+// rseq_or / rseq_and, xor / xor) so the uncontended case always takes the
+// success path. Pairs count as 2 ops.
+
+uint32_t nthreads = 4;
+uint64_t niters   = (1 << 22);
+char *   op_name  = NULL;
+
+enum mode { UNCONTENDED = 0, SAME_CPU = 1, CROSS_CPU = 2, NMODES = 3 };
+static const char * const mode_names[NMODES] = { "uncontended",
+                                                 "same_cpu",
+                                                 "cross_cpu" };
+
+// one line per cpu, same layout rseq_any_cpu_* expects
+struct alignas(CACHE_LINE_SIZE) percpu_line {
+    uint64_t w[CACHE_LINE_SIZE / sizeof(uint64_t)];
+};
+
+//////////////////////////////////////////////////////////////////////
+// ops. Each has a static ops_per_iter, rseq(...) and atomic(...). w is the
+// word for this thread, fw a second word on another line (for reclaim), base
+// the start of the per cpu lines
+
+#define RSEQ_OP_ARGS                                                           \
+    uint64_t *const w, uint64_t *const fw, uint64_t *const base,               \
+        const uint64_t i, const uint32_t start_cpu
+
+struct op_or_if_unset {
+    static constexpr const char *   name         = "or_if_unset";
+    static constexpr const uint32_t ops_per_iter = 2;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        or_if_unset(w, (1UL) << (i % 64), start_cpu);
+        xor_if_set(w, (1UL) << (i % 64), start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)start_cpu;
+        if (!(__atomic_fetch_or(w, (1UL) << (i % 64), __ATOMIC_RELAXED) &
+              ((1UL) << (i % 64)))) {
+            __atomic_fetch_and(w, ~((1UL) << (i % 64)), __ATOMIC_RELAXED);
+        }
+    }
+};
+
+struct op_rseq_xor {
+    static constexpr const char *   name         = "rseq_xor";
+    static constexpr const uint32_t ops_per_iter = 2;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        rseq_xor(w, (1UL) << (i % 64), start_cpu);
+        rseq_xor(w, (1UL) << (i % 64), start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)start_cpu;
+        atomic_xor(w, (1UL) << (i % 64));
+        atomic_xor(w, (1UL) << (i % 64));
+    }
+};
+
+struct op_rseq_or_and {
+    static constexpr const char *   name         = "rseq_or+rseq_and";
+    static constexpr const uint32_t ops_per_iter = 2;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        rseq_or(w, (1UL) << (i % 64), start_cpu);
+        rseq_and(w, ~((1UL) << (i % 64)), start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)start_cpu;
+        atomic_or(w, (1UL) << (i % 64));
+        atomic_unset(w, (1UL) << (i % 64));
+    }
+};
+
+struct op_xor_if_set {
+    static constexpr const char *   name         = "xor_if_set";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        // set bit with plain store first, we only want to time the op
+        *w = (1UL) << (i % 64);
+        xor_if_set(w, (1UL) << (i % 64), start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)start_cpu;
+        *w = (1UL) << (i % 64);
+        __atomic_fetch_and(w, ~((1UL) << (i % 64)), __ATOMIC_RELAXED);
+    }
+};
+
+struct op_try_reclaim_free_slots {
+    static constexpr const char *   name         = "try_reclaim_free_slots";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)base;
+        *w  = vec::FULL;
+        *fw = (3UL) << (i % 63);
+        try_reclaim_free_slots(w, fw, start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)base;
+        (void)start_cpu;
+        *w  = vec::FULL;
+        *fw = (3UL) << (i % 63);
+        const uint64_t reclaimed =
+            __atomic_exchange_n(fw, 0, __ATOMIC_RELAXED);
+        atomic_xor(w, reclaimed & (reclaimed - 1));
+    }
+};
+
+struct op_try_reclaim_all_free_slabs {
+    static constexpr const char *   name         = "try_reclaim_all_free_slabs";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)base;
+        *w  = vec::FULL;
+        *fw = (3UL) << (i % 63);
+        try_reclaim_all_free_slabs(w, fw, start_cpu);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)base;
+        (void)start_cpu;
+        *w  = vec::FULL;
+        *fw = (3UL) << (i % 63);
+        atomic_xor(w, __atomic_exchange_n(fw, 0, __ATOMIC_RELAXED));
+    }
+};
+
+struct op_acquire_lock {
+    static constexpr const char *   name         = "acquire_lock";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)i;
+        if (!acquire_lock(w, start_cpu)) {
+            *w = 0;
+        }
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)i;
+        (void)start_cpu;
+        if (!__atomic_exchange_n(w, 1, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(w, 0, __ATOMIC_RELEASE);
+        }
+    }
+};
+
+struct op_rseq_any_cpu_or {
+    static constexpr const char *   name         = "rseq_any_cpu_or";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)w;
+        (void)fw;
+        (void)start_cpu;
+        rseq_any_cpu_or(base, (1UL) << (i % 64));
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)start_cpu;
+        atomic_or(w, (1UL) << (i % 64));
+    }
+};
+
+struct op_rseq_any_cpu_incr {
+    static constexpr const char *   name         = "rseq_any_cpu_incr";
+    static constexpr const uint32_t ops_per_iter = 1;
+    static void ALWAYS_INLINE
+    rseq(RSEQ_OP_ARGS) {
+        (void)w;
+        (void)fw;
+        (void)i;
+        (void)start_cpu;
+        rseq_any_cpu_incr(base);
+    }
+    static void ALWAYS_INLINE
+    atomic(RSEQ_OP_ARGS) {
+        (void)fw;
+        (void)base;
+        (void)i;
+        (void)start_cpu;
+        __atomic_fetch_add(w, 1, __ATOMIC_RELAXED);
+    }
+};
+
+#undef RSEQ_OP_ARGS
+
+//////////////////////////////////////////////////////////////////////
+// runner
+
+struct thread_times {
+    uint64_t cycles;
+    uint64_t ns;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+template<typename op_t, bool use_rseq>
+struct op_runner {
+    percpu_line *     lines;
+    percpu_line *     free_lines;
+    pthread_barrier_t b;
+    mode              m;
+    uint32_t          shared_cpu;
+    uint32_t          nlines;
+    thread_times *    times;
+
+    void
+    run_thread(const uint32_t tid) {
+        pthread_barrier_wait(&b);
+        const uint64_t start_ns = bench::get_ns();
+        const uint64_t start    = bench::get_cycles();
+        for (uint64_t i = 0; i < niters; ++i) {
+            const uint32_t start_cpu = get_start_cpu();
+
+            // cross_cpu shares 1 line between every cpu, otherwise use the
+            // line of the cpu we are on (there is one for every possible cpu)
+            const uint32_t line = m == CROSS_CPU ? shared_cpu : start_cpu;
+            if constexpr (use_rseq) {
+                op_t::rseq(lines[line].w,
+                           free_lines[line].w,
+                           lines[0].w,
+                           i,
+                           start_cpu);
+            }
+            else {
+                op_t::atomic(lines[line].w,
+                             free_lines[line].w,
+                             lines[0].w,
+                             i,
+                             start_cpu);
+            }
+        }
+        times[tid].cycles = bench::get_cycles() - start;
+        times[tid].ns     = bench::get_ns() - start_ns;
+    }
+
+    struct targ {
+        op_runner * r;
+        uint32_t    tid;
+    } ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    static void *
+    run_thread_wrapper(void * arg) {
+        init_thread();
+        targ * const t = (targ *)arg;
+        t->r->run_thread(t->tid);
+        return NULL;
+    }
+
+    // returns false if the mode can't run on this machine
+    bool
+    run(const mode _m, double * const cycles_per_op, double * const ns_per_op) {
+        m = _m;
+
+        // sized for the host we run on, not the NPROCS we were built with
+        nlines                = sysi::runtime_nprocs();
+        uint32_t * const cpus = (uint32_t *)calloc(nlines, sizeof(uint32_t));
+        ERROR_ASSERT(cpus);
+        const uint32_t ncpus = bench::allowed_cpus(cpus, nlines);
+        shared_cpu           = cpus[0];
+
+        uint32_t _nthreads;
+        switch (m) {
+            case UNCONTENDED:
+                _nthreads = 1;
+                break;
+            case SAME_CPU:
+                _nthreads = nthreads;
+                break;
+            case CROSS_CPU:
+                if (ncpus < 2) {
+                    free(cpus);
+                    return false;
+                }
+                _nthreads = ncpus;
+                break;
+            default:
+                DIE("Unknown mode: %d\n", m);
+        }
+
+        lines = (percpu_line *)aligned_alloc(CACHE_LINE_SIZE,
+                                             nlines * sizeof(percpu_line));
+        free_lines = (percpu_line *)aligned_alloc(CACHE_LINE_SIZE,
+                                                  nlines * sizeof(percpu_line));
+        times      = (thread_times *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            _nthreads * sizeof(thread_times));
+        targ * targs = (targ *)aligned_alloc(CACHE_LINE_SIZE,
+                                             _nthreads * sizeof(targ));
+        pthread_t * tids = (pthread_t *)calloc(_nthreads, sizeof(pthread_t));
+        ERROR_ASSERT(lines && free_lines && times && targs && tids);
+        memset(lines, 0, nlines * sizeof(percpu_line));
+        memset(free_lines, 0, nlines * sizeof(percpu_line));
+
+        ERROR_ASSERT(!pthread_barrier_init(&b, NULL, _nthreads));
+        for (uint32_t i = 0; i < _nthreads; ++i) {
+            targs[i].r   = this;
+            targs[i].tid = i;
+
+            pthread_attr_t attr;
+            ERROR_ASSERT(!pthread_attr_init(&attr));
+            cpu_set_t cset;
+            CPU_ZERO(&cset);
+            CPU_SET(m == CROSS_CPU ? cpus[i] : cpus[0], &cset);
+            ERROR_ASSERT(!pthread_attr_setaffinity_np(&attr,
+                                                      sizeof(cpu_set_t),
+                                                      &cset));
+            ERROR_ASSERT(!pthread_create(tids + i,
+                                         &attr,
+                                         &op_runner::run_thread_wrapper,
+                                         (void *)(targs + i)));
+            pthread_attr_destroy(&attr);
+        }
+        for (uint32_t i = 0; i < _nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        pthread_barrier_destroy(&b);
+
+        // per thread average so contended numbers read as latency
+        uint64_t cycles = 0, ns = 0;
+        for (uint32_t i = 0; i < _nthreads; ++i) {
+            cycles += times[i].cycles;
+            ns += times[i].ns;
+        }
+        const double nops = ((double)_nthreads) * niters * op_t::ops_per_iter;
+        *cycles_per_op    = ((double)cycles) / nops;
+        *ns_per_op        = ((double)ns) / nops;
+
+        free(tids);
+        free(targs);
+        free(times);
+        free(free_lines);
+        free(lines);
+        free(cpus);
+        return true;
+    }
+};
+
+template<typename op_t>
+static void
+bench_op() {
+    if (op_name && strcmp(op_name, "all") && strcmp(op_name, op_t::name)) {
+        return;
+    }
+    for (uint32_t _m = 0; _m < NMODES; ++_m) {
+        double rseq_cycles = 0, rseq_ns = 0, atomic_cycles = 0, atomic_ns = 0;
+
+        op_runner<op_t, true> * rr = new op_runner<op_t, true>();
+        const bool ran = rr->run((mode)_m, &rseq_cycles, &rseq_ns);
+        delete rr;
+        if (!ran) {
+            fprintf(stdout,
+                    "%-28s %-12s %12s %10s %12s %10s\n",
+                    op_t::name,
+                    mode_names[_m],
+                    "n/a",
+                    "n/a",
+                    "n/a",
+                    "n/a");
+            continue;
+        }
+
+        op_runner<op_t, false> * ar = new op_runner<op_t, false>();
+        ar->run((mode)_m, &atomic_cycles, &atomic_ns);
+        delete ar;
+
+        fprintf(stdout,
+                "%-28s %-12s %12.2f %10.2f %12.2f %10.2f\n",
+                op_t::name,
+                mode_names[_m],
+                rseq_cycles,
+                rseq_ns,
+                atomic_cycles,
+                atomic_ns);
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t",
+            "--threads",
+            false,
+            Int,
+            nthreads,
+            "Threads for same_cpu contention");
+    ADD_ARG("-s", "--size", false, Int, niters, "Iterations PER THREAD");
+    ADD_ARG("-o", "--op", false, String, op_name, "Op to run (or all)");
+    PARSE_ARGUMENTS;
+
+    fprintf(stdout,
+            "%-28s %-12s %12s %10s %12s %10s\n",
+            "op",
+            "mode",
+            "rseq cyc/op",
+            "rseq ns/op",
+            "atomic cyc",
+            "atomic ns");
+
+    bench_op<op_or_if_unset>();
+    bench_op<op_xor_if_set>();
+    bench_op<op_rseq_xor>();
+    bench_op<op_rseq_or_and>();
+    bench_op<op_try_reclaim_free_slots>();
+    bench_op<op_try_reclaim_all_free_slabs>();
+    bench_op<op_acquire_lock>();
+    bench_op<op_rseq_any_cpu_or>();
+    bench_op<op_rseq_any_cpu_incr>();
+}
@@ -0,0 +1,133 @@
+#include <allocator/magazine/magazine_cache.h>
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/growable_slab_manager.h>
+#include <allocator/vec_layout/vec_manager.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "workloads.h"
+
+//////////////////////////////////////////////////////////////////////
+// Runs the workloads in workloads.h against each of the managers and glibc
+// malloc.
+
+static constexpr const uint32_t obj_size = 64;
+struct obj_t {
+    uint64_t data[obj_size / sizeof(uint64_t)];
+};
+
+// manager_t with a magazine_cache in front
+template<typename T, typename manager_t>
+struct magazine_allocator {
+    manager_t                    backing;
+    magazine_cache<T, manager_t> cache;
+
+    magazine_allocator() : cache(&backing) {}
+
+    T *
+    _allocate() {
+        return cache._allocate();
+    }
+
+    void
+    _free(T * addr) {
+        cache._free(addr);
+    }
+};
+
+uint32_t nthreads       = sysi::runtime_nprocs();
+uint32_t ops_per_thread = (1 << 20);
+char *   workload_name  = NULL;
+char *   allocator_name = NULL;
+
+static bool
+selected(const char * const choice, const char * const name) {
+    return choice == NULL || (!strcmp(choice, "all")) || (!strcmp(choice, name));
+}
+
+template<typename allocator_t>
+static void
+run_all_workloads(const char * const name) {
+    if (!selected(allocator_name, name)) {
+        return;
+    }
+    workload_bench<allocator_t> wb;
+    for (uint32_t w = 0; w < NWORKLOADS; ++w) {
+        if (selected(workload_name, workload_names[w])) {
+            const workload_result res =
+                wb.run((workload)w, nthreads, ops_per_thread);
+            fprintf(stdout,
+                    "%-12s %-10s %8u %12.3f %10.2f %10lu\n",
+                    workload_names[w],
+                    name,
+                    res.nthreads,
+                    res.mops(),
+                    res.ns_per_op(),
+                    res.nfailed);
+        }
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s",
+            "--size",
+            false,
+            Int,
+            ops_per_thread,
+            "Allocator calls PER THREAD");
+    ADD_ARG("-w",
+            "--workload",
+            false,
+            String,
+            workload_name,
+            "threadtest, larson, prodcon, shbench or all");
+    ADD_ARG("-a",
+            "--allocator",
+            false,
+            String,
+            allocator_name,
+            "fixed, fixed-core, fixed-llc, fixed-depot, fixed-mag, growable, "
+            "dynamic, vec, glibc or all");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    fprintf(stdout,
+            "%-12s %-10s %8s %12s %10s %10s\n",
+            "workload",
+            "allocator",
+            "threads",
+            "Mops/sec",
+            "ns/op",
+            "failed");
+
+    run_all_workloads<fixed_slab_manager<obj_t, 2, 1, 1, 2>>("fixed");
+    run_all_workloads<
+        sharded_fixed_slab_manager<obj_t, PER_CORE, 0, 2, 1, 1, 2>>("fixed-core");
+    run_all_workloads<sharded_fixed_slab_manager<obj_t, PER_LLC, 0, 2, 1, 1, 2>>(
+        "fixed-llc");
+    run_all_workloads<depot_fixed_slab_manager<obj_t, 64, 2, 1, 1, 2>>(
+        "fixed-depot");
+    run_all_workloads<
+        magazine_allocator<obj_t, fixed_slab_manager<obj_t, 2, 1, 1, 2>>>(
+        "fixed-mag");
+    run_all_workloads<growable_slab_manager<obj_t, 2, 1, 1, 2>>("growable");
+    run_all_workloads<
+        dynamic_slab_manager<obj_t, 1, reclaim_policy::SHARED, 1, 8>>(
+        "dynamic");
+    run_all_workloads<fixed_vec_manager<obj_t, 2, 1, 1, 2>>("vec");
+    run_all_workloads<glibc_allocator<obj_t>>("glibc");
+}
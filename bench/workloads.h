@@ -0,0 +1,376 @@
+#ifndef _WORKLOADS_H_
+#define _WORKLOADS_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/sys_info.h>
+
+#include <allocator/rseq/rseq_base.h>
+
+#include "bench_util.h"
+
+//////////////////////////////////////////////////////////////////////
+// Classic allocator workloads (threadtest, larson, producer-consumer and
+// shbench style mixed lifetimes) that can be run against any allocator_t
+// with the slab manager interface. Every workload reports total alloc + free
+// calls so the numbers are comparable across workloads.
+
+// threadtest: batches allocated and freed by the same thread
+static constexpr const uint32_t threadtest_batch = 128;
+
+// larson: slots per thread, arrays are handed to the next thread each round
+static constexpr const uint32_t larson_slots  = 1024;
+static constexpr const uint32_t larson_rounds = 16;
+
+// producer-consumer: spsc ring between each producer/consumer pair
+static constexpr const uint32_t prodcon_ring = 1024;
+
+// shbench: short and long lived pools with 1 / shbench_long_ratio allocations
+// going to the long lived pool
+static constexpr const uint32_t shbench_short      = 16;
+static constexpr const uint32_t shbench_long       = 2048;
+static constexpr const uint32_t shbench_long_ratio = 8;
+
+enum workload { THREADTEST = 0, LARSON = 1, PRODCON = 2, SHBENCH = 3, NWORKLOADS = 4 };
+static const char * const workload_names[NWORKLOADS] = { "threadtest",
+                                                         "larson",
+                                                         "prodcon",
+                                                         "shbench" };
+
+template<typename allocator_t>
+struct workload_bench;
+
+template<typename allocator_t>
+struct thread_arg {
+    workload_bench<allocator_t> * wb;
+    uint32_t                      tid;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+struct spsc_ring {
+    void *            slots[prodcon_ring];
+    volatile uint64_t head ALIGN_ATTR(CACHE_LINE_SIZE);
+    volatile uint64_t tail ALIGN_ATTR(CACHE_LINE_SIZE);
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+// what a single run of a workload measured
+struct workload_result {
+    uint32_t nthreads;
+    uint64_t nops;
+    uint64_t ns;
+    uint64_t nfailed;
+
+    double
+    mops() const {
+        return ((double)nops * 1000.0) / ((double)ns);
+    }
+
+    double
+    ns_per_op() const {
+        return ((double)ns * nthreads) / ((double)nops);
+    }
+};
+
+template<typename allocator_t>
+struct workload_bench {
+    using obj_t = typename std::remove_pointer<decltype(
+        std::declval<allocator_t &>()._allocate())>::type;
+
+    allocator_t *           allocator;
+    workload                w;
+    uint32_t                nthreads;
+    uint32_t                ops_per_thread;
+    pthread_barrier_t       b;
+    bench::thread_result *  results;
+    thread_arg<allocator_t> * targs;
+
+    // larson
+    obj_t ** larson_arrays;
+
+    // prodcon
+    spsc_ring * rings;
+
+
+    static void ALWAYS_INLINE
+    touch(obj_t * const obj, const uint64_t v) {
+        *((volatile uint8_t *)obj) = v;
+    }
+
+    void
+    threadtest(const uint32_t tid) {
+        bench::thread_result * const r = results + tid;
+        obj_t *                      batch[threadtest_batch];
+        const uint32_t nbatches = cmath::max<uint32_t>(
+            ops_per_thread / (2 * threadtest_batch), 1);
+
+        pthread_barrier_wait(&b);
+        r->start_ns = bench::get_ns();
+        for (uint32_t i = 0; i < nbatches; ++i) {
+            for (uint32_t j = 0; j < threadtest_batch; ++j) {
+                batch[j] = allocator->_allocate();
+                if (BRANCH_UNLIKELY(batch[j] == NULL)) {
+                    ++r->nfailed;
+                    continue;
+                }
+                touch(batch[j], j);
+            }
+            for (uint32_t j = 0; j < threadtest_batch; ++j) {
+                if (BRANCH_LIKELY(batch[j] != NULL)) {
+                    allocator->_free(batch[j]);
+                }
+            }
+        }
+        r->end_ns = bench::get_ns();
+        r->nops   = 2UL * nbatches * threadtest_batch;
+    }
+
+    void
+    larson(const uint32_t tid) {
+        bench::thread_result * const r = results + tid;
+        uint64_t                     rng_state = tid + 1;
+        const uint32_t ops_per_round =
+            cmath::max<uint32_t>(ops_per_thread / (2 * larson_rounds), 1);
+
+        obj_t ** arr = larson_arrays + tid * larson_slots;
+        for (uint32_t i = 0; i < larson_slots; ++i) {
+            arr[i] = allocator->_allocate();
+        }
+
+        pthread_barrier_wait(&b);
+        r->start_ns = bench::get_ns();
+        for (uint32_t round = 0; round < larson_rounds; ++round) {
+            // each round works on the array last owned by another thread so
+            // most frees are of objects allocated elsewhere
+            arr = larson_arrays + ((tid + round) % nthreads) * larson_slots;
+            for (uint32_t i = 0; i < ops_per_round; ++i) {
+                const uint32_t idx =
+                    rutil::next_rand(&rng_state) % larson_slots;
+                if (BRANCH_LIKELY(arr[idx] != NULL)) {
+                    allocator->_free(arr[idx]);
+                }
+                arr[idx] = allocator->_allocate();
+                if (BRANCH_UNLIKELY(arr[idx] == NULL)) {
+                    ++r->nfailed;
+                    continue;
+                }
+                touch(arr[idx], i);
+            }
+            pthread_barrier_wait(&b);
+        }
+        r->end_ns = bench::get_ns();
+        r->nops   = 2UL * larson_rounds * ops_per_round;
+
+        pthread_barrier_wait(&b);
+        arr = larson_arrays + tid * larson_slots;
+        for (uint32_t i = 0; i < larson_slots; ++i) {
+            if (arr[i]) {
+                allocator->_free(arr[i]);
+            }
+        }
+    }
+
+    void
+    producer(spsc_ring * const ring, bench::thread_result * const r) {
+        const uint64_t nobjs = ops_per_thread;
+        uint64_t       tail  = 0;
+        for (uint64_t i = 0; i < nobjs; ++i) {
+            obj_t * const obj = allocator->_allocate();
+            if (BRANCH_UNLIKELY(obj == NULL)) {
+                ++r->nfailed;
+            }
+            else {
+                touch(obj, i);
+            }
+            while (BRANCH_UNLIKELY(tail - ring->head == prodcon_ring)) {
+                sched_yield();
+            }
+            ring->slots[tail % prodcon_ring] = obj;
+            __atomic_store_n(&(ring->tail), ++tail, __ATOMIC_RELEASE);
+        }
+        r->nops = nobjs;
+    }
+
+    void
+    consumer(spsc_ring * const ring, bench::thread_result * const r) {
+        const uint64_t nobjs = ops_per_thread;
+        uint64_t       head  = 0;
+        while (head < nobjs) {
+            while (head == __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE)) {
+                sched_yield();
+            }
+            obj_t * const obj = (obj_t *)ring->slots[head % prodcon_ring];
+            ring->head        = ++head;
+            if (BRANCH_LIKELY(obj != NULL)) {
+                allocator->_free(obj);
+            }
+        }
+        r->nops = nobjs;
+    }
+
+    void
+    prodcon(const uint32_t tid) {
+        bench::thread_result * const r = results + tid;
+        pthread_barrier_wait(&b);
+        r->start_ns = bench::get_ns();
+        if (tid & 0x1) {
+            consumer(rings + (tid / 2), r);
+        }
+        else {
+            producer(rings + (tid / 2), r);
+        }
+        r->end_ns = bench::get_ns();
+    }
+
+    void
+    shbench(const uint32_t tid) {
+        bench::thread_result * const r = results + tid;
+        uint64_t                     rng_state = tid + 1;
+        obj_t *                      short_lived[shbench_short];
+        obj_t **                     long_lived =
+            (obj_t **)calloc(shbench_long, sizeof(obj_t *));
+        ERROR_ASSERT(long_lived);
+        memset(short_lived, 0, sizeof(short_lived));
+
+        const uint32_t nallocs = cmath::max<uint32_t>(ops_per_thread / 2, 1);
+        uint32_t       nfrees  = 0;
+
+        pthread_barrier_wait(&b);
+        r->start_ns = bench::get_ns();
+        for (uint32_t i = 0; i < nallocs; ++i) {
+            obj_t * const obj = allocator->_allocate();
+            if (BRANCH_UNLIKELY(obj == NULL)) {
+                ++r->nfailed;
+                continue;
+            }
+            touch(obj, i);
+
+            const uint64_t rand = rutil::next_rand(&rng_state);
+            obj_t **       slot = (rand % shbench_long_ratio)
+                                ? short_lived + (i % shbench_short)
+                                : long_lived + ((rand >> 32) % shbench_long);
+            if (*slot) {
+                allocator->_free(*slot);
+                ++nfrees;
+            }
+            *slot = obj;
+        }
+        r->end_ns = bench::get_ns();
+        r->nops   = nallocs + nfrees;
+
+        for (uint32_t i = 0; i < shbench_short; ++i) {
+            if (short_lived[i]) {
+                allocator->_free(short_lived[i]);
+            }
+        }
+        for (uint32_t i = 0; i < shbench_long; ++i) {
+            if (long_lived[i]) {
+                allocator->_free(long_lived[i]);
+            }
+        }
+        free(long_lived);
+    }
+
+    static void *
+    run_thread(void * targ) {
+        init_thread();
+        thread_arg<allocator_t> * const arg = (thread_arg<allocator_t> *)targ;
+        switch (arg->wb->w) {
+            case THREADTEST:
+                arg->wb->threadtest(arg->tid);
+                break;
+            case LARSON:
+                arg->wb->larson(arg->tid);
+                break;
+            case PRODCON:
+                arg->wb->prodcon(arg->tid);
+                break;
+            case SHBENCH:
+                arg->wb->shbench(arg->tid);
+                break;
+            default:
+                DIE("Unknown workload: %d\n", arg->wb->w);
+        }
+        return NULL;
+    }
+
+    workload_result
+    run(const workload _w, const uint32_t _nthreads, const uint32_t _ops_per_thread) {
+        w              = _w;
+        ops_per_thread = _ops_per_thread;
+
+        // prodcon needs producer/consumer pairs
+        nthreads = w == PRODCON ? cmath::roundup<uint32_t>(_nthreads, 2)
+                                : _nthreads;
+
+        allocator = new allocator_t();
+        results   = (bench::thread_result *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            nthreads * sizeof(bench::thread_result));
+        targs = (thread_arg<allocator_t> *)aligned_alloc(
+            CACHE_LINE_SIZE,
+            nthreads * sizeof(thread_arg<allocator_t>));
+        ERROR_ASSERT(results && targs);
+        memset(results, 0, nthreads * sizeof(bench::thread_result));
+
+        larson_arrays = NULL;
+        rings         = NULL;
+        if (w == LARSON) {
+            larson_arrays =
+                (obj_t **)calloc(nthreads * larson_slots, sizeof(obj_t *));
+            ERROR_ASSERT(larson_arrays);
+        }
+        else if (w == PRODCON) {
+            rings = (spsc_ring *)aligned_alloc(
+                CACHE_LINE_SIZE,
+                (nthreads / 2) * sizeof(spsc_ring));
+            ERROR_ASSERT(rings);
+            memset(rings, 0, (nthreads / 2) * sizeof(spsc_ring));
+        }
+
+        ERROR_ASSERT(!pthread_barrier_init(&b, NULL, nthreads));
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            targs[i].wb  = this;
+            targs[i].tid = i;
+        }
+
+        bench::thread_group tg;
+        tg.spawn(nthreads,
+                 &workload_bench<allocator_t>::run_thread,
+                 (void *)targs,
+                 sizeof(thread_arg<allocator_t>));
+        tg.join();
+
+        uint64_t nops = 0, nfailed = 0;
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            nops += results[i].nops;
+            nfailed += results[i].nfailed;
+        }
+        workload_result res;
+        res.nthreads = nthreads;
+        res.nops     = nops;
+        res.nfailed  = nfailed;
+        res.ns       = bench::elapsed_ns(results, nthreads);
+
+        pthread_barrier_destroy(&b);
+        if (larson_arrays) {
+            free(larson_arrays);
+        }
+        if (rings) {
+            free(rings);
+        }
+        free(targs);
+        free(results);
+        delete allocator;
+        return res;
+    }
+};
+
+#endif
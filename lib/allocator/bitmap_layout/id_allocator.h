@@ -0,0 +1,71 @@
+#ifndef _ID_ALLOCATOR_H_
+#define _ID_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <optimized/atomic_bit_vector.h>
+#include <system/runtime_sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/rseq/rseq_base.h>
+
+//////////////////////////////////////////////////////////////////////
+// Concurrent allocator for small integer ids in [0, max_ids) (connection
+// ids, file table slots, indexes into an array the caller owns). Backed by a
+// vatm::atomic_bit_set so it is the same 64 bit claim-by-atomic-or as the
+// slab bitmaps with a summary level to skip full words.
+//
+// _allocate() always returns the lowest free id it can find (like open()
+// with fds) so ids stay dense. _allocate_spread() starts each cpu at its own
+// share of the id space which keeps cpus from fighting over the same words
+// when density doesn't matter.
+
+template<uint32_t max_ids>
+struct id_allocator {
+    using bit_set_t = vatm::atomic_bit_set<max_ids>;
+
+    static constexpr const uint32_t NO_ID    = (~(0U));
+    static constexpr const uint32_t capacity = max_ids;
+
+    bit_set_t ids;
+    uint32_t  nprocs;
+
+    id_allocator() : nprocs(sysi::runtime_nprocs()) {}
+
+    uint32_t ALWAYS_INLINE
+    is_allocated(const uint32_t id) const {
+        return ids.is_set(id);
+    }
+
+    uint32_t
+    _allocate_from(const uint32_t start_leaf) {
+        ALLOC_STAT_INCR(ALLOCS);
+        const uint32_t id = ids.set(start_leaf);
+        if (BRANCH_UNLIKELY(id == bit_set_t::bit_scan_failure())) {
+            ALLOC_STAT_INCR(FULL);
+            return NO_ID;
+        }
+        return id;
+    }
+
+    uint32_t ALWAYS_INLINE
+    _allocate() {
+        return _allocate_from(0);
+    }
+
+    uint32_t ALWAYS_INLINE
+    _allocate_spread() {
+        // cpu_id_start is only a hint here, no rseq
+        const uint32_t cpu = get_start_cpu() % nprocs;
+        return _allocate_from((cpu * bit_set_t::nleaves) / nprocs);
+    }
+
+    void ALWAYS_INLINE
+    _free(const uint32_t id) {
+        ALLOC_STAT_INCR(FREES);
+        ids.unset(id);
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _ALLOC_STATS_H_
+#define _ALLOC_STATS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/cpp_attributes.h>
+
+//////////////////////////////////////////////////////////////////////
+// Optional per thread event counters for the slab managers. Everything
+// compiles away unless ALLOC_STATS is defined before the allocator headers
+// are included so the fast path is unchanged for normal builds.
+
+namespace astats {
+
+enum counter {
+    ALLOCS        = 0,
+    FREES         = 1,
+    REMOTE_FREES  = 2,  // free from a cpu other than the owner
+    RSEQ_ABORTS   = 3,  // FAILED_RSEQ / WAS_PREEMPTED retries
+    FULL          = 4,  // allocation returned NULL
+    DEPOT_BORROWS = 5,  // slab taken from a fixed manager's depot
+    SLAB_GROWS    = 6,  // slab attached by a growable manager
+    MAG_REFILLS   = 7,  // magazine filled straight from the backing manager
+    NCOUNTERS     = 8
+};
+
+static const char * const counter_names[NCOUNTERS] = { "allocs",
+                                                       "frees",
+                                                       "remote_frees",
+                                                       "rseq_aborts",
+                                                       "full",
+                                                       "depot_borrows",
+                                                       "slab_grows",
+                                                       "mag_refills" };
+
+__thread uint64_t thread_counters[NCOUNTERS];
+
+void
+reset_thread_counters() {
+    memset(thread_counters, 0, sizeof(thread_counters));
+}
+
+}  // namespace astats
+
+#ifdef ALLOC_STATS
+#define ALLOC_STAT_INCR(X) (++(astats::thread_counters[astats::X]))
+#else
+#define ALLOC_STAT_INCR(X)
+#endif
+
+#endif
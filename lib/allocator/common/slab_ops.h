@@ -0,0 +1,134 @@
+#ifndef _SLAB_OPS_H_
+#define _SLAB_OPS_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+
+#include <allocator/common/safe_atomics.h>
+#include <allocator/rseq/rseq_base.h>
+
+//////////////////////////////////////////////////////////////////////
+// Operations obj_slab / super_slab use to update the bit vectors owned by
+// whoever is allocating from them. Return values match rseq_ops.h (non-zero
+// means the caller should treat it as an abort and retry).
+//
+// rseq_slab_ops: slab is owned by a single cpu so everything is a restartable
+// sequence pinned to start_cpu.
+//
+// locked_slab_ops: slab is shared by a group of cpus (SMT siblings, an LLC
+// ...) so everything has to be lock prefixed. start_cpu is ignored.
+//
+// can_bump: obj_slab hands out never used slots with bump (see rseq_bump)
+// before searching its bitmap. Only rseq, without it another cpu in the group
+// could find_first_zero a word between the cursor moving into it and the
+// word being marked.
+
+struct rseq_slab_ops {
+    static constexpr const uint32_t can_bump = 1;
+
+    static uint32_t ALWAYS_INLINE
+    or_if_unset(uint64_t * const v,
+                const uint64_t   new_bit_mask,
+                const uint32_t   start_cpu) {
+        return ::or_if_unset(v, new_bit_mask, start_cpu);
+    }
+
+    static uint32_t ALWAYS_INLINE
+    xor_bits(uint64_t * const v,
+             const uint64_t   new_bit_mask,
+             const uint32_t   start_cpu) {
+        return rseq_xor(v, new_bit_mask, start_cpu);
+    }
+
+    static uint32_t ALWAYS_INLINE
+    and_bits(uint64_t * const v,
+             const uint64_t   new_bit_mask,
+             const uint32_t   start_cpu) {
+        return rseq_and(v, new_bit_mask, start_cpu);
+    }
+
+    static uint32_t ALWAYS_INLINE
+    acquire_lock(uint64_t * const lock_ptr, const uint32_t start_cpu) {
+        return ::acquire_lock(lock_ptr, start_cpu);
+    }
+
+    static uint64_t ALWAYS_INLINE
+    try_reclaim_free_slots(uint64_t * const v,
+                           uint64_t * const free_v,
+                           const uint32_t   start_cpu) {
+        return ::try_reclaim_free_slots(v, free_v, start_cpu);
+    }
+
+    static uint64_t ALWAYS_INLINE
+    try_reclaim_all_free_slabs(uint64_t * const v,
+                               uint64_t * const free_v,
+                               const uint32_t   start_cpu) {
+        return ::try_reclaim_all_free_slabs(v, free_v, start_cpu);
+    }
+
+    // returns the slot, >= limit if exhausted, ~0 if aborted
+    static uint64_t ALWAYS_INLINE
+    bump(uint64_t * const cursor,
+         uint64_t * const words,
+         const uint64_t   limit,
+         const uint32_t   start_cpu) {
+        return rseq_bump(cursor, words, limit, start_cpu);
+    }
+};
+
+struct locked_slab_ops {
+    static constexpr const uint32_t can_bump = 0;
+
+    // fails (like an abort) if the bit was already set by another cpu in the
+    // group
+    static uint32_t ALWAYS_INLINE
+    or_if_unset(uint64_t * const v, const uint64_t new_bit_mask, const uint32_t) {
+        return (__atomic_fetch_or(v, new_bit_mask, __ATOMIC_RELAXED) &
+                new_bit_mask) != 0;
+    }
+
+    static uint32_t ALWAYS_INLINE
+    xor_bits(uint64_t * const v, const uint64_t new_bit_mask, const uint32_t) {
+        atomic_xor(v, new_bit_mask);
+        return 0;
+    }
+
+    static uint32_t ALWAYS_INLINE
+    and_bits(uint64_t * const v, const uint64_t new_bit_mask, const uint32_t) {
+        __atomic_fetch_and(v, new_bit_mask, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    // lock is released with a plain store of 0 same as the rseq version
+    static uint32_t ALWAYS_INLINE
+    acquire_lock(uint64_t * const lock_ptr, const uint32_t) {
+        return __atomic_exchange_n(lock_ptr, 1, __ATOMIC_ACQUIRE) != 0;
+    }
+
+    // these are only called with the slab's freed lock held so freed_v can
+    // only gain bits underneath us
+    static uint64_t ALWAYS_INLINE
+    try_reclaim_free_slots(uint64_t * const v,
+                           uint64_t * const free_v,
+                           const uint32_t) {
+        const uint64_t reclaimed = *free_v;
+        if (reclaimed) {
+            atomic_xor(v, reclaimed & (reclaimed - 1));
+        }
+        return reclaimed;
+    }
+
+    static uint64_t ALWAYS_INLINE
+    try_reclaim_all_free_slabs(uint64_t * const v,
+                               uint64_t * const free_v,
+                               const uint32_t) {
+        const uint64_t reclaimed = *free_v;
+        if (reclaimed) {
+            atomic_xor(v, reclaimed);
+        }
+        return reclaimed;
+    }
+};
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef _STATS_PAGE_H_
+#define _STATS_PAGE_H_
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+
+//////////////////////////////////////////////////////////////////////
+// Allocator stats exported through shared memory so a sidecar (see
+// src/stats_reader.cc) can watch a running process without signals or
+// RPCs. The process writes the page, readers map it read only.
+//
+// The counters need two things from the exporting program or they stay 0:
+//   - it is built with -DALLOC_STATS (or defines ALLOC_STATS before any
+//     allocator header), otherwise ALLOC_STAT_INCR compiles to nothing.
+//     The page's counters_enabled says which it was so readers can tell
+//     "disabled" from "nothing happened".
+//   - every thread that allocates / frees calls publish_thread_counters()
+//     now and then, counts that are never published never reach the page.
+// Occupancy (sample()) works either way.
+//
+// Nothing here is on the allocation / free path. The counters are the per
+// thread ALLOC_STAT_INCR ones (alloc_stats.h). Per slab occupancy is filled
+// in by sample(), which walks the manager's bitmaps (for_each_live) from
+// whichever thread calls it. Both are meant to be called from timers /
+// housekeeping threads the application already has.
+//
+// counters[] only ever grows (each publish adds the thread's delta).
+// Everything after seq is a seqlock: sample() makes seq odd while writing,
+// readers retry until they see the same even seq before and after copying
+// (stats_reader::snapshot). A process that dies (or is stopped) in the middle
+// of sample() leaves seq odd, so readers give up after
+// STATS_SNAPSHOT_MAX_RETRIES tries and report the page as stale. Only one
+// thread at a time may call sample().
+//
+// The page is shm_open(stats_page_name(pid)), so /dev/shm/obj_alloc_stats.<pid>
+// on Linux.
+
+namespace astats {
+
+static constexpr const uint64_t STATS_PAGE_MAGIC   = 0x7374617473736c62UL;
+static constexpr const uint32_t STATS_PAGE_VERSION = 2;
+static constexpr const uint32_t STATS_MAX_SLABS    = 1024;
+static constexpr const uint32_t STATS_NAME_LEN     = 64;
+
+// each failed try yields, so this is well past any sample() that is merely
+// preempted
+static constexpr const uint32_t STATS_SNAPSHOT_MAX_RETRIES = (1 << 16);
+
+// one per slab a handle can name (the shards' then any depot slabs)
+struct slab_occupancy {
+    uint64_t live;
+    uint64_t capacity;
+};
+
+struct stats_page {
+    // magic is written last so a reader never sees a half built page
+    uint64_t magic;
+    uint32_t version;
+    uint32_t pid;
+    char     label[STATS_NAME_LEN];
+    // 1 if the exporter was built with ALLOC_STATS, counters[] are all 0
+    // otherwise
+    uint32_t counters_enabled;
+
+    uint64_t counters[NCOUNTERS] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    uint64_t       seq ALIGN_ATTR(CACHE_LINE_SIZE);
+    uint64_t       nsamples;
+    uint64_t       sample_ns;  // CLOCK_REALTIME of the last sample
+    uint32_t       nshards;
+    uint32_t       nslabs;
+    slab_occupancy slabs[STATS_MAX_SLABS];
+
+    static uint64_t
+    size() {
+        return cmath::roundup<uint64_t>(sizeof(stats_page), PAGE_SIZE);
+    }
+};
+
+void
+stats_page_name(char * const buf, const uint64_t len, const uint32_t pid) {
+    snprintf(buf, len, "/obj_alloc_stats.%u", pid);
+}
+
+// what this thread has already added to the page
+__thread uint64_t published_counters[NCOUNTERS];
+
+struct stats_exporter {
+    stats_page * page;
+    char         name[STATS_NAME_LEN];
+
+    stats_exporter(const char * const label) {
+        stats_page_name(name, STATS_NAME_LEN, getpid());
+        const int32_t fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ERROR_ASSERT(fd >= 0, "shm_open(%s) failed\n", name);
+        ERROR_ASSERT(!ftruncate(fd, stats_page::size()),
+                     "ftruncate(%s) failed\n",
+                     name);
+        page = (stats_page *)safe_mmap(NULL,
+                                       stats_page::size(),
+                                       (PROT_READ | PROT_WRITE),
+                                       MAP_SHARED,
+                                       fd,
+                                       0);
+        close(fd);
+
+        page->version = STATS_PAGE_VERSION;
+        page->pid     = getpid();
+        strncpy(page->label, label, STATS_NAME_LEN - 1);
+#ifdef ALLOC_STATS
+        page->counters_enabled = 1;
+#endif
+        __atomic_store_n(&(page->magic), STATS_PAGE_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    ~stats_exporter() {
+        safe_munmap(page, stats_page::size());
+        shm_unlink(name);
+    }
+
+    // adds what the calling thread has counted since its last publish
+    void
+    publish_thread_counters() {
+        for (uint32_t i = 0; i < NCOUNTERS; ++i) {
+            // reset_thread_counters() since the last publish
+            if (thread_counters[i] < published_counters[i]) {
+                published_counters[i] = 0;
+            }
+            const uint64_t delta = thread_counters[i] - published_counters[i];
+            if (delta) {
+                __atomic_fetch_add(page->counters + i,
+                                   delta,
+                                   __ATOMIC_RELAXED);
+                published_counters[i] = thread_counters[i];
+            }
+        }
+    }
+
+    // live objects per slab of a sharded_fixed_slab_manager (fixed / depot /
+    // sharded). Costs a walk of the bitmaps, see for_each_live
+    template<typename manager_t>
+    void
+    sample(const manager_t * const mgr) {
+        uint64_t       live[STATS_MAX_SLABS];
+        const uint32_t nslabs =
+            cmath::min<uint32_t>(mgr->nslabs(), STATS_MAX_SLABS);
+        memset(live, 0, nslabs * sizeof(uint64_t));
+        mgr->for_each_live([&](const auto * const ptr) {
+            const uint32_t slab_idx =
+                mgr->to_handle(ptr) >> manager_t::handle_slot_bits;
+            if (slab_idx < nslabs) {
+                ++live[slab_idx];
+            }
+        });
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        const uint64_t seq = __atomic_load_n(&(page->seq), __ATOMIC_RELAXED);
+        __atomic_store_n(&(page->seq), seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        page->nsamples++;
+        page->sample_ns = 1000UL * 1000UL * 1000UL * ts.tv_sec + ts.tv_nsec;
+        page->nshards   = mgr->m->nshards;
+        page->nslabs    = nslabs;
+        for (uint32_t i = 0; i < nslabs; ++i) {
+            page->slabs[i].live     = live[i];
+            page->slabs[i].capacity = mgr->slab_capacity(i);
+        }
+        __atomic_store_n(&(page->seq), seq + 2, __ATOMIC_RELEASE);
+    }
+};
+
+struct stats_reader {
+    const stats_page * page;
+
+    // name is a shm name (stats_page_name), fd an already open file (for
+    // example /proc/<pid>/fd/<n>)
+    stats_reader(const char * const name) {
+        const int32_t fd = shm_open(name, O_RDONLY, 0);
+        ERROR_ASSERT(fd >= 0, "shm_open(%s) failed\n", name);
+        attach(fd);
+    }
+
+    stats_reader(const int32_t fd) {
+        attach(fd);
+    }
+
+    ~stats_reader() {
+        safe_munmap((void *)page, stats_page::size());
+    }
+
+    void
+    attach(const int32_t fd) {
+        struct stat st;
+        ERROR_ASSERT(!fstat(fd, &st), "fstat failed\n");
+        DIE_ASSERT(((uint64_t)st.st_size) >= stats_page::size(),
+                   "Not a stats page (%lu bytes)\n",
+                   (uint64_t)st.st_size);
+        page = (const stats_page *)safe_mmap(NULL,
+                                             stats_page::size(),
+                                             PROT_READ,
+                                             MAP_SHARED,
+                                             fd,
+                                             0);
+        close(fd);
+        DIE_ASSERT(__atomic_load_n(&(page->magic), __ATOMIC_ACQUIRE) ==
+                           STATS_PAGE_MAGIC &&
+                       page->version == STATS_PAGE_VERSION,
+                   "Not a stats page (or still being built)\n");
+    }
+
+    // consistent copy of the page into out. Returns 0 (out is garbage) if
+    // no try in STATS_SNAPSHOT_MAX_RETRIES got one, i.e. the writer is stuck
+    // or died in sample()
+    uint32_t
+    snapshot(stats_page * const out) const {
+        for (uint32_t i = 0; i < STATS_SNAPSHOT_MAX_RETRIES; ++i) {
+            const uint64_t seq =
+                __atomic_load_n(&(page->seq), __ATOMIC_ACQUIRE);
+            if (!(seq & 0x1)) {
+                memcpy((void *)out, (const void *)page, sizeof(stats_page));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&(page->seq), __ATOMIC_RELAXED) == seq) {
+                    out->seq = seq;
+                    return 1;
+                }
+            }
+            // the writer may be waiting for this cpu
+            sched_yield();
+        }
+        return 0;
+    }
+};
+
+}  // namespace astats
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef _FREELIST_MANAGER_H_
+#define _FREELIST_MANAGER_H_
+
+#include <stdint.h>
+#include <new>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/internal_returns.h>
+#include <allocator/rseq/rseq_base.h>
+
+#include "freelist_stack.h"
+
+//////////////////////////////////////////////////////////////////////
+// Intrusive free list pool for objects too large for the 64 slot bitmaps to
+// be memory efficient (>= a page or so). Free objects store the next ptr in
+// their first 8 bytes so there is no per object overhead.
+//
+// Each cpu has a bounded list updated with rseq (rseq_list_push / pop, head
+// and count packed in one word). When it is empty / full objects move to /
+// from a global freelist_stack (Treiber stack with an ABA tag). Objects that
+// have never been allocated are handed out from a bump pointer into the
+// reserved (MAP_NORESERVE) region so untouched objects cost nothing.
+//
+// Nothing ever takes objects out of another cpu's list (that would need an
+// rseq sequence on that cpu) so whatever sits in them is out of reach of
+// every other cpu. The per cpu bound is percpu_max but capped so all the
+// lists together hold at most 1 / FREELIST_PERCPU_SHARE of the pool. Big
+// objects with a small max_objs on a many cpu host end up with a small (or
+// 0, every free goes global) bound, and _allocate only returns NULL once
+// at least (FREELIST_PERCPU_SHARE - 1) / FREELIST_PERCPU_SHARE of the pool
+// is allocated.
+//
+// Memory is never unmapped while the manager is alive so reading next from a
+// node another thread may have just popped is safe (the tag makes the cas
+// fail).
+
+// per cpu lists hold at most 1 / this of max_objs between them
+static constexpr const uint32_t FREELIST_PERCPU_SHARE = 8;
+
+template<typename T>
+struct internal_freelist_manager {
+    // per cpu head: node ptr in the low 48 bits, count in the high 16
+    using percpu_head_t = packed_ptr<freelist_node, 0, 16>;
+
+    // in uint64_t so per cpu heads are on separate cache lines
+    static constexpr const uint32_t head_stride =
+        CACHE_LINE_SIZE / sizeof(uint64_t);
+
+    // read only after construction
+    uint32_t nprocs;
+    uint32_t max_objs;
+    T *      objs;
+    // per cpu bound in count_one units, see rseq_list_push
+    uint64_t max_count;
+
+    // next never allocated object
+    uint64_t next_fresh ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    freelist_stack global_stack ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    uint64_t percpu_heads[] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    internal_freelist_manager(const uint32_t _nprocs,
+                              const uint32_t _max_objs,
+                              const uint32_t percpu_max)
+        : nprocs(_nprocs), max_objs(_max_objs), next_fresh(0), global_stack() {
+        objs = (T *)(((uint64_t)this) + meta_size(nprocs));
+        const uint32_t percpu_bound = cmath::min<uint32_t>(
+            percpu_max,
+            max_objs / (FREELIST_PERCPU_SHARE * nprocs));
+        max_count = ((uint64_t)percpu_bound)
+                    << percpu_head_t::high_bits_shift();
+    }
+
+    static uint64_t
+    meta_size(const uint32_t _nprocs) {
+        return cmath::roundup<uint64_t>(
+            sizeof(internal_freelist_manager) +
+                _nprocs * head_stride * sizeof(uint64_t),
+            PAGE_SIZE);
+    }
+
+    static uint64_t
+    size(const uint32_t _nprocs, const uint32_t _max_objs) {
+        return meta_size(_nprocs) + ((uint64_t)_max_objs) * sizeof(T);
+    }
+};
+
+template<typename T, uint32_t percpu_max = 32>
+struct freelist_manager {
+    static_assert(sizeof(T) >= sizeof(freelist_node),
+                  "Objects must be able to hold a next pointer");
+    static_assert(percpu_max < (1 << 16), "Per cpu count is 16 bits");
+
+    using internal_manager_t = internal_freelist_manager<T>;
+    using percpu_head_t      = typename internal_manager_t::percpu_head_t;
+
+    static constexpr const uint64_t ptr_mask  = percpu_head_t::ptr_mask();
+    static constexpr const uint64_t count_one = (1UL)
+                                                << percpu_head_t::high_bits_shift();
+
+    internal_manager_t * m;
+
+    freelist_manager(const uint32_t max_objs) {
+        const uint32_t nprocs = sysi::runtime_nprocs();
+        m                     = (internal_manager_t *)mmap_alloc_noreserve(
+            internal_manager_t::size(nprocs, max_objs));
+        new ((void * const)m) internal_manager_t(nprocs, max_objs, percpu_max);
+    }
+
+    ~freelist_manager() {
+        safe_munmap(m, internal_manager_t::size(m->nprocs, m->max_objs));
+    }
+
+    static uint64_t
+    region_size(const uint32_t max_objs) {
+        return internal_manager_t::size(sysi::runtime_nprocs(), max_objs);
+    }
+
+    void
+    reset() {
+        const uint32_t nprocs   = m->nprocs;
+        const uint32_t max_objs = m->max_objs;
+        memset((void *)(m->percpu_heads),
+               0,
+               nprocs * internal_manager_t::head_stride * sizeof(uint64_t));
+        new ((void * const)m) internal_manager_t(nprocs, max_objs, percpu_max);
+    }
+
+    uint64_t *
+    percpu_head(const uint32_t cpu) const {
+        return m->percpu_heads + cpu * internal_manager_t::head_stride;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // global stack
+    ALWAYS_INLINE freelist_node *
+    global_pop() {
+        return m->global_stack.pop();
+    }
+
+    void ALWAYS_INLINE
+    global_push(freelist_node * const node) {
+        m->global_stack.push(node);
+    }
+
+    // slow path when this cpu's list is empty
+    T *
+    refill() {
+        return pop_or_carve(&(m->global_stack),
+                            &(m->next_fresh),
+                            m->objs,
+                            m->max_objs);
+    }
+
+    T *
+    _allocate() {
+        uint64_t ret;
+        do {
+            const uint32_t start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ret = rseq_list_pop(percpu_head(start_cpu),
+                                ptr_mask,
+                                count_one,
+                                start_cpu);
+            if (BRANCH_UNLIKELY(ret == FAILED_RSEQ)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
+        } while (BRANCH_UNLIKELY(ret == FAILED_RSEQ));
+        ALLOC_STAT_INCR(ALLOCS);
+        if (BRANCH_LIKELY(successful(ret))) {
+            return (T *)ret;
+        }
+
+        T * const fresh = refill();
+        if (BRANCH_UNLIKELY(fresh == NULL)) {
+            ALLOC_STAT_INCR(FULL);
+        }
+        return fresh;
+    }
+
+    void
+    _free(T * const addr) {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m->objs)));
+        ALLOC_STAT_INCR(FREES);
+        uint32_t ret;
+        do {
+            const uint32_t start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ret = rseq_list_push(percpu_head(start_cpu),
+                                 (uint64_t *)addr,
+                                 ptr_mask,
+                                 count_one,
+                                 m->max_count,
+                                 start_cpu);
+            if (BRANCH_UNLIKELY(ret == 1)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
+        } while (BRANCH_UNLIKELY(ret == 1));
+
+        // this cpu's list is full (or holds its share of the pool)
+        if (BRANCH_UNLIKELY(ret)) {
+            global_push((freelist_node *)addr);
+        }
+    }
+};
+
+#endif
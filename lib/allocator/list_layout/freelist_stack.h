@@ -0,0 +1,96 @@
+#ifndef _FREELIST_STACK_H_
+#define _FREELIST_STACK_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <optimized/packed_ptr.h>
+
+//////////////////////////////////////////////////////////////////////
+// Lock free (Treiber) stack of intrusive nodes. The head is an
+// atomic_packed_ptr with the high 16 bits as an ABA tag that every
+// successful cas bumps.
+//
+// Reading next from a node another thread may have just popped is only safe
+// because users never unmap node memory while the stack is alive (the tag
+// makes the cas fail).
+
+struct freelist_node {
+    freelist_node * next;
+};
+
+struct freelist_stack {
+    using head_t = atomic_packed_ptr<freelist_node, 0, 16>;
+
+    head_t head;
+
+    freelist_stack() : head(0UL) {}
+
+    freelist_node *
+    pop() {
+        uint64_t        expected = head.template _load<__ATOMIC_ACQUIRE>();
+        freelist_node * node;
+        do {
+            node = head_t::to_ptr(expected);
+            if (node == NULL) {
+                return NULL;
+            }
+        } while (
+            !head.template cas_ptr_incr_high_bits<__ATOMIC_ACQUIRE,
+                                                  __ATOMIC_ACQUIRE>(expected,
+                                                                    node->next));
+        return node;
+    }
+
+    void
+    push(freelist_node * const node) {
+        uint64_t expected = head.template _load<__ATOMIC_RELAXED>();
+        do {
+            node->next = head_t::to_ptr(expected);
+        } while (
+            !head.template cas_ptr_incr_high_bits<__ATOMIC_RELEASE,
+                                                  __ATOMIC_RELAXED>(expected,
+                                                                    node));
+    }
+
+    // empties the stack and returns the old head, the nodes stay linked
+    // through next and now belong to the caller
+    freelist_node *
+    take_all() {
+        uint64_t expected = head.template _load<__ATOMIC_ACQUIRE>();
+        do {
+            if (head_t::to_ptr(expected) == NULL) {
+                return NULL;
+            }
+        } while (
+            !head.template cas_ptr_incr_high_bits<__ATOMIC_ACQUIRE,
+                                                  __ATOMIC_ACQUIRE>(expected,
+                                                                    NULL));
+        return head_t::to_ptr(expected);
+    }
+};
+
+// fixed size records[0, max) handed out from stack (ones given back) and
+// then from next_fresh (never used ones, carved off in order). Returns NULL
+// once both are used up. link_offset is where the record's freelist_node
+// is. Carved records are whatever the region holds, zero for a fresh mmap
+template<uint64_t link_offset = 0, typename rec_t, typename idx_t>
+rec_t *
+pop_or_carve(freelist_stack * const stack,
+             idx_t * const          next_fresh,
+             rec_t * const          records,
+             const uint64_t         max) {
+    freelist_node * const node = stack->pop();
+    if (node != NULL) {
+        return (rec_t *)(((uint64_t)node) - link_offset);
+    }
+    const idx_t idx = __atomic_fetch_add(next_fresh, 1, __ATOMIC_RELAXED);
+    if (BRANCH_UNLIKELY(idx >= max)) {
+        // leave next_fresh pinned at the end so it can't wrap
+        __atomic_store_n(next_fresh, (idx_t)max, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return records + idx;
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef _MAGAZINE_CACHE_H_
+#define _MAGAZINE_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <new>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/list_layout/freelist_stack.h>
+
+//////////////////////////////////////////////////////////////////////
+// Per thread magazine layer (Bonwick & Adams, "Magazines and Vmem") in front
+// of any manager with T * _allocate() / _free(T *). Each thread has a loaded
+// and a previous magazine (arrays of up to mag_size object ptrs) and
+// allocation / free are a plain load and store on the loaded one. No rseq
+// and no atomics so threads that migrate a lot don't pay for aborts and
+// remote frees on every call.
+//
+// When loaded is empty / full the thread swaps it with previous, then trades
+// with the depot (freelist_stacks of full and empty magazines). Only when the
+// depot has no full magazine is the backing manager called, and then it
+// fills half a magazine in one go. If the depot runs out of empty magazines
+// previous is drained back to the backing manager.
+//
+// Thread state is a __thread per instantiation so only one instance of a
+// given magazine_cache type is cached per thread. Calls on any other
+// instance go straight to the backing manager. A thread's magazines go back
+// to the depot when it exits (or calls flush_thread()) and drain() returns
+// everything in the depot to the backing manager. Other threads must have
+// exited or called flush_thread() before the cache is destroyed.
+
+static constexpr const uint32_t MAGAZINE_DEFAULT_SIZE = 64;
+
+// magazines reserved per cpu by default
+static constexpr const uint32_t MAGAZINE_DEFAULT_PER_CPU = 64;
+
+template<typename T, uint32_t mag_size>
+struct magazine {
+    freelist_node link;  // for the depot stacks, must be first
+    uint32_t      nrounds;
+    T *           rounds[mag_size];
+};
+
+template<typename T, uint32_t mag_size>
+struct internal_magazine_depot {
+    using magazine_t = magazine<T, mag_size>;
+
+    // read only after construction
+    uint32_t     max_magazines;
+    magazine_t * mags;
+
+    // next never used magazine
+    uint32_t next_fresh ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    freelist_stack full ALIGN_ATTR(CACHE_LINE_SIZE);
+    freelist_stack empty ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    internal_magazine_depot(const uint32_t _max_magazines)
+        : max_magazines(_max_magazines), next_fresh(0), full(), empty() {
+        mags = (magazine_t *)(((uint64_t)this) + meta_size());
+    }
+
+    static uint64_t
+    meta_size() {
+        return cmath::roundup<uint64_t>(sizeof(internal_magazine_depot),
+                                        PAGE_SIZE);
+    }
+
+    static uint64_t
+    size(const uint32_t _max_magazines) {
+        return meta_size() + ((uint64_t)_max_magazines) * sizeof(magazine_t);
+    }
+};
+
+template<typename T,
+         typename manager_t,
+         uint32_t mag_size = MAGAZINE_DEFAULT_SIZE>
+struct magazine_cache {
+    static_assert(mag_size >= 2, "Magazines need room to refill half");
+
+    using internal_depot_t = internal_magazine_depot<T, mag_size>;
+    using magazine_t       = typename internal_depot_t::magazine_t;
+
+    // objects taken from the backing manager when the depot has no full
+    // magazine
+    static constexpr const uint32_t refill_count = mag_size / 2;
+
+    struct thread_cache {
+        magazine_cache * owner;
+        magazine_t *     loaded;
+        magazine_t *     previous;
+    };
+    static __thread thread_cache tcache;
+
+    manager_t *        backing;
+    internal_depot_t * d;
+    pthread_key_t      exit_key;
+
+    magazine_cache(manager_t * const _backing)
+        : magazine_cache(_backing,
+                         sysi::runtime_nprocs() * MAGAZINE_DEFAULT_PER_CPU) {}
+
+    magazine_cache(manager_t * const _backing, const uint32_t max_magazines)
+        : backing(_backing) {
+        DIE_ASSERT(max_magazines >= 2,
+                   "Need at least 2 magazines (%u)\n",
+                   max_magazines);
+        d = (internal_depot_t *)mmap_alloc_noreserve(
+            internal_depot_t::size(max_magazines));
+        new ((void * const)d) internal_depot_t(max_magazines);
+        ERROR_ASSERT(!pthread_key_create(&exit_key, thread_exit));
+    }
+
+    ~magazine_cache() {
+        if (tcache.owner == this) {
+            tcache.owner = NULL;
+        }
+        pthread_key_delete(exit_key);
+        safe_munmap(d, internal_depot_t::size(d->max_magazines));
+    }
+
+    static uint64_t
+    region_size(const uint32_t max_magazines) {
+        return internal_depot_t::size(max_magazines);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // depot
+    // never used magazines are still zero from the mmap
+    magazine_t *
+    get_empty() {
+        return pop_or_carve(&(d->empty),
+                            &(d->next_fresh),
+                            d->mags,
+                            d->max_magazines);
+    }
+
+    ALWAYS_INLINE magazine_t *
+    get_full() {
+        return (magazine_t *)d->full.pop();
+    }
+
+    void ALWAYS_INLINE
+    put(magazine_t * const mag) {
+        if (mag->nrounds) {
+            d->full.push(&(mag->link));
+        }
+        else {
+            d->empty.push(&(mag->link));
+        }
+    }
+
+    void
+    drain_magazine(magazine_t * const mag) {
+        for (uint32_t i = 0; i < mag->nrounds; ++i) {
+            backing->_free(mag->rounds[i]);
+        }
+        mag->nrounds = 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // per thread state
+    static void
+    thread_exit(void * const arg) {
+        ((magazine_cache *)arg)->flush_thread();
+    }
+
+    // returns 1 if this thread is now caching for this instance
+    uint32_t
+    attach() {
+        if (tcache.owner != NULL) {
+            return 0;
+        }
+        magazine_t * const loaded = get_empty();
+        if (BRANCH_UNLIKELY(loaded == NULL)) {
+            return 0;
+        }
+        magazine_t * const previous = get_empty();
+        if (BRANCH_UNLIKELY(previous == NULL)) {
+            put(loaded);
+            return 0;
+        }
+        tcache.loaded   = loaded;
+        tcache.previous = previous;
+        tcache.owner    = this;
+        ERROR_ASSERT(!pthread_setspecific(exit_key, (void *)this));
+        return 1;
+    }
+
+    // give this thread's magazines back to the depot
+    void
+    flush_thread() {
+        if (tcache.owner != this) {
+            return;
+        }
+        put(tcache.loaded);
+        put(tcache.previous);
+        tcache.owner = NULL;
+        pthread_setspecific(exit_key, NULL);
+    }
+
+    // return every object sitting in a depot magazine to the backing manager
+    void
+    drain() {
+        magazine_t * mag;
+        while ((mag = get_full()) != NULL) {
+            drain_magazine(mag);
+            put(mag);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // slow paths
+    T *
+    refill() {
+        if (BRANCH_UNLIKELY(tcache.owner != this)) {
+            if (!attach()) {
+                return backing->_allocate();
+            }
+        }
+        // loaded is empty (or attach() just gave us an empty one)
+        magazine_t * loaded = tcache.loaded;
+        if (tcache.previous->nrounds) {
+            tcache.loaded   = tcache.previous;
+            tcache.previous = loaded;
+            loaded          = tcache.loaded;
+        }
+        else {
+            magazine_t * const full = get_full();
+            if (full != NULL) {
+                // loaded and previous are both empty
+                put(tcache.previous);
+                tcache.previous = loaded;
+                tcache.loaded   = full;
+                loaded          = full;
+            }
+            else {
+                ALLOC_STAT_INCR(MAG_REFILLS);
+                uint32_t n = 0;
+                for (; n < refill_count; ++n) {
+                    T * const ptr = backing->_allocate();
+                    if (BRANCH_UNLIKELY(ptr == NULL)) {
+                        break;
+                    }
+                    loaded->rounds[n] = ptr;
+                }
+                if (BRANCH_UNLIKELY(n == 0)) {
+                    return NULL;
+                }
+                loaded->nrounds = n;
+            }
+        }
+        return loaded->rounds[--(loaded->nrounds)];
+    }
+
+    void
+    flush(T * const addr) {
+        if (BRANCH_UNLIKELY(tcache.owner != this)) {
+            if (!attach()) {
+                backing->_free(addr);
+                return;
+            }
+        }
+        magazine_t * loaded = tcache.loaded;
+        if (loaded->nrounds < mag_size) {
+            // attach() just gave us an empty magazine
+            loaded->rounds[(loaded->nrounds)++] = addr;
+            return;
+        }
+
+        if (tcache.previous->nrounds < mag_size) {
+            tcache.loaded   = tcache.previous;
+            tcache.previous = loaded;
+            loaded          = tcache.loaded;
+        }
+        else {
+            magazine_t * const empty = get_empty();
+            if (empty != NULL) {
+                // loaded and previous are both full
+                put(tcache.previous);
+                tcache.previous = loaded;
+                tcache.loaded   = empty;
+                loaded          = empty;
+            }
+            else {
+                // out of magazines, give previous back to the manager
+                drain_magazine(tcache.previous);
+                tcache.loaded   = tcache.previous;
+                tcache.previous = loaded;
+                loaded          = tcache.loaded;
+            }
+        }
+        loaded->rounds[(loaded->nrounds)++] = addr;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // fast paths
+    ALWAYS_INLINE T *
+    _allocate() {
+        if (BRANCH_LIKELY(tcache.owner == this)) {
+            magazine_t * const loaded = tcache.loaded;
+            if (BRANCH_LIKELY(loaded->nrounds)) {
+                return loaded->rounds[--(loaded->nrounds)];
+            }
+        }
+        return refill();
+    }
+
+    void ALWAYS_INLINE
+    _free(T * const addr) {
+        if (BRANCH_LIKELY(tcache.owner == this)) {
+            magazine_t * const loaded = tcache.loaded;
+            if (BRANCH_LIKELY(loaded->nrounds < mag_size)) {
+                loaded->rounds[(loaded->nrounds)++] = addr;
+                return;
+            }
+        }
+        flush(addr);
+    }
+};
+
+template<typename T, typename manager_t, uint32_t mag_size>
+__thread typename magazine_cache<T, manager_t, mag_size>::thread_cache
+    magazine_cache<T, manager_t, mag_size>::tcache;
+
+#endif
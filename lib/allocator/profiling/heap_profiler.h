@@ -0,0 +1,460 @@
+#ifndef _HEAP_PROFILER_H_
+#define _HEAP_PROFILER_H_
+
+#include <execinfo.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <x86intrin.h>
+#include <type_traits>
+#include <utility>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/bits.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <util/rand_utils.h>
+
+
+//////////////////////////////////////////////////////////////////////
+// Sampling heap profiler that sits on top of any slab manager. Every
+// ~sample_period allocated bytes (geometric / poisson sampling so it doesn't
+// alias with periodic allocation patterns) a stack trace is taken and tracked
+// until the object is freed. Profiles are dumped in the legacy gperftools
+// "heap_v2" text format so `pprof --inuse_space` and `pprof --alloc_space`
+// both work on the same file.
+//
+// Sampling state is per thread and shared by every profiled manager (same as
+// tcmalloc). Everything other than decrementing the byte counter on alloc and
+// checking the live sample count plus one filter counter on free is on the
+// slow path.
+
+namespace hprof {
+
+static constexpr const uint32_t MAX_DEPTH = 32;
+// frames for record_sample / _sample themselves
+static constexpr const uint32_t SKIP_DEPTH = 2;
+
+static constexpr const uint32_t NBUCKETS_LOG = 12;
+static constexpr const uint32_t NBUCKETS     = (1 << NBUCKETS_LOG);
+
+static constexpr const uint32_t NLIVE_LOG = 16;
+static constexpr const uint32_t NLIVE     = (1 << NLIVE_LOG);
+
+// counting filter over live sample addresses, see heap_profile::filter
+static constexpr const uint32_t NFILTER_LOG = 15;
+static constexpr const uint32_t NFILTER     = (1 << NFILTER_LOG);
+
+static constexpr const uint64_t EMPTY_SLOT     = 0;
+static constexpr const uint64_t TOMBSTONE_SLOT = 1;
+
+// bytes until next sample. <= 0 means take the slow path. Starts at 0 so the
+// first allocation on a thread seeds the sampler instead of sampling
+__thread int64_t bytes_until_sample;
+__thread uint64_t sampler_rng;
+
+// xorshift is plenty here, we just need uniform bits for the exponential
+uint64_t ALWAYS_INLINE
+next_sample_rand() {
+    if (BRANCH_UNLIKELY(sampler_rng == 0)) {
+        sampler_rng = (__rdtsc() ^ ((uint64_t)(&sampler_rng))) | 1;
+    }
+    return rutil::next_rand(&sampler_rng);
+}
+
+// distance to next sample is exponentially distributed with mean
+// sample_period. This makes sampling a poisson process over allocated bytes
+int64_t
+pick_next_sample(const uint64_t sample_period) {
+    // 53 bits of uniform in (0, 1]
+    const double u = ((next_sample_rand() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    const double d = -log(u) * (double)sample_period;
+    return d < 1.0 ? 1 : (int64_t)d;
+}
+
+
+struct spin_lock {
+    uint32_t v;
+
+    void ALWAYS_INLINE
+    lock() {
+        while (__atomic_exchange_n(&v, 1, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&v, __ATOMIC_RELAXED)) {
+                _mm_pause();
+            }
+        }
+    }
+
+    void ALWAYS_INLINE
+    unlock() {
+        __atomic_store_n(&v, 0, __ATOMIC_RELEASE);
+    }
+};
+
+struct stack_bucket {
+    uint64_t hash;
+    uint32_t depth;
+    uint32_t pad;
+
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t free_count;
+    uint64_t free_bytes;
+
+    void * frames[MAX_DEPTH];
+};
+
+struct live_sample {
+    uint64_t addr;
+    uint32_t bucket_idx;
+    uint32_t bytes;
+};
+
+// all tables are mmapped noreserve so an idle profiler costs nothing
+struct heap_profile {
+    // version is odd while the live table is being rebuilt. Frees probe the
+    // live table without the lock and retry if the version changed
+    uint64_t live_version ALIGN_ATTR(CACHE_LINE_SIZE);
+    uint64_t nlive;
+
+    spin_lock lock ALIGN_ATTR(CACHE_LINE_SIZE);
+    uint32_t  nlive_slots_used;  // live + tombstones
+    uint32_t  nbuckets_used;
+    uint64_t  ndropped;
+    uint64_t  sample_period;
+
+    // number of live samples whose address hashes to each slot (only
+    // changed with lock held). A free whose slot is 0 can't be a sample so
+    // skips the live table entirely. At most NLIVE / 2 samples are live so
+    // uint16_t can't overflow
+    uint16_t filter[NFILTER] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    live_sample  live[NLIVE] ALIGN_ATTR(CACHE_LINE_SIZE);
+    stack_bucket buckets[NBUCKETS];
+
+    static uint64_t ALWAYS_INLINE CONST_ATTR
+    hash_filter(const uint64_t addr) {
+        return (addr * 0xff51afd7ed558ccdUL) >> (64 - NFILTER_LOG);
+    }
+
+    uint32_t ALWAYS_INLINE
+    maybe_live(const uint64_t addr) const {
+        return __atomic_load_n(filter + hash_filter(addr), __ATOMIC_RELAXED);
+    }
+
+    static uint64_t ALWAYS_INLINE CONST_ATTR
+    hash_addr(const uint64_t addr) {
+        return (addr * 0x9E3779B97F4A7C15UL) >> (64 - NLIVE_LOG);
+    }
+
+    static uint64_t
+    hash_stack(void * const * frames, const uint32_t depth) {
+        uint64_t h = 0xcbf29ce484222325UL;
+        for (uint32_t i = 0; i < depth; ++i) {
+            h ^= (uint64_t)frames[i];
+            h *= 0x100000001b3UL;
+        }
+        // 0 is reserved for empty bucket
+        return h | 1;
+    }
+
+    // lock must be held
+    int32_t
+    find_bucket(void * const * frames, const uint32_t depth) {
+        const uint64_t h = hash_stack(frames, depth);
+        for (uint32_t i = 0; i < NBUCKETS; ++i) {
+            const uint32_t idx = (h + i) & (NBUCKETS - 1);
+            if (buckets[idx].hash == h && buckets[idx].depth == depth &&
+                (!memcmp(buckets[idx].frames,
+                         frames,
+                         depth * sizeof(void *)))) {
+                return idx;
+            }
+            if (buckets[idx].hash == 0) {
+                if (nbuckets_used >= (3 * NBUCKETS) / 4) {
+                    return (-1);
+                }
+                ++nbuckets_used;
+                buckets[idx].hash  = h;
+                buckets[idx].depth = depth;
+                memcpy(buckets[idx].frames, frames, depth * sizeof(void *));
+                return idx;
+            }
+        }
+        return (-1);
+    }
+
+    // lock must be held. Squeezes tombstones out of the live table
+    void
+    rebuild_live() {
+        __atomic_fetch_add(&live_version, 1, __ATOMIC_RELEASE);
+
+        live_sample * tmp = (live_sample *)mmap_alloc_noreserve(sizeof(live));
+        memcpy(tmp, live, sizeof(live));
+        memset(live, 0, sizeof(live));
+        nlive_slots_used = 0;
+        for (uint32_t i = 0; i < NLIVE; ++i) {
+            if (tmp[i].addr > TOMBSTONE_SLOT) {
+                insert_live(tmp[i]);
+            }
+        }
+        safe_munmap(tmp, sizeof(live));
+
+        __atomic_fetch_add(&live_version, 1, __ATOMIC_RELEASE);
+    }
+
+    // lock must be held
+    void
+    insert_live(const live_sample s) {
+        for (uint64_t i = hash_addr(s.addr);; i = (i + 1) & (NLIVE - 1)) {
+            if (live[i].addr <= TOMBSTONE_SLOT) {
+                if (live[i].addr == EMPTY_SLOT) {
+                    ++nlive_slots_used;
+                }
+                live[i].bucket_idx = s.bucket_idx;
+                live[i].bytes      = s.bytes;
+                __atomic_store_n(&(live[i].addr), s.addr, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+    }
+
+    void NEVER_INLINE
+    record_sample(const uint64_t addr, const uint32_t bytes) {
+        void *         frames[MAX_DEPTH + SKIP_DEPTH];
+        const uint32_t depth = backtrace(frames, MAX_DEPTH + SKIP_DEPTH);
+        const uint32_t skip  = cmath::min<uint32_t>(depth, SKIP_DEPTH);
+
+        lock.lock();
+        if (BRANCH_UNLIKELY(nlive >= (NLIVE / 2))) {
+            ++ndropped;
+            lock.unlock();
+            return;
+        }
+        const int32_t bucket_idx = find_bucket(frames + skip, depth - skip);
+        if (BRANCH_UNLIKELY(bucket_idx < 0)) {
+            ++ndropped;
+            lock.unlock();
+            return;
+        }
+        ++buckets[bucket_idx].alloc_count;
+        buckets[bucket_idx].alloc_bytes += bytes;
+
+        if (nlive_slots_used >= (3 * NLIVE) / 4) {
+            rebuild_live();
+        }
+        insert_live({ addr, (uint32_t)bucket_idx, bytes });
+        __atomic_store_n(filter + hash_filter(addr),
+                         filter[hash_filter(addr)] + 1,
+                         __ATOMIC_RELAXED);
+        __atomic_fetch_add(&nlive, 1, __ATOMIC_RELAXED);
+        lock.unlock();
+    }
+
+    // returns slot index of addr or (-1). Safe without the lock
+    int64_t
+    probe_live(const uint64_t addr) const {
+        uint64_t v;
+        int64_t  ret;
+        do {
+            while ((v = __atomic_load_n(&live_version, __ATOMIC_ACQUIRE)) &
+                   0x1) {
+                _mm_pause();
+            }
+            ret = (-1);
+            for (uint64_t i = hash_addr(addr), n = 0; n < NLIVE;
+                 i = (i + 1) & (NLIVE - 1), ++n) {
+                const uint64_t slot_addr =
+                    __atomic_load_n(&(live[i].addr), __ATOMIC_ACQUIRE);
+                if (slot_addr == addr) {
+                    ret = i;
+                    break;
+                }
+                if (slot_addr == EMPTY_SLOT) {
+                    break;
+                }
+            }
+        } while (BRANCH_UNLIKELY(
+            v != __atomic_load_n(&live_version, __ATOMIC_ACQUIRE)));
+        return ret;
+    }
+
+    void NEVER_INLINE
+    maybe_untrack(const uint64_t addr) {
+        if (probe_live(addr) < 0) {
+            return;
+        }
+
+        lock.lock();
+        // table may have been rebuilt between probe and lock
+        const int64_t idx = probe_live(addr);
+        if (BRANCH_LIKELY(idx >= 0)) {
+            stack_bucket * const b = buckets + live[idx].bucket_idx;
+            ++b->free_count;
+            b->free_bytes += live[idx].bytes;
+            __atomic_store_n(&(live[idx].addr),
+                             TOMBSTONE_SLOT,
+                             __ATOMIC_RELEASE);
+            __atomic_store_n(filter + hash_filter(addr),
+                             filter[hash_filter(addr)] - 1,
+                             __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&nlive, 1, __ATOMIC_RELAXED);
+        }
+        lock.unlock();
+    }
+
+    void
+    clear() {
+        lock.lock();
+        __atomic_fetch_add(&live_version, 1, __ATOMIC_RELEASE);
+        memset(filter, 0, sizeof(filter));
+        memset(live, 0, sizeof(live));
+        memset(buckets, 0, sizeof(buckets));
+        nlive_slots_used = 0;
+        nbuckets_used    = 0;
+        ndropped         = 0;
+        __atomic_store_n(&nlive, 0, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&live_version, 1, __ATOMIC_RELEASE);
+        lock.unlock();
+    }
+
+    // pprof expects in use before cumulative in each record
+    void
+    dump(FILE * fp) {
+        uint64_t inuse_count = 0, inuse_bytes = 0;
+        uint64_t alloc_count = 0, alloc_bytes = 0;
+
+        lock.lock();
+        for (uint32_t i = 0; i < NBUCKETS; ++i) {
+            if (buckets[i].hash) {
+                inuse_count += buckets[i].alloc_count - buckets[i].free_count;
+                inuse_bytes += buckets[i].alloc_bytes - buckets[i].free_bytes;
+                alloc_count += buckets[i].alloc_count;
+                alloc_bytes += buckets[i].alloc_bytes;
+            }
+        }
+
+        fprintf(fp,
+                "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%lu\n",
+                inuse_count,
+                inuse_bytes,
+                alloc_count,
+                alloc_bytes,
+                sample_period);
+
+        for (uint32_t i = 0; i < NBUCKETS; ++i) {
+            if (!buckets[i].hash) {
+                continue;
+            }
+            fprintf(fp,
+                    "%6lu: %8lu [%6lu: %8lu] @",
+                    buckets[i].alloc_count - buckets[i].free_count,
+                    buckets[i].alloc_bytes - buckets[i].free_bytes,
+                    buckets[i].alloc_count,
+                    buckets[i].alloc_bytes);
+            for (uint32_t j = 0; j < buckets[i].depth; ++j) {
+                fprintf(fp, " %p", buckets[i].frames[j]);
+            }
+            fprintf(fp, "\n");
+        }
+        lock.unlock();
+
+        // pprof needs the mappings to symbolize
+        fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+        FILE * maps = fopen("/proc/self/maps", "r");
+        if (maps != NULL) {
+            char   buf[512];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+                fwrite(buf, 1, n, fp);
+            }
+            fclose(maps);
+        }
+    }
+
+    void
+    dump(const char * path) {
+        FILE * fp = fopen(path, "w+");
+        ERROR_ASSERT(fp != NULL, "Error unable to open file at:\n\"%s\"\n", path);
+        dump(fp);
+        fclose(fp);
+    }
+};
+
+}  // namespace hprof
+
+
+template<typename manager_t, uint64_t sample_period = (1UL << 19)>
+struct profiled_manager {
+    using T = typename std::remove_pointer<decltype(
+        std::declval<manager_t &>()._allocate())>::type;
+
+    static constexpr const uint32_t capacity = manager_t::capacity;
+
+    manager_t             allocator;
+    hprof::heap_profile * profile;
+
+    profiled_manager() : allocator() {
+        profile = (hprof::heap_profile *)mmap_alloc_noreserve(
+            sizeof(hprof::heap_profile));
+        profile->sample_period = sample_period;
+    }
+
+    ~profiled_manager() {
+        safe_munmap(profile, sizeof(hprof::heap_profile));
+    }
+
+    void
+    reset() {
+        allocator.reset();
+        profile->clear();
+    }
+
+    T *
+    _allocate() {
+        T * const ret = allocator._allocate();
+        if (BRANCH_UNLIKELY((hprof::bytes_until_sample -= sizeof(T)) <= 0) &&
+            ret) {
+            _sample(ret);
+        }
+        return ret;
+    }
+
+    void
+    _free(T * addr) {
+        // a long running process almost always has some live samples so
+        // that check alone filters nothing. The filter load does, only
+        // about nlive / NFILTER of frees that aren't samples reach the
+        // live table probe
+        if (__atomic_load_n(&(profile->nlive), __ATOMIC_RELAXED) &&
+            BRANCH_UNLIKELY(profile->maybe_live((uint64_t)addr))) {
+            profile->maybe_untrack((uint64_t)addr);
+        }
+        allocator._free(addr);
+    }
+
+    void NEVER_INLINE
+    _sample(T * const addr) {
+        // first allocation on this thread just seeds the sampler
+        const bool seeded = hprof::sampler_rng != 0;
+        hprof::bytes_until_sample += hprof::pick_next_sample(sample_period);
+        if (BRANCH_LIKELY(seeded)) {
+            profile->record_sample((uint64_t)addr, sizeof(T));
+        }
+    }
+
+    void
+    dump(FILE * fp) {
+        profile->dump(fp);
+    }
+
+    void
+    dump(const char * path) {
+        profile->dump(path);
+    }
+};
+
+
+#endif
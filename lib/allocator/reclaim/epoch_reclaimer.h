@@ -0,0 +1,288 @@
+#ifndef _EPOCH_RECLAIMER_H_
+#define _EPOCH_RECLAIMER_H_
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+
+#include <concurrency/epoch_domain.h>
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/list_layout/freelist_stack.h>
+#include <allocator/rseq/rseq_base.h>
+
+//////////////////////////////////////////////////////////////////////
+// retire(T *) for objects from any manager with _free(T *). Retired ptrs go
+// into the calling cpu's batch with rseq_buf_push (nothing is written to the
+// object itself, readers may still be looking at it). When a batch fills it
+// is swapped for an empty one with rseq_cmp_store, stamped with the
+// domain's epoch and pushed on the sealed stack. Sealed batches whose stamp
+// is 2 epochs behind the domain are freed to the manager in one go.
+//
+// Batches come from a reserved (MAP_NORESERVE) region so retire never calls
+// the backing manager to allocate. If every batch is sealed and none can be
+// freed yet retire waits for the epoch to advance, which it can only do
+// outside a critical section (max_batches has to cover what is retired
+// inside one).
+
+static constexpr const uint32_t EPOCH_DEFAULT_BATCH_SIZE = 64;
+
+// batches reserved per cpu by default (one is always the cpu's current)
+static constexpr const uint32_t EPOCH_DEFAULT_BATCHES_PER_CPU = 8;
+
+template<uint32_t batch_size>
+struct retire_batch {
+    // count and entries have to be first, this is the rseq_buf_push layout
+    uint64_t      count;
+    uint64_t      entries[batch_size];
+    uint64_t      sealed_epoch;
+    freelist_node link;
+
+    static retire_batch *
+    from_link(freelist_node * const node) {
+        return (retire_batch *)(((uint64_t)node) - offsetof(retire_batch, link));
+    }
+};
+
+template<uint32_t batch_size>
+struct internal_epoch_reclaimer {
+    using batch_t = retire_batch<batch_size>;
+
+    // in uint64_t so per cpu batch ptrs are on separate cache lines
+    static constexpr const uint32_t cur_stride =
+        CACHE_LINE_SIZE / sizeof(uint64_t);
+
+    // read only after construction
+    uint32_t  nprocs;
+    uint32_t  max_batches;
+    batch_t * batches;
+
+    // next never used batch
+    uint32_t next_fresh ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    freelist_stack free_batches ALIGN_ATTR(CACHE_LINE_SIZE);
+    freelist_stack sealed ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    // per cpu batch_t * that rseq_buf_push appends to
+    uint64_t percpu_cur[] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    internal_epoch_reclaimer(const uint32_t _nprocs,
+                             const uint32_t _max_batches)
+        : nprocs(_nprocs),
+          max_batches(_max_batches),
+          next_fresh(0),
+          free_batches(),
+          sealed() {
+        batches = (batch_t *)(((uint64_t)this) + meta_size(nprocs));
+    }
+
+    static uint64_t
+    meta_size(const uint32_t _nprocs) {
+        return cmath::roundup<uint64_t>(
+            sizeof(internal_epoch_reclaimer) +
+                _nprocs * cur_stride * sizeof(uint64_t),
+            PAGE_SIZE);
+    }
+
+    static uint64_t
+    size(const uint32_t _nprocs, const uint32_t _max_batches) {
+        return meta_size(_nprocs) + ((uint64_t)_max_batches) * sizeof(batch_t);
+    }
+};
+
+template<typename T,
+         typename manager_t,
+         uint32_t batch_size = EPOCH_DEFAULT_BATCH_SIZE>
+struct epoch_reclaimer {
+    using internal_reclaimer_t = internal_epoch_reclaimer<batch_size>;
+    using batch_t              = typename internal_reclaimer_t::batch_t;
+
+    epoch_domain *         domain;
+    manager_t *            backing;
+    internal_reclaimer_t * m;
+
+    epoch_reclaimer(epoch_domain * const _domain, manager_t * const _backing)
+        : epoch_reclaimer(_domain,
+                          _backing,
+                          sysi::runtime_nprocs() *
+                              EPOCH_DEFAULT_BATCHES_PER_CPU) {}
+
+    epoch_reclaimer(epoch_domain * const _domain,
+                    manager_t * const    _backing,
+                    const uint32_t       max_batches)
+        : domain(_domain), backing(_backing) {
+        const uint32_t nprocs = sysi::runtime_nprocs();
+        DIE_ASSERT(max_batches > nprocs,
+                   "Need more than 1 batch per cpu (%u <= %u)\n",
+                   max_batches,
+                   nprocs);
+        m = (internal_reclaimer_t *)mmap_alloc_noreserve(
+            internal_reclaimer_t::size(nprocs, max_batches));
+        new ((void * const)m) internal_reclaimer_t(nprocs, max_batches);
+        for (uint32_t i = 0; i < nprocs; ++i) {
+            *percpu_cur(i) = (uint64_t)get_batch();
+        }
+    }
+
+    // everything still retired is freed, nobody can be reading it anymore
+    ~epoch_reclaimer() {
+        drain();
+        safe_munmap(m, internal_reclaimer_t::size(m->nprocs, m->max_batches));
+    }
+
+    static uint64_t
+    region_size(const uint32_t max_batches) {
+        return internal_reclaimer_t::size(sysi::runtime_nprocs(), max_batches);
+    }
+
+    uint64_t *
+    percpu_cur(const uint32_t cpu) const {
+        return m->percpu_cur + cpu * internal_reclaimer_t::cur_stride;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // batches
+    // never used batches are still zero from the mmap
+    batch_t *
+    get_batch() {
+        return pop_or_carve<offsetof(batch_t, link)>(&(m->free_batches),
+                                                     &(m->next_fresh),
+                                                     m->batches,
+                                                     m->max_batches);
+    }
+
+    void
+    free_batch(batch_t * const batch) {
+        for (uint64_t i = 0; i < batch->count; ++i) {
+            backing->_free((T *)(batch->entries[i]));
+        }
+        batch->count = 0;
+        m->free_batches.push(&(batch->link));
+    }
+
+    // frees every sealed batch that is 2 epochs old. Returns number freed
+    uint32_t
+    reclaim() {
+        const uint64_t  e    = domain->try_advance();
+        freelist_node * node = m->sealed.take_all();
+        freelist_node * keep = NULL;
+        uint32_t        nfreed = 0;
+        while (node != NULL) {
+            freelist_node * const next  = node->next;
+            batch_t * const       batch = batch_t::from_link(node);
+            if (batch->sealed_epoch + 2 <= e) {
+                free_batch(batch);
+                ++nfreed;
+            }
+            else {
+                node->next = keep;
+                keep       = node;
+            }
+            node = next;
+        }
+        while (keep != NULL) {
+            freelist_node * const next = keep->next;
+            m->sealed.push(keep);
+            keep = next;
+        }
+        return nfreed;
+    }
+
+    // swaps start_cpu's batch for an empty one and seals the old one.
+    // Returns 1 on abort
+    uint32_t
+    seal(const uint32_t start_cpu) {
+        batch_t * const cur = (batch_t *)(*percpu_cur(start_cpu));
+        batch_t *       fresh;
+        while ((fresh = get_batch()) == NULL) {
+            // every batch is sealed, wait for readers to move on. If we are
+            // a reader ourselves the epoch can't get far enough
+            if (reclaim() == 0) {
+                DIE_ASSERT(!domain->in_critical_section(),
+                           "Out of retire batches in a critical section\n");
+                sched_yield();
+            }
+        }
+
+        const uint32_t ret = rseq_cmp_store(percpu_cur(start_cpu),
+                                            (uint64_t)cur,
+                                            (uint64_t)fresh,
+                                            start_cpu);
+        if (BRANCH_UNLIKELY(ret)) {
+            // aborted or another thread on this cpu already swapped
+            m->free_batches.push(&(fresh->link));
+            return ret == 1;
+        }
+
+        // cur is ours now. Everything in it was retired at or before the
+        // epoch read here
+        cur->sealed_epoch = domain->epoch();
+        m->sealed.push(&(cur->link));
+        reclaim();
+        return 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // api
+
+    // ptr must already be unreachable for threads that enter() from now on
+    void
+    retire(T * const ptr) {
+        uint32_t ret;
+        do {
+            const uint32_t start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ret = rseq_buf_push(percpu_cur(start_cpu),
+                                (uint64_t)ptr,
+                                batch_size,
+                                start_cpu);
+            if (BRANCH_UNLIKELY(ret == 2)) {
+                ret = seal(start_cpu) ? 1 : 2;
+            }
+            if (BRANCH_UNLIKELY(ret == 1)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
+        } while (BRANCH_UNLIKELY(ret));
+    }
+
+    // seal the calling cpu's batch even if it isn't full and free whatever
+    // is old enough
+    void
+    collect() {
+        uint32_t start_cpu;
+        do {
+            start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+        } while (((batch_t *)(*percpu_cur(start_cpu)))->count &&
+                 seal(start_cpu));
+        reclaim();
+    }
+
+    // frees everything retired so far. Only safe when no thread is in a
+    // critical section or calling retire
+    void
+    drain() {
+        for (uint32_t i = 0; i < m->nprocs; ++i) {
+            batch_t * const cur = (batch_t *)(*percpu_cur(i));
+            for (uint64_t j = 0; j < cur->count; ++j) {
+                backing->_free((T *)(cur->entries[j]));
+            }
+            cur->count = 0;
+        }
+        freelist_node * node = m->sealed.take_all();
+        while (node != NULL) {
+            freelist_node * const next = node->next;
+            free_batch(batch_t::from_link(node));
+            node = next;
+        }
+    }
+};
+
+#endif
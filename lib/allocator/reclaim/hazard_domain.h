@@ -0,0 +1,304 @@
+#ifndef _HAZARD_DOMAIN_H_
+#define _HAZARD_DOMAIN_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/sys_info.h>
+
+#include <allocator/slab_layout/growable_slab_manager.h>
+
+//////////////////////////////////////////////////////////////////////
+// Hazard pointers (Michael) for objects from any manager with _free(T *).
+// Unlike epoch_domain a reader that stalls only keeps the nhazards objects
+// it has protected from being freed.
+//
+// Each thread's record (its hazard slots and retired list) is allocated
+// from a growable_slab_manager owned by the domain. scan() finds every record
+// with growable_slab_manager::for_each_live (the slab bitmaps) instead of
+// walking a list of records, so it reads a few bitmap words plus the
+// records that are actually in use. A cpu with more registered threads than
+// fit in its slab attaches another from the shared reserve
+// (GROWABLE_DEFAULT_SLABS_PER_CPU * nprocs slabs), so oversubscribed
+// programs only run out once every cpu's worth of slabs is in use.
+//
+// A thread that exits with retired objects still protected by someone
+// leaves its record orphaned. The next scan() that sees it finishes its
+// retired list and frees the record.
+//
+// Thread state is a __thread per instantiation, like magazine_cache.
+
+static constexpr const uint32_t HP_DEFAULT_HAZARDS = 4;
+
+// retired objects per thread before scan() runs
+static constexpr const uint32_t HP_RETIRE_MAX = 128;
+
+// records per slab (64 * HP_RECORD_NVEC records)
+static constexpr const uint32_t HP_RECORD_NVEC = 4;
+
+template<typename T, uint32_t nhazards>
+struct hazard_record {
+    enum state { OWNED = 0, ORPHANED = 1, ADOPTED = 2 };
+
+    T *      hazards[nhazards] ALIGN_ATTR(CACHE_LINE_SIZE);
+    uint32_t state;
+    uint32_t nretired;
+    T *      retired[HP_RETIRE_MAX];
+};
+
+template<typename T,
+         typename manager_t,
+         uint32_t nhazards = HP_DEFAULT_HAZARDS>
+struct hazard_domain {
+    using record_t = hazard_record<T, nhazards>;
+    using record_manager_t =
+        growable_slab_manager<record_t, 0, HP_RECORD_NVEC>;
+
+    // open addressed table of retired indexes scan() builds on the stack
+    static constexpr const uint32_t table_size = 2 * HP_RETIRE_MAX;
+    static constexpr const uint8_t  EMPTY_SLOT = 0xff;
+    static_assert(HP_RETIRE_MAX < EMPTY_SLOT, "Retired index must fit uint8_t");
+    static_assert(table_size == 256, "hash() returns 8 bits");
+
+    static __thread record_t * trecord;
+    static __thread hazard_domain * towner;
+
+    manager_t *      backing;
+    record_manager_t records;
+    pthread_key_t    exit_key;
+
+    hazard_domain(manager_t * const _backing) : backing(_backing) {
+        ERROR_ASSERT(!pthread_key_create(&exit_key, thread_exit));
+    }
+
+    // everything still retired is freed, nobody can be protecting it
+    ~hazard_domain() {
+        records.for_each_live([this](record_t * const rec) {
+            for (uint32_t i = 0; i < rec->nretired; ++i) {
+                backing->_free(rec->retired[i]);
+            }
+            rec->nretired = 0;
+        });
+        if (towner == this) {
+            towner = NULL;
+        }
+        pthread_key_delete(exit_key);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // per thread record
+    static void
+    thread_exit(void * const arg) {
+        ((hazard_domain *)arg)->unregister_thread();
+    }
+
+    record_t *
+    register_thread() {
+        DIE_ASSERT(towner == NULL,
+                   "Thread already registered with another hazard domain\n");
+        record_t * const rec = records._allocate();
+        DIE_ASSERT(rec != NULL, "Out of hazard records\n");
+        for (uint32_t i = 0; i < nhazards; ++i) {
+            rec->hazards[i] = NULL;
+        }
+        rec->state    = record_t::OWNED;
+        rec->nretired = 0;
+        // record has to be empty before a scan can see the hazards
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        trecord = rec;
+        towner  = this;
+        ERROR_ASSERT(!pthread_setspecific(exit_key, (void *)this));
+        return rec;
+    }
+
+    // clears this thread's hazards and gives up its record. Anything it
+    // retired that is still protected is finished by a later scan()
+    void
+    unregister_thread() {
+        if (towner != this) {
+            return;
+        }
+        record_t * const rec = trecord;
+        for (uint32_t i = 0; i < nhazards; ++i) {
+            __atomic_store_n(rec->hazards + i, NULL, __ATOMIC_RELEASE);
+        }
+        scan_record(rec);
+        towner = NULL;
+        pthread_setspecific(exit_key, NULL);
+        if (rec->nretired) {
+            __atomic_store_n(&(rec->state),
+                             record_t::ORPHANED,
+                             __ATOMIC_RELEASE);
+        }
+        else {
+            records._free(rec);
+        }
+    }
+
+    ALWAYS_INLINE record_t *
+    my_record() {
+        if (BRANCH_UNLIKELY(towner != this)) {
+            return register_thread();
+        }
+        return trecord;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // scan
+
+    // frees everything in rec's retired list that no record has in a
+    // hazard slot. Caller must own rec. Returns number still retired
+    uint32_t
+    scan_record(record_t * const rec) {
+        const uint32_t n = rec->nretired;
+        if (n == 0) {
+            return 0;
+        }
+
+        uint8_t table[table_size];
+        uint8_t is_protected[HP_RETIRE_MAX];
+        for (uint32_t i = 0; i < table_size; ++i) {
+            table[i] = EMPTY_SLOT;
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t h = hash(rec->retired[i]);
+            while (table[h] != EMPTY_SLOT) {
+                h = (h + 1) % table_size;
+            }
+            table[h]        = i;
+            is_protected[i] = 0;
+        }
+
+        // retired ptrs were unlinked before this so any protect() that
+        // still validates published its hazard before this fence
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        records.for_each_live([&](record_t * const other) {
+            for (uint32_t j = 0; j < nhazards; ++j) {
+                T * const hp =
+                    __atomic_load_n(other->hazards + j, __ATOMIC_ACQUIRE);
+                if (hp == NULL) {
+                    continue;
+                }
+                for (uint32_t h = hash(hp); table[h] != EMPTY_SLOT;
+                     h     = (h + 1) % table_size) {
+                    if (rec->retired[table[h]] == hp) {
+                        is_protected[table[h]] = 1;
+                    }
+                }
+            }
+        });
+
+        uint32_t nkept = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (is_protected[i]) {
+                rec->retired[nkept++] = rec->retired[i];
+            }
+            else {
+                backing->_free(rec->retired[i]);
+            }
+        }
+        rec->nretired = nkept;
+        return nkept;
+    }
+
+    // finish any orphaned records. Returns 1 if one was adopted
+    uint32_t
+    adopt_orphans() {
+        uint32_t adopted = 0;
+        records.for_each_live([&](record_t * const other) {
+            uint32_t expected = record_t::ORPHANED;
+            if (__atomic_load_n(&(other->state), __ATOMIC_RELAXED) !=
+                    expected ||
+                !__atomic_compare_exchange_n(&(other->state),
+                                             &expected,
+                                             record_t::ADOPTED,
+                                             false,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_RELAXED)) {
+                return;
+            }
+            adopted = 1;
+            if (scan_record(other)) {
+                __atomic_store_n(&(other->state),
+                                 record_t::ORPHANED,
+                                 __ATOMIC_RELEASE);
+            }
+            else {
+                records._free(other);
+            }
+        });
+        return adopted;
+    }
+
+    static uint32_t ALWAYS_INLINE
+    hash(const T * const ptr) {
+        // objects are at least 8 byte aligned
+        return ((((uint64_t)ptr) >> 3) * 0x9E3779B97F4A7C15UL) >> 56;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // api
+
+    // reads *src into hazard slot idx and returns it once it is known to be
+    // protected (still in *src after being published)
+    ALWAYS_INLINE T *
+    protect(const uint32_t idx, T * const * const src) {
+        IMPOSSIBLE_VALUES(idx >= nhazards);
+        record_t * const rec = my_record();
+        T *              ptr = __atomic_load_n(src, __ATOMIC_RELAXED);
+        T *              validated;
+        while (1) {
+            __atomic_store_n(rec->hazards + idx, ptr, __ATOMIC_SEQ_CST);
+            validated = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+            if (BRANCH_LIKELY(validated == ptr)) {
+                return ptr;
+            }
+            ptr = validated;
+        }
+    }
+
+    void ALWAYS_INLINE
+    clear(const uint32_t idx) {
+        IMPOSSIBLE_VALUES(idx >= nhazards);
+        __atomic_store_n(my_record()->hazards + idx, NULL, __ATOMIC_RELEASE);
+    }
+
+    // ptr must already be unreachable for any later protect()
+    void
+    retire(T * const ptr) {
+        record_t * const rec = my_record();
+        while (BRANCH_UNLIKELY(rec->nretired == HP_RETIRE_MAX)) {
+            if (scan_record(rec) == HP_RETIRE_MAX) {
+                // everything we retired is protected, wait for readers
+                adopt_orphans();
+                sched_yield();
+            }
+        }
+        rec->retired[rec->nretired++] = ptr;
+        if (BRANCH_UNLIKELY(rec->nretired == HP_RETIRE_MAX)) {
+            scan_record(rec);
+            adopt_orphans();
+        }
+    }
+
+    // free everything this thread retired that isn't protected right now
+    void
+    collect() {
+        scan_record(my_record());
+        adopt_orphans();
+    }
+};
+
+template<typename T, typename manager_t, uint32_t nhazards>
+__thread typename hazard_domain<T, manager_t, nhazards>::record_t *
+    hazard_domain<T, manager_t, nhazards>::trecord;
+
+template<typename T, typename manager_t, uint32_t nhazards>
+__thread hazard_domain<T, manager_t, nhazards> *
+    hazard_domain<T, manager_t, nhazards>::towner;
+
+#endif
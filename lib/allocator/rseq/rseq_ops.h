@@ -323,4 +323,219 @@ abort:
     return 1;
 }
 
+// per cpu intrusive list. *head_cpu_ptr is the head node ptr in the bits of
+// ptr_mask and a node count in the bits above (each node adds count_one). A
+// nodes next ptr is stored in its first 8 bytes (plain ptr, no count). Count
+// and head are in the same word so the commit is a single store.
+//
+// returns 0 on success, 1 if aborted, 2 if the list already has max_count
+// (count_one * max nodes) nodes
+uint32_t NEVER_INLINE
+rseq_list_push(uint64_t * const head_cpu_ptr,
+               uint64_t * const node,
+               const uint64_t   ptr_mask,
+               const uint64_t   count_one,
+               const uint64_t   max_count,
+               const uint32_t   start_cpu) {
+    uint32_t ret;
+    asm volatile(
+        RSEQ_INFO_DEF(32)
+        RSEQ_CS_ARR_DEF()
+        RSEQ_PREP_CS_DEF()
+        RSEQ_CMP_CUR_VS_START_CPUS()
+
+        "movl $2, %[ret]\n\t"
+        "movq (%[head_cpu_ptr]), %%rcx\n\t"      // current head + count
+        "cmpq %[max_count], %%rcx\n\t"           // ptr bits < count_one so
+        "jae 2f\n\t"                             // this only compares counts
+        "movq %[ptr_mask], %%rdx\n\t"
+        "andq %%rcx, %%rdx\n\t"                  // rdx = head node
+        "movq %%rdx, (%[node])\n\t"              // node->next = head
+        "subq %%rdx, %%rcx\n\t"                  // rcx = count
+        "addq %[count_one], %%rcx\n\t"
+        "orq %[node], %%rcx\n\t"                 // rcx = count + 1 | node
+        "movl $0, %[ret]\n\t"
+        "movq %%rcx, (%[head_cpu_ptr])\n\t"      // commit
+        "2:\n\t"
+        RSEQ_START_ABORT_DEF()
+        "movl $1, %[ret]\n\t"
+        "jmp 2b\n\t"
+        RSEQ_END_ABORT_DEF()
+        : [ ret ] "=&r"(ret)
+        : [ start_cpu ] "g"(start_cpu),
+          [ rseq_abi ] "g"(&__rseq_abi),
+          [ head_cpu_ptr ] "r"(head_cpu_ptr),
+          [ node ] "r"(node),
+          [ ptr_mask ] "r"(ptr_mask),
+          [ count_one ] "r"(count_one),
+          [ max_count ] "r"(max_count)
+        : "memory", "cc", "rax", "rcx", "rdx");
+    return ret;
+}
+
+// pops from a list pushed with rseq_list_push. Returns the node, 0 if
+// aborted, 1 if the list is empty
+uint64_t NEVER_INLINE
+rseq_list_pop(uint64_t * const head_cpu_ptr,
+              const uint64_t   ptr_mask,
+              const uint64_t   count_one,
+              const uint32_t   start_cpu) {
+    uint64_t ret;
+    asm volatile(
+        RSEQ_INFO_DEF(32)
+        RSEQ_CS_ARR_DEF()
+        RSEQ_PREP_CS_DEF()
+        RSEQ_CMP_CUR_VS_START_CPUS()
+
+        "movq $1, %[ret]\n\t"
+        "movq (%[head_cpu_ptr]), %%rcx\n\t"      // current head + count
+        "movq %[ptr_mask], %%rdx\n\t"
+        "andq %%rcx, %%rdx\n\t"                  // rdx = head node
+        "jz 2f\n\t"                              // empty
+        "subq %%rdx, %%rcx\n\t"                  // rcx = count
+        "subq %[count_one], %%rcx\n\t"
+        "orq (%%rdx), %%rcx\n\t"                 // rcx = count - 1 | next
+        "movq %%rdx, %[ret]\n\t"
+        "movq %%rcx, (%[head_cpu_ptr])\n\t"      // commit
+        "2:\n\t"
+        RSEQ_START_ABORT_DEF()
+        "movq $0, %[ret]\n\t"
+        "jmp 2b\n\t"
+        RSEQ_END_ABORT_DEF()
+        : [ ret ] "=&r"(ret)
+        : [ start_cpu ] "g"(start_cpu),
+          [ rseq_abi ] "g"(&__rseq_abi),
+          [ head_cpu_ptr ] "r"(head_cpu_ptr),
+          [ ptr_mask ] "r"(ptr_mask),
+          [ count_one ] "r"(count_one)
+        : "memory", "cc", "rax", "rcx", "rdx");
+    return ret;
+}
+
+// per cpu buffer behind a pointer. *buf_ptr_cpu_ptr is the cpu's current
+// buffer, buffer[0] is its count and the entries start at buffer[1]. The
+// entry store is speculative (if this aborts the slot is just reused), the
+// count store is the commit.
+//
+// returns 0 on success, 1 if aborted, 2 if the buffer already has max_count
+// entries
+uint32_t NEVER_INLINE
+rseq_buf_push(uint64_t * const buf_ptr_cpu_ptr,
+              const uint64_t   value,
+              const uint64_t   max_count,
+              const uint32_t   start_cpu) {
+    uint32_t ret;
+    asm volatile(
+        RSEQ_INFO_DEF(32)
+        RSEQ_CS_ARR_DEF()
+        RSEQ_PREP_CS_DEF()
+        RSEQ_CMP_CUR_VS_START_CPUS()
+
+        "movl $2, %[ret]\n\t"
+        "movq (%[buf_ptr_cpu_ptr]), %%rdx\n\t"   // rdx = buffer
+        "movq (%%rdx), %%rcx\n\t"                // rcx = count
+        "cmpq %[max_count], %%rcx\n\t"
+        "jae 2f\n\t"
+        "movq %[value], 8(%%rdx, %%rcx, 8)\n\t"  // buffer[count + 1] = value
+        "addq $1, %%rcx\n\t"
+        "movl $0, %[ret]\n\t"
+        "movq %%rcx, (%%rdx)\n\t"                // commit
+        "2:\n\t"
+        RSEQ_START_ABORT_DEF()
+        "movl $1, %[ret]\n\t"
+        "jmp 2b\n\t"
+        RSEQ_END_ABORT_DEF()
+        : [ ret ] "=&r"(ret)
+        : [ start_cpu ] "g"(start_cpu),
+          [ rseq_abi ] "g"(&__rseq_abi),
+          [ buf_ptr_cpu_ptr ] "r"(buf_ptr_cpu_ptr),
+          [ value ] "r"(value),
+          [ max_count ] "r"(max_count)
+        : "memory", "cc", "rax", "rcx", "rdx");
+    return ret;
+}
+
+// *v_cpu_ptr = new_v if it is still expected. Used to swap out a cpu's
+// rseq_buf_push buffer, once this commits no other thread on the cpu can
+// commit into the old one.
+//
+// returns 0 on success, 1 if aborted, 2 if *v_cpu_ptr != expected
+uint32_t NEVER_INLINE
+rseq_cmp_store(uint64_t * const v_cpu_ptr,
+               const uint64_t   expected,
+               const uint64_t   new_v,
+               const uint32_t   start_cpu) {
+    uint32_t ret;
+    asm volatile(
+        RSEQ_INFO_DEF(32)
+        RSEQ_CS_ARR_DEF()
+        RSEQ_PREP_CS_DEF()
+        RSEQ_CMP_CUR_VS_START_CPUS()
+
+        "movl $2, %[ret]\n\t"
+        "cmpq %[expected], (%[v_cpu_ptr])\n\t"
+        "jne 2f\n\t"
+        "movl $0, %[ret]\n\t"
+        "movq %[new_v], (%[v_cpu_ptr])\n\t"      // commit
+        "2:\n\t"
+        RSEQ_START_ABORT_DEF()
+        "movl $1, %[ret]\n\t"
+        "jmp 2b\n\t"
+        RSEQ_END_ABORT_DEF()
+        : [ ret ] "=&r"(ret)
+        : [ start_cpu ] "g"(start_cpu),
+          [ rseq_abi ] "g"(&__rseq_abi),
+          [ v_cpu_ptr ] "r"(v_cpu_ptr),
+          [ expected ] "r"(expected),
+          [ new_v ] "r"(new_v)
+        : "memory", "cc", "rax");
+    return ret;
+}
+
+// bump allocation out of a region that has never been handed out.
+// *cursor_cpu_ptr is the next slot and words is the region's bit vector (bit
+// set == taken). The first slot of each 64 slot word marks the whole word
+// taken in the same critical section as the cursor commit, so a
+// find_first_zero over words never picks a slot at or past the cursor and a
+// restart just redoes the (idempotent) store.
+//
+// returns the slot, >= limit if the region is exhausted, ~0 if aborted
+uint64_t NEVER_INLINE
+rseq_bump(uint64_t * const cursor_cpu_ptr,
+          uint64_t * const words,
+          const uint64_t   limit,
+          const uint32_t   start_cpu) {
+    uint64_t ret;
+    asm volatile(
+        RSEQ_INFO_DEF(32)
+        RSEQ_CS_ARR_DEF()
+        RSEQ_PREP_CS_DEF()
+        RSEQ_CMP_CUR_VS_START_CPUS()
+
+        "movq (%[cursor_cpu_ptr]), %[ret]\n\t"
+        "cmpq %[limit], %[ret]\n\t"
+        "jae 2f\n\t"                              // exhausted
+        "testq $63, %[ret]\n\t"
+        "jnz 5f\n\t"
+        "movq %[ret], %%rcx\n\t"
+        "shrq $6, %%rcx\n\t"
+        "movq $-1, (%[words], %%rcx, 8)\n\t"      // new word, all taken
+        "5:\n\t"
+        "leaq 1(%[ret]), %%rcx\n\t"
+        "movq %%rcx, (%[cursor_cpu_ptr])\n\t"     // commit
+        "2:\n\t"
+        RSEQ_START_ABORT_DEF()
+        "movq $-1, %[ret]\n\t"
+        "jmp 2b\n\t"
+        RSEQ_END_ABORT_DEF()
+        : [ ret ] "=&r"(ret)
+        : [ start_cpu ] "g"(start_cpu),
+          [ rseq_abi ] "g"(&__rseq_abi),
+          [ cursor_cpu_ptr ] "r"(cursor_cpu_ptr),
+          [ words ] "r"(words),
+          [ limit ] "r"(limit)
+        : "memory", "cc", "rax", "rcx");
+    return ret;
+}
+
 #endif
@@ -0,0 +1,19 @@
+#ifndef _TUNED_SLAB_CONFIG_H_
+#define _TUNED_SLAB_CONFIG_H_
+
+// Generated by bench/autotune.cc (make run_autotune)
+// Tuned with: default (not tuned)
+// Threads: 0, Score: 0.000 Mops/sec
+
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+// Object size and processor count the config was tuned for
+#define TUNED_OBJ_SIZE 64
+#define TUNED_NPROCS 0
+#define TUNED_SLAB_CONFIG_NAME "fixed-2:1,1,2"
+
+template<typename T>
+using tuned_slab_manager = fixed_slab_manager<T, 2, 1, 1, 2>;
+
+#endif
@@ -9,20 +9,23 @@
 #include <optimized/bits.h>
 #include <optimized/const_math.h>
 #include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
 #include <system/sys_info.h>
 
+#include <allocator/common/alloc_stats.h>
 #include <allocator/common/internal_returns.h>
 #include <allocator/rseq/rseq_base.h>
 
 #include <allocator/slab_layout/obj_slab.h>
 #include <allocator/slab_layout/super_slab.h>
 
+#include "slab_config.h"
 #include "slab_manager_template_helpers.h"
 
 template<reclaim_policy rp = reclaim_policy::SHARED>
 struct cpu_region {
     static constexpr const uint32_t nfree_vec =
-        rp == reclaim_policy::PERCPU ? 8 * NPROCS : 1;
+        rp == reclaim_policy::PERCPU ? 8 * PERCPU_RECLAIM_MAX_CPUS : 1;
 
     uint64_t allocable_regions ALIGN_ATTR(CACHE_LINE_SIZE);
     uint64_t                   free_regions_lock;
@@ -33,31 +36,37 @@ struct cpu_region {
 
 template<reclaim_policy rp = reclaim_policy::SHARED>
 struct region_manager {
-    static constexpr const uint32_t cpu_map_bits =
-        cmath::ulog2<uint32_t>(NPROCS);
-    static constexpr const uint32_t cpu_map_bits_div = (64 / cpu_map_bits);
-
-    cpu_region<rp> percpu_regions[NPROCS] ALIGN_ATTR(CACHE_LINE_SIZE);
+    static constexpr const uint32_t max_regions = 64;
 
     // a cache line to itself because this will have the most contention
     uint64_t available_regions ALIGN_ATTR(CACHE_LINE_SIZE);
 
-    // this should waste no memory as we are cache aligning slabs
-    uint64_t region_map[cmath::roundup<uint32_t>(cpu_map_bits, 8)] ALIGN_ATTR(
-        CACHE_LINE_SIZE);
+    // region idx -> cpu owner (this is used for free to go from memory
+    // location -> cpu owner)
+    uint16_t region_owner[max_regions] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    // only read on construction / destruction
+    uint32_t nprocs;
+
+    cpu_region<rp> percpu_regions[] ALIGN_ATTR(CACHE_LINE_SIZE);
+
 
+    region_manager(const uint32_t _nprocs) : nprocs(_nprocs) {}
 
-    region_manager() = default;
+    static uint64_t
+    size(const uint32_t _nprocs) {
+        return sizeof(region_manager) + _nprocs * sizeof(cpu_region<rp>);
+    }
 
     uint32_t ALWAYS_INLINE
     add_new_region(const uint32_t start_cpu) {
         const uint32_t new_region_idx =
             __atomic_fetch_add(&available_regions, 1, __ATOMIC_RELAXED);
-        // setup cpu map (this is used for free to go from memory location ->
-        // cpu owner)
-        atomic_or(
-            region_map + (new_region_idx / cpu_map_bits_div),
-            start_cpu << (cpu_map_bits * (new_region_idx % cpu_map_bits_div)));
+        if (BRANCH_UNLIKELY(new_region_idx >= max_regions)) {
+            // out of regions, caller will see this as >= its max_regions
+            return new_region_idx;
+        }
+        region_owner[new_region_idx] = start_cpu;
 
         if (BRANCH_UNLIKELY(
                 rseq_or(&(percpu_regions[start_cpu].allocable_regions),
@@ -66,7 +75,7 @@ struct region_manager {
             // slow path add to free region. We are not going to be using this
             // immediately anyways and probably best to let next alloc on this
             // CPU get the vector
-            atomic_or(&(percpu_regions[start_cpu].free_regions),
+            atomic_or(percpu_regions[start_cpu].free_regions,
                       (1UL) << new_region_idx);
             return WAS_PREEMPTED;
         }
@@ -86,7 +95,7 @@ struct region_manager {
         if constexpr (rp == reclaim_policy::SHARED) {
 #ifdef SAFER_FREE
             if (BRANCH_UNLIKELY(acquire_lock(
-                    &(percpu_regions[start_cpu].freed_regions_lock),
+                    &(percpu_regions[start_cpu].free_regions_lock),
                     start_cpu))) {
                 return WAS_PREEMPTED;
             }
@@ -94,47 +103,49 @@ struct region_manager {
 #ifdef CONTINUE_RSEQ
             // this option allows for preemption between check on
             // availabe_regions and acquiring the lock
-            if (percpu_regions[start_cpu].freed_regions[0]) {
+            if (percpu_regions[start_cpu].free_regions[0]) {
                 const uint64_t reclaimed_regions = try_reclaim_all_free_slabs(
                     &(percpu_regions[start_cpu].allocable_regions),
-                    percpu_regions[start_cpu].freed_regions,
+                    percpu_regions[start_cpu].free_regions,
                     start_cpu);
                 if (BRANCH_LIKELY(reclaimed_regions)) {
-                    atomic_xor(percpu_regions[start_cpu].freed_regions,
+                    atomic_xor(percpu_regions[start_cpu].free_regions,
                                reclaimed_regions);
-                    percpu_regions[start_cpu].freed_regions_lock = 0;
+                    percpu_regions[start_cpu].free_regions_lock = 0;
                     return bits::find_first_one(reclaimed_regions);
                 }
-                percpu_regions[start_cpu].freed_regions_lock = 0;
+                percpu_regions[start_cpu].free_regions_lock = 0;
                 return WAS_PREEMPTED;
             }
 #endif
 #ifndef CONTINUE_RSEQ
             if (BRANCH_UNLIKELY(percpu_regions[start_cpu].allocable_regions)) {
-                percpu_regions[start_cpu].freed_regions_lock = 0;
+                percpu_regions[start_cpu].free_regions_lock = 0;
                 return WAS_PREEMPTED;
             }
 
-            if (percpu_regions[start_cpu].freed_regions_lock[0]) {
+            if (percpu_regions[start_cpu].free_regions[0]) {
+                // or (not store) as mark_free from this CPU may race with us
                 const uint64_t reclaimed_regions =
-                    percpu_regions[start_cpu].freed_regions_lock[0];
-                percpu_regions[start_cpu].allocable_regions = reclaimed_regions;
-                atomic_xor(percpu_regions[start_cpu].freed_regions,
+                    percpu_regions[start_cpu].free_regions[0];
+                atomic_or(&(percpu_regions[start_cpu].allocable_regions),
+                          reclaimed_regions);
+                atomic_xor(percpu_regions[start_cpu].free_regions,
                            reclaimed_regions);
-                percpu_regions[start_cpu].freed_regions_lock = 0;
+                percpu_regions[start_cpu].free_regions_lock = 0;
                 return bits::find_first_one(reclaimed_regions);
             }
 #endif
-            percpu_regions[start_cpu].freed_regions_lock = 0;
+            percpu_regions[start_cpu].free_regions_lock = 0;
 #endif
 #ifndef SAFER_FREE
-            if (percpu_regions[start_cpu].freed_regions[0]) {
+            if (percpu_regions[start_cpu].free_regions[0]) {
                 const uint64_t reclaimed_regions = try_reclaim_all_free_slabs(
                     &(percpu_regions[start_cpu].allocable_regions),
-                    percpu_regions[start_cpu].freed_regions,
+                    percpu_regions[start_cpu].free_regions,
                     start_cpu);
                 if (BRANCH_LIKELY(reclaimed_regions)) {
-                    atomic_xor(percpu_regions[start_cpu].freed_regions,
+                    atomic_xor(percpu_regions[start_cpu].free_regions,
                                reclaimed_regions);
                     return bits::find_first_one(reclaimed_regions);
                 }
@@ -146,72 +157,73 @@ struct region_manager {
         else {
 #ifdef SAFER_FREE
             if (BRANCH_UNLIKELY(acquire_lock(
-                    &(percpu_regions[start_cpu].freed_regions_lock),
+                    &(percpu_regions[start_cpu].free_regions_lock),
                     start_cpu))) {
                 return WAS_PREEMPTED;
             }
 #ifdef CONTINUE_RSEQ
-            for (uint32_t _i = 0; _i < 8 * NPROCS; _i += 8) {
-                if (percpu_regions[start_cpu].freed_regions[_i]) {
+            for (uint32_t _i = 0; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
+                if (percpu_regions[start_cpu].free_regions[_i]) {
                     const uint64_t reclaimed_regions =
                         try_reclaim_all_free_slabs(
                             &(percpu_regions[start_cpu].allocable_regions),
-                            percpu_regions[start_cpu].freed_regions + _i,
+                            percpu_regions[start_cpu].free_regions + _i,
                             start_cpu);
                     if (BRANCH_LIKELY(reclaimed_regions)) {
-                        atomic_xor(percpu_regions[start_cpu].freed_regions + _i,
+                        atomic_xor(percpu_regions[start_cpu].free_regions + _i,
                                    reclaimed_regions);
-                        percpu_regions[start_cpu].freed_regions_lock = 0;
+                        percpu_regions[start_cpu].free_regions_lock = 0;
                         return bits::find_first_one(reclaimed_regions);
                     }
-                    percpu_regions[start_cpu].freed_regions_lock = 0;
+                    percpu_regions[start_cpu].free_regions_lock = 0;
                     return WAS_PREEMPTED;
                 }
             }
 #endif
 #ifndef CONTINUE_RSEQ
             if (BRANCH_UNLIKELY(percpu_regions[start_cpu].allocable_regions)) {
-                percpu_regions[start_cpu].freed_regions_lock = 0;
+                percpu_regions[start_cpu].free_regions_lock = 0;
                 return WAS_PREEMPTED;
             }
             // I think since we don't need to worry about being preempted
             // its best to get them all
             uint64_t reclaimed_regions =
-                percpu_regions[start_cpu].freed_regions[0];
+                percpu_regions[start_cpu].free_regions[0];
             if (reclaimed_regions) {
-                atomic_xor(percpu_regions[start_cpu].freed_regions,
+                atomic_xor(percpu_regions[start_cpu].free_regions,
                            reclaimed_regions);
             }
-            for (uint32_t _i = 8; _i < 8 * NPROCS; _i += 8) {
+            for (uint32_t _i = 8; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
                 const uint64_t _reclaimed_regions =
-                    percpu_regions[start_cpu].freed_regions[_i];
+                    percpu_regions[start_cpu].free_regions[_i];
                 if (_reclaimed_regions) {
-                    atomic_xor(percpu_regions[start_cpu].freed_regions + _i,
+                    atomic_xor(percpu_regions[start_cpu].free_regions + _i,
                                _reclaimed_regions);
                     reclaimed_regions |= _reclaimed_regions;
                 }
 
             }
             if (reclaimed_regions) {
-                percpu_regions[start_cpu].allocable_regions = reclaimed_regions;
-                percpu_regions[start_cpu].freed_regions_lock = 0;
+                atomic_or(&(percpu_regions[start_cpu].allocable_regions),
+                          reclaimed_regions);
+                percpu_regions[start_cpu].free_regions_lock = 0;
                 return bits::find_first_one(reclaimed_regions);
             }
 #endif
-            percpu_regions[start_cpu].freed_regions_lock = 0;
+            percpu_regions[start_cpu].free_regions_lock = 0;
 #endif
 #ifndef SAFER_FREE
             // this a very expensive loop due to the fact that all
             // other freed_slabs are "owned" by other CPUS
-            for (uint32_t _i = 0; _i < 8 * NPROCS; _i += 8) {
-                if (percpu_regions[start_cpu].freed_regions[_i]) {
+            for (uint32_t _i = 0; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
+                if (percpu_regions[start_cpu].free_regions[_i]) {
                     const uint64_t reclaimed_regions =
                         try_reclaim_all_free_slabs(
                             &(percpu_regions[start_cpu].allocable_regions),
-                            percpu_regions[start_cpu].freed_regions + _i,
+                            percpu_regions[start_cpu].free_regions + _i,
                             start_cpu);
                     if (BRANCH_LIKELY(reclaimed_regions)) {
-                        atomic_xor(percpu_regions[start_cpu].freed_regions + _i,
+                        atomic_xor(percpu_regions[start_cpu].free_regions + _i,
                                    reclaimed_regions);
                         return bits::find_first_one(reclaimed_regions);
                     }
@@ -225,9 +237,7 @@ struct region_manager {
 
     uint32_t ALWAYS_INLINE
     get_address_owner(const uint32_t region_idx) {
-        return (region_map[region_idx / cpu_map_bits_div] >>
-                (cpu_map_bits * (region_idx % cpu_map_bits_div))) &
-               (cpu_map_bits - 1);
+        return region_owner[region_idx];
     }
 
     void ALWAYS_INLINE
@@ -242,9 +252,9 @@ struct region_manager {
     mark_free(const uint64_t region_mask, const uint32_t start_cpu) {
         if (start_cpu == get_start_cpu()) {
             if (BRANCH_LIKELY(
-                    rseq_or(&(percpu_regions[start_cpu].allocable_regions),
-                            region_mask,
-                            start_cpu))) {
+                    !rseq_or(&(percpu_regions[start_cpu].allocable_regions),
+                             region_mask,
+                             start_cpu))) {
                 return;
             }
         }
@@ -262,73 +272,140 @@ struct region_manager {
 
 
 template<typename T,
-         int32_t        levels,
+         uint32_t       levels,
          reclaim_policy rp = reclaim_policy::SHARED,
-         int32_t... per_level_nvec>
+         uint32_t... per_level_nvec>
 struct dynamic_slab_manager {
     static constexpr const uint32_t ABSOLUTE_MAX_REGIONS = 64;
 
     using slab_t = typename type_helper<T, levels, 0, per_level_nvec...>::type;
 
-    constexpr uint32_t
-    _capacity(uint32_t n) const {
+    static constexpr uint32_t
+    _capacity(uint32_t n) {
         return 64 * get_N<per_level_nvec...>(n) * (n ? _capacity(n - 1) : 1);
     }
     static constexpr const uint32_t capacity = _capacity(levels);
 
 
+    // slabs are laid out directly before m so both the slab array and the
+    // region manager are found from m and max_regions without knowing how
+    // many cpus the region manager was sized for
     region_manager<rp> * m;
     uint32_t max_regions;  // this might be better placed upper bits of m
 
 
     dynamic_slab_manager(const uint32_t _max_regions = ABSOLUTE_MAX_REGIONS)
         : dynamic_slab_manager(
-              mmap_alloc_noreserve(
-                  sizeof(region_manager<rp>) +
-                  cmath::min<uint32_t>(_max_regions, ABSOLUTE_MAX_REGIONS) *
-                      sizeof(slab_t)),
+              mmap_alloc_noreserve(region_size(
+                  cmath::min<uint32_t>(_max_regions, ABSOLUTE_MAX_REGIONS))),
               cmath::min<uint32_t>(_max_regions, ABSOLUTE_MAX_REGIONS)) {}
 
 
+    // base must be at least region_size(_max_regions) bytes
     dynamic_slab_manager(void * const   base,
                          const uint32_t _max_regions = ABSOLUTE_MAX_REGIONS) {
-        m           = (region_manager<rp> *)base;
+        const uint32_t nprocs = sysi::runtime_nprocs();
+        if constexpr (rp == reclaim_policy::PERCPU) {
+            DIE_ASSERT(nprocs <= PERCPU_RECLAIM_MAX_CPUS,
+                       "PERCPU reclaim built for %d cpus, host has %d\n",
+                       PERCPU_RECLAIM_MAX_CPUS,
+                       nprocs);
+        }
         max_regions = _max_regions;
+        m           = (region_manager<rp> *)(((uint64_t)base) +
+                                   max_regions * sizeof(slab_t));
+        new ((void * const)m) region_manager<rp>(nprocs);
+    }
+
+    // base holds a manager built with the constructor above with the same
+    // _max_regions. Nothing is written, objects and bitmaps are kept
+    dynamic_slab_manager(void * const   base,
+                         const uint32_t _max_regions,
+                         reattach_region) {
+        max_regions = _max_regions;
+        m           = (region_manager<rp> *)(((uint64_t)base) +
+                                   max_regions * sizeof(slab_t));
+        DIE_ASSERT(m->nprocs == sysi::runtime_nprocs(),
+                   "Region built for %u cpus\n",
+                   m->nprocs);
+    }
+
+    ~dynamic_slab_manager() {
+        safe_munmap(slabs(), _region_size(max_regions, m->nprocs));
+    }
+
+    static uint64_t
+    _region_size(const uint32_t _max_regions, const uint32_t nprocs) {
+        return _max_regions * sizeof(slab_t) + region_manager<rp>::size(nprocs);
     }
 
+    static uint64_t
+    region_size(const uint32_t _max_regions = ABSOLUTE_MAX_REGIONS) {
+        return _region_size(_max_regions, sysi::runtime_nprocs());
+    }
+
+    slab_t *
+    slabs() const {
+        return ((slab_t *)m) - max_regions;
+    }
+
+    void
+    reset() {
+        const uint32_t nprocs = m->nprocs;
+        memset((void *)slabs(), 0, _region_size(max_regions, nprocs));
+        m->nprocs = nprocs;
+    }
+
+    // zero is for _allocate_zeroed
+    template<bool zero = false>
     T *
     _allocate() {
-        uint64_t ptr;
-        do {
+        ALLOC_STAT_INCR(ALLOCS);
+        while (1) {
             const uint32_t start_cpu = get_start_cpu();
             const uint32_t region    = m->get_region(start_cpu);
             if (BRANCH_UNLIKELY(region >= max_regions)) {
                 if (region == WAS_PREEMPTED) {
+                    ALLOC_STAT_INCR(RSEQ_ABORTS);
                     continue;
                 }
-                else {
-                    return NULL;
-                }
+                ALLOC_STAT_INCR(FULL);
+                return NULL;
             }
-            ptr = (((slab_t *)(m + 1)) + region)->_allocate(start_cpu);
-            if (ptr == FAILED_VEC_FULL) {
+            const uint64_t ptr =
+                (slabs() + region)->template _allocate<zero>(start_cpu);
+            if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
                 m->try_mark_non_allocable((1UL) << region, start_cpu);
                 continue;
             }
-        } while (BRANCH_UNLIKELY(ptr == FAILED_RSEQ));
+            if (BRANCH_LIKELY(ptr != FAILED_RSEQ)) {
+                return (T *)ptr;
+            }
+            ALLOC_STAT_INCR(RSEQ_ABORTS);
+        }
+    }
+
+    // calloc, see obj_slab::hand_out
+    T *
+    _allocate_zeroed() {
+        return _allocate<true>();
     }
 
     void
     _free(T * addr) {
-        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m + 1)));
-        const uint32_t region_idx = ((uint64_t)addr) - ((uint64_t)(m + 1));
-        const uint32_t owner_cpu  = m->get_address_owner(region_idx);
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)slabs()));
+        const uint32_t region_idx =
+            (((uint64_t)addr) - ((uint64_t)slabs())) / sizeof(slab_t);
+        IMPOSSIBLE_VALUES(region_idx >= max_regions);
+
+        const uint32_t owner_cpu = m->get_address_owner(region_idx);
+        ALLOC_STAT_INCR(FREES);
         if (owner_cpu == get_start_cpu()) {
-            (((slab_t *)(m + 1)) + region_idx)
-                ->_optimistic_free(addr, owner_cpu);
+            (slabs() + region_idx)->_optimistic_free(addr, owner_cpu);
         }
         else {
-            (((slab_t *)(m + 1)) + region_idx)->_free(addr);
+            ALLOC_STAT_INCR(REMOTE_FREES);
+            (slabs() + region_idx)->_free(addr);
         }
         m->mark_free((1UL) << region_idx, owner_cpu);
     }
@@ -7,35 +7,150 @@
 
 #include <misc/cpp_attributes.h>
 #include <optimized/bits.h>
+#include <optimized/const_math.h>
 #include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
 #include <system/sys_info.h>
 
+#include <allocator/common/alloc_stats.h>
 #include <allocator/common/internal_returns.h>
 #include <allocator/rseq/rseq_base.h>
 
 #include <allocator/slab_layout/obj_slab.h>
 #include <allocator/slab_layout/super_slab.h>
 
+#include "slab_config.h"
+#include "slab_depot.h"
 #include "slab_manager_template_helpers.h"
 
 //////////////////////////////////////////////////////////////////////
 // simple slab manager that simply allocates 1 super_slab/obj_slab per
-// processor. Region size must be set with template parameters
+// shard. Region size must be set with template parameters. A shard is a
+// group of cpus sharing a slab, chosen with granularity (slab_config.h). The
+// number of processors and the cpu -> shard map are read at construction
+// (sysi::get_sys_info()) so the same binary works on any host.
+//
+// fixed_slab_manager is the PER_CPU version which uses rseq for everything.
+// Wider granularities use lock prefixed ops on the shard's slab. ndepot_slabs
+// adds a slab_depot shards borrow from once their own slab is full.
 
-template<typename T, uint32_t levels, uint32_t... per_level_nvec>
-struct fixed_slab_manager;
+template<typename T,
+         shard_granularity granularity,
+         uint32_t          ndepot_slabs,
+         uint32_t          levels,
+         uint32_t... per_level_nvec>
+struct sharded_fixed_slab_manager;
 
-template<typename T, uint32_t levels, uint32_t... per_level_nvec>
-struct internal_fixed_slab_manager {
-    using slab_t =
-        typename fixed_slab_manager<T, levels, per_level_nvec...>::slab_t;
-    slab_t obj_slabs[NPROCS];
-    internal_fixed_slab_manager() = default;
+template<typename T,
+         shard_granularity granularity,
+         uint32_t          ndepot_slabs,
+         uint32_t          levels,
+         uint32_t... per_level_nvec>
+struct internal_sharded_slab_manager {
+    using slab_t  = typename sharded_fixed_slab_manager<T,
+                                                       granularity,
+                                                       ndepot_slabs,
+                                                       levels,
+                                                       per_level_nvec...>::slab_t;
+    using depot_t = typename sharded_fixed_slab_manager<T,
+                                                        granularity,
+                                                        ndepot_slabs,
+                                                        levels,
+                                                        per_level_nvec...>::depot_t;
+
+    static constexpr const uint32_t max_cpus =
+        (PAGE_SIZE - 2 * sizeof(uint32_t)) / sizeof(uint16_t);
+
+    // only read on construction / destruction. obj_slabs are page aligned so
+    // the header (and shard_of map) fits in the first page for free and each
+    // shard's slab starts on its own page
+    uint32_t nprocs;
+    uint32_t nshards;
+    uint16_t shard_of[max_cpus];
+    slab_t   obj_slabs[] ALIGN_ATTR(PAGE_SIZE);
+
+    static uint32_t
+    group_of(const sysi::sys_info_cache & info, const uint32_t cpu) {
+        switch (granularity) {
+            case PER_CORE:
+                return info.core_of[cpu];
+            case PER_LLC:
+                return info.llc_of[cpu];
+            case PER_NODE:
+                return info.node_of[cpu];
+            default:
+                return cpu;
+        }
+    }
+
+    static uint32_t
+    ngroups(const sysi::sys_info_cache & info) {
+        switch (granularity) {
+            case PER_CORE:
+                return info.ncores;
+            case PER_LLC:
+                return info.nllcs;
+            case PER_NODE:
+                return info.nnodes;
+            default:
+                return info.nprocs_possible;
+        }
+    }
+
+    internal_sharded_slab_manager(const uint32_t _nprocs) : nprocs(_nprocs) {
+        const sysi::sys_info_cache & info = sysi::get_sys_info();
+        nshards                           = ngroups(info);
+        if (granularity != PER_CPU) {
+            DIE_ASSERT(nprocs <= max_cpus,
+                       "Too many cpus for shard map (%u > %u)\n",
+                       nprocs,
+                       max_cpus);
+            for (uint32_t i = 0; i < nprocs; ++i) {
+                shard_of[i] = group_of(info, i);
+            }
+        }
+        if constexpr (ndepot_slabs) {
+            new ((void *)depot()) depot_t();
+        }
+    }
+
+    // depot (if any) starts on the first page after the shards' slabs
+    static uint64_t
+    depot_offset(const uint32_t _nshards) {
+        return cmath::roundup<uint64_t>(
+            sizeof(internal_sharded_slab_manager) + _nshards * sizeof(slab_t),
+            PAGE_SIZE);
+    }
+
+    static uint64_t
+    size(const uint32_t _nshards) {
+        if constexpr (ndepot_slabs) {
+            return depot_offset(_nshards) + depot_t::size(_nshards);
+        }
+        return sizeof(internal_sharded_slab_manager) +
+               _nshards * sizeof(slab_t);
+    }
+
+    depot_t *
+    depot() {
+        return (depot_t *)(((uint64_t)this) + depot_offset(nshards));
+    }
 };
 
-template<typename T, uint32_t levels, uint32_t... per_level_nvec>
-struct fixed_slab_manager {
-    using slab_t = typename type_helper<T, levels, 0, per_level_nvec...>::type;
+template<typename T,
+         shard_granularity granularity,
+         uint32_t          ndepot_slabs,
+         uint32_t          levels,
+         uint32_t... per_level_nvec>
+struct sharded_fixed_slab_manager {
+    using ops_t = typename std::
+        conditional<granularity == PER_CPU, rseq_slab_ops, locked_slab_ops>::type;
+    using slab_t =
+        typename ops_type_helper<T, ops_t, levels, 0, per_level_nvec...>::type;
+
+    // depot slabs are the same size as the innermost slab
+    using depot_t =
+        slab_depot<T, ndepot_slabs, get_N<per_level_nvec...>(levels)>;
 
     static constexpr uint32_t
     _capacity(uint32_t n) {
@@ -43,60 +158,281 @@ struct fixed_slab_manager {
     }
     static constexpr const uint32_t capacity = _capacity(levels);
 
-    using internal_manager_t =
-        internal_fixed_slab_manager<T, levels, per_level_nvec...>;
-    
+    // extra objects shared by all shards through the depot
+    static constexpr const uint32_t depot_capacity =
+        ndepot_slabs ? depot_t::capacity : 0;
+
+    using internal_manager_t = internal_sharded_slab_manager<T,
+                                                             granularity,
+                                                             ndepot_slabs,
+                                                             levels,
+                                                             per_level_nvec...>;
+
+    //////////////////////////////////////////////////////////////////////
+    // 32 bit handles. The low handle_slot_bits are the object's slot in its
+    // slab (slot_of / at_slot, just the slab layout arithmetic with constant
+    // divisors) and the high bits are the slab's index: shard, or nshards +
+    // i for the i'th depot slab. Objects can be stored as handle_t instead of
+    // T * and decoded in O(levels) with to_ptr
+    using handle_t = uint32_t;
+    static constexpr const handle_t NULL_HANDLE = (~(0U));
+    static constexpr const uint32_t handle_slot_bits =
+        cmath::ulog2<uint32_t>(cmath::next_p2<uint32_t>(slab_t::nslots));
+    static constexpr const handle_t handle_slot_mask =
+        (((1UL) << handle_slot_bits) - 1);
+    static_assert(handle_slot_bits < 32, "Slab too large for 32 bit handles");
+
+    // all 1s is NULL_HANDLE so the last slab index is unusable
+    static constexpr const uint64_t max_handle_slabs =
+        ((1UL) << (32 - handle_slot_bits)) - 1;
+
     internal_manager_t * m;
 
-    fixed_slab_manager()
-        : fixed_slab_manager(mmap_alloc_noreserve(sizeof(internal_manager_t))) {
+    sharded_fixed_slab_manager()
+        : sharded_fixed_slab_manager(mmap_alloc_noreserve(region_size())) {
 
-        // this is just to get the first page for each CPU
+        // this is just to get the first page for each shard we can run on
         // DO NOT USE ON MULTI SOCKET SYSTEM!!!!
-        for (uint32_t i = 0; i < NPROCS; ++i) {
-            *((uint64_t *)(m->obj_slabs + i)) = 0;
+        cpu_set_t      cset;
+        const uint32_t nallowed = sysi::read_allowed_cpus(&cset);
+        for (uint32_t i = 0; i < m->nprocs && i < nallowed; ++i) {
+            if (CPU_ISSET(i, &cset)) {
+                *((uint64_t *)(m->obj_slabs + shard_of(i))) = 0;
+            }
         }
     }
 
-    fixed_slab_manager(void * const base) {
+    // base must be at least region_size() bytes
+    sharded_fixed_slab_manager(void * const base) {
         m = (internal_manager_t *)base;
-        new ((void * const)base) internal_manager_t();
+        new ((void * const)base) internal_manager_t(sysi::runtime_nprocs());
+        DIE_ASSERT(m->nshards + ndepot_slabs <= max_handle_slabs,
+                   "Too many slabs for 32 bit handles (%u > %lu)\n",
+                   m->nshards + ndepot_slabs,
+                   max_handle_slabs);
     }
 
-    ~fixed_slab_manager() {
-        safe_munmap(m, sizeof(internal_manager_t));
+    // base holds a manager built with the constructor above (on a host with
+    // the same cpus). Nothing is written, objects and bitmaps are kept
+    sharded_fixed_slab_manager(void * const base, reattach_region) {
+        m = (internal_manager_t *)base;
+        DIE_ASSERT(m->nprocs == sysi::runtime_nprocs() &&
+                       m->nshards ==
+                           internal_manager_t::ngroups(sysi::get_sys_info()),
+                   "Region built for %u cpus / %u shards\n",
+                   m->nprocs,
+                   m->nshards);
+    }
+
+    ~sharded_fixed_slab_manager() {
+        safe_munmap(m, internal_manager_t::size(m->nshards));
+    }
+
+    static uint64_t
+    region_size() {
+        return internal_manager_t::size(
+            internal_manager_t::ngroups(sysi::get_sys_info()));
+    }
+
+    // objects available beyond what each shard's own slab holds
+    uint64_t
+    extra_capacity() const {
+        return depot_capacity;
     }
 
     void
     reset() {
-        memset(m, 0, sizeof(internal_manager_t));
+        memset((void *)(m->obj_slabs), 0, m->nshards * sizeof(slab_t));
+        if constexpr (ndepot_slabs) {
+            memset((void *)(m->depot()), 0, depot_t::size(m->nshards));
+            new ((void *)(m->depot())) depot_t();
+        }
     }
 
+    uint32_t ALWAYS_INLINE
+    shard_of(const uint32_t cpu) const {
+        if (granularity == PER_CPU) {
+            return cpu;
+        }
+        return m->shard_of[cpu];
+    }
+
+    // zero is for _allocate_zeroed
+    template<bool zero = false>
     T *
     _allocate() {
         uint64_t ptr;
         do {
             const uint32_t start_cpu = get_start_cpu();
-            IMPOSSIBLE_VALUES(start_cpu > NPROCS);
-            ptr = m->obj_slabs[start_cpu]._allocate(start_cpu);
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ptr = m->obj_slabs[shard_of(start_cpu)].template _allocate<zero>(
+                start_cpu);
+            if (BRANCH_UNLIKELY(ptr == FAILED_RSEQ)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
         } while (BRANCH_UNLIKELY(ptr == FAILED_RSEQ));
+        if constexpr (ndepot_slabs) {
+            if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
+                ptr = m->depot()->template _allocate<zero>(
+                    shard_of(get_start_cpu()));
+            }
+        }
+        ALLOC_STAT_INCR(ALLOCS);
+        if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
+            ALLOC_STAT_INCR(FULL);
+        }
         return (T *)(ptr & (~(0x1UL)));
     }
+
+    // calloc. Only slots that have been handed out before are cleared, the
+    // rest are still zero from mmap (see obj_slab::hand_out)
+    T *
+    _allocate_zeroed() {
+        return _allocate<true>();
+    }
+
+    ALWAYS_INLINE T *
+    to_ptr(const handle_t h) const {
+        IMPOSSIBLE_VALUES(h == NULL_HANDLE);
+        const uint32_t slab_idx = h >> handle_slot_bits;
+        if constexpr (ndepot_slabs) {
+            if (BRANCH_UNLIKELY(slab_idx >= m->nshards)) {
+                return m->depot()->slabs[slab_idx - m->nshards].at_slot(
+                    h & handle_slot_mask);
+            }
+        }
+        return m->obj_slabs[slab_idx].at_slot(h & handle_slot_mask);
+    }
+
+    handle_t ALWAYS_INLINE
+    to_handle(const T * const addr) const {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m->obj_slabs)));
+        const uint32_t slab_idx =
+            (((uint64_t)addr) - ((uint64_t)(m->obj_slabs))) / sizeof(slab_t);
+        if constexpr (ndepot_slabs) {
+            if (BRANCH_UNLIKELY(slab_idx >= m->nshards)) {
+                depot_t * const depot = m->depot();
+                const uint32_t  depot_idx =
+                    (((uint64_t)addr) - ((uint64_t)(depot->slabs))) /
+                    sizeof(typename depot_t::slab_t);
+                return ((m->nshards + depot_idx) << handle_slot_bits) |
+                       depot->slabs[depot_idx].slot_of(addr);
+            }
+        }
+        return (slab_idx << handle_slot_bits) |
+               m->obj_slabs[slab_idx].slot_of(addr);
+    }
+
+    // 1 if addr is the start of an object slot in this manager, allocated or
+    // not
+    uint32_t
+    is_slot(const T * const addr) const {
+        const uint64_t a      = (uint64_t)addr;
+        const uint64_t shards = (uint64_t)(m->obj_slabs);
+        uint32_t       in_region =
+            a >= shards && a < shards + m->nshards * sizeof(slab_t);
+        if constexpr (ndepot_slabs) {
+            const uint64_t depot_slabs = (uint64_t)(m->depot()->slabs);
+            in_region |=
+                a >= depot_slabs &&
+                a < depot_slabs + ndepot_slabs * sizeof(typename depot_t::slab_t);
+        }
+        return in_region && to_ptr(to_handle(addr)) == addr;
+    }
+
+    // calls f(T *) on every allocated object by walking the slab bitmaps
+    // (see obj_slab::for_each_live). Cost is the size of the bitmaps plus
+    // the number of live objects, no object memory is touched except by f
+    template<typename func_t>
+    void
+    for_each_live(func_t && f) const {
+        for (uint32_t i = 0; i < m->nshards; ++i) {
+            m->obj_slabs[i].for_each_live(f);
+        }
+        if constexpr (ndepot_slabs) {
+            m->depot()->for_each_live(f);
+        }
+    }
+
+    // slabs a handle can name: the shards' then the depot's
+    uint32_t
+    nslabs() const {
+        return m->nshards + ndepot_slabs;
+    }
+
+    // objects slab slab_idx (handle >> handle_slot_bits) holds
+    uint32_t
+    slab_capacity(const uint32_t slab_idx) const {
+        if constexpr (ndepot_slabs) {
+            if (slab_idx >= m->nshards) {
+                return depot_t::slab_t::nslots;
+            }
+        }
+        return capacity;
+    }
+
+    handle_t
+    _allocate_handle() {
+        T * const ptr = _allocate();
+        return BRANCH_LIKELY(ptr != NULL) ? to_handle(ptr) : NULL_HANDLE;
+    }
+
+    void
+    _free_handle(const handle_t h) {
+        _free(to_ptr(h));
+    }
+
     void
     _free(T * addr) {
-        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)m));
-        const uint32_t from_cpu =
-            (((uint64_t)addr) - ((uint64_t)m)) / sizeof(slab_t);
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m->obj_slabs)));
+        const uint32_t from_shard =
+            (((uint64_t)addr) - ((uint64_t)(m->obj_slabs))) / sizeof(slab_t);
 
-        IMPOSSIBLE_VALUES(from_cpu > NPROCS);
-        if (from_cpu == get_start_cpu()) {
-            m->obj_slabs[from_cpu]._optimistic_free(addr, from_cpu);
+        ALLOC_STAT_INCR(FREES);
+        if constexpr (ndepot_slabs) {
+            if (BRANCH_UNLIKELY(from_shard >= m->nshards)) {
+                ALLOC_STAT_INCR(REMOTE_FREES);
+                m->depot()->_free(addr);
+                return;
+            }
+        }
+        IMPOSSIBLE_VALUES(from_shard >= m->nshards);
+        const uint32_t start_cpu = get_start_cpu();
+        if (from_shard == shard_of(start_cpu)) {
+            m->obj_slabs[from_shard]._optimistic_free(addr, start_cpu);
         }
         else {
-            m->obj_slabs[from_cpu]._free(addr);
+            ALLOC_STAT_INCR(REMOTE_FREES);
+            m->obj_slabs[from_shard]._free(addr);
         }
     }
 };
 
+template<typename T, uint32_t levels, uint32_t... per_level_nvec>
+struct fixed_slab_manager
+    : sharded_fixed_slab_manager<T, PER_CPU, 0, levels, per_level_nvec...> {
+    using sharded_fixed_slab_manager<T, PER_CPU, 0, levels, per_level_nvec...>::
+        sharded_fixed_slab_manager;
+};
+
+// fixed_slab_manager plus a depot of ndepot_slabs innermost slabs that cpus
+// whose own slab is full borrow from (see slab_depot.h)
+template<typename T,
+         uint32_t ndepot_slabs,
+         uint32_t levels,
+         uint32_t... per_level_nvec>
+struct depot_fixed_slab_manager
+    : sharded_fixed_slab_manager<T,
+                                 PER_CPU,
+                                 ndepot_slabs,
+                                 levels,
+                                 per_level_nvec...> {
+    using sharded_fixed_slab_manager<T,
+                                     PER_CPU,
+                                     ndepot_slabs,
+                                     levels,
+                                     per_level_nvec...>::
+        sharded_fixed_slab_manager;
+};
 
 #endif
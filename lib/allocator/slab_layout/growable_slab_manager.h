@@ -0,0 +1,273 @@
+#ifndef _GROWABLE_SLAB_MANAGER_H_
+#define _GROWABLE_SLAB_MANAGER_H_
+
+#include <stdint.h>
+#include <new>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/internal_returns.h>
+#include <allocator/rseq/rseq_base.h>
+
+#include <allocator/slab_layout/obj_slab.h>
+#include <allocator/slab_layout/super_slab.h>
+
+#include "slab_manager_template_helpers.h"
+
+//////////////////////////////////////////////////////////////////////
+// fixed_slab_manager that doesn't have to be sized for the worst case peak
+// of any one cpu. A range of max_slabs slab_t is reserved (MAP_NORESERVE so
+// untouched slabs cost nothing) and each cpu starts with one of them. When
+// the cpu's active slab returns FAILED_VEC_FULL the cpu first looks through
+// the other slabs in its chain (frees may have made room) and otherwise
+// attaches the next unused slab from the range to its chain.
+//
+// A slab belongs to the cpu that attached it forever so everything is still
+// rseq. The fast path is the same as fixed_slab_manager with one extra load
+// (active[cpu]) and free has one extra load (the slab's owner).
+
+// default number of slabs reserved for each cpu (they are a shared pool, a
+// cpu may end up with more or fewer)
+static constexpr const uint32_t GROWABLE_DEFAULT_SLABS_PER_CPU = 16;
+
+template<typename T, uint32_t levels, uint32_t... per_level_nvec>
+struct internal_growable_slab_manager {
+    using slab_t = typename type_helper<T, levels, 0, per_level_nvec...>::type;
+
+    static constexpr const uint32_t NONE = (~(0U));
+
+    struct chain_link {
+        uint32_t next;
+        uint32_t owner;
+    };
+
+    // all read only after construction
+    uint32_t     nprocs;
+    uint32_t     max_slabs;
+    uint32_t *   active;  // per cpu, slab the fast path allocates from
+    uint32_t *   head;    // per cpu, most recently attached slab
+    chain_link * links;   // per slab
+    slab_t *     slabs;
+
+    // number of slabs attached so far
+    uint32_t nslabs ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    internal_growable_slab_manager(const uint32_t _nprocs,
+                                   const uint32_t _max_slabs)
+        : nprocs(_nprocs), max_slabs(_max_slabs) {
+        active = (uint32_t *)(this + 1);
+        head   = active + nprocs;
+        links  = (chain_link *)(head + nprocs);
+        slabs  = (slab_t *)(((uint64_t)this) + meta_size(nprocs, max_slabs));
+
+        // cpu i starts with slab i
+        for (uint32_t i = 0; i < nprocs; ++i) {
+            active[i]      = i;
+            head[i]        = i;
+            links[i].next  = NONE;
+            links[i].owner = i;
+        }
+        nslabs = nprocs;
+    }
+
+    static uint64_t
+    meta_size(const uint32_t _nprocs, const uint32_t _max_slabs) {
+        return cmath::roundup<uint64_t>(
+            sizeof(internal_growable_slab_manager) +
+                2 * _nprocs * sizeof(uint32_t) + _max_slabs * sizeof(chain_link),
+            PAGE_SIZE);
+    }
+
+    static uint64_t
+    size(const uint32_t _nprocs, const uint32_t _max_slabs) {
+        return meta_size(_nprocs, _max_slabs) + _max_slabs * sizeof(slab_t);
+    }
+};
+
+template<typename T, uint32_t levels, uint32_t... per_level_nvec>
+struct growable_slab_manager {
+    using slab_t = typename type_helper<T, levels, 0, per_level_nvec...>::type;
+
+    static constexpr uint32_t
+    _capacity(uint32_t n) {
+        return 64 * get_N<per_level_nvec...>(n) * (n ? _capacity(n - 1) : 1);
+    }
+    // capacity of one slab
+    static constexpr const uint32_t capacity = _capacity(levels);
+
+    using internal_manager_t =
+        internal_growable_slab_manager<T, levels, per_level_nvec...>;
+    static constexpr const uint32_t NONE = internal_manager_t::NONE;
+
+    internal_manager_t * m;
+
+    growable_slab_manager()
+        : growable_slab_manager(sysi::runtime_nprocs() *
+                                GROWABLE_DEFAULT_SLABS_PER_CPU) {}
+
+    growable_slab_manager(const uint32_t max_slabs) {
+        const uint32_t nprocs = sysi::runtime_nprocs();
+        DIE_ASSERT(max_slabs >= nprocs,
+                   "Need at least 1 slab per cpu (%u < %u)\n",
+                   max_slabs,
+                   nprocs);
+        m = (internal_manager_t *)mmap_alloc_noreserve(
+            internal_manager_t::size(nprocs, max_slabs));
+        new ((void * const)m) internal_manager_t(nprocs, max_slabs);
+
+        // this is just to get the first page of each initial slab for the
+        // CPUs we can run on
+        cpu_set_t      cset;
+        const uint32_t nallowed = sysi::read_allowed_cpus(&cset);
+        for (uint32_t i = 0; i < nprocs && i < nallowed; ++i) {
+            if (CPU_ISSET(i, &cset)) {
+                *((uint64_t *)(m->slabs + i)) = 0;
+            }
+        }
+    }
+
+    ~growable_slab_manager() {
+        safe_munmap(m, internal_manager_t::size(m->nprocs, m->max_slabs));
+    }
+
+    static uint64_t
+    region_size(const uint32_t max_slabs) {
+        return internal_manager_t::size(sysi::runtime_nprocs(), max_slabs);
+    }
+
+    // objects available beyond the initial slab of each cpu
+    uint64_t
+    extra_capacity() const {
+        return ((uint64_t)(m->max_slabs - m->nprocs)) * capacity;
+    }
+
+    void
+    reset() {
+        const uint32_t nprocs    = m->nprocs;
+        const uint32_t max_slabs = m->max_slabs;
+        memset((void *)(m->slabs), 0, m->nslabs * sizeof(slab_t));
+        new ((void * const)m) internal_manager_t(nprocs, max_slabs);
+    }
+
+    // slow path. Slabs earlier in the chain may have had frees since they
+    // went full so try those before attaching a new one
+    template<bool zero>
+    uint64_t
+    grow(const uint32_t start_cpu) {
+        const uint32_t cur = m->active[start_cpu];
+        for (uint32_t i = __atomic_load_n(m->head + start_cpu, __ATOMIC_ACQUIRE);
+             i != NONE;
+             i = m->links[i].next) {
+            if (i == cur) {
+                continue;
+            }
+            const uint64_t ret =
+                m->slabs[i].template _allocate<zero>(start_cpu);
+            if (successful(ret)) {
+                m->active[start_cpu] = i;
+                return ret;
+            }
+            if (ret == FAILED_RSEQ) {
+                return FAILED_RSEQ;
+            }
+        }
+
+        uint32_t idx = __atomic_load_n(&(m->nslabs), __ATOMIC_RELAXED);
+        do {
+            if (BRANCH_UNLIKELY(idx >= m->max_slabs)) {
+                return FAILED_VEC_FULL;
+            }
+        } while (!__atomic_compare_exchange_n(&(m->nslabs),
+                                              &idx,
+                                              idx + 1,
+                                              false,
+                                              __ATOMIC_RELAXED,
+                                              __ATOMIC_RELAXED));
+        ALLOC_STAT_INCR(SLAB_GROWS);
+
+        // another thread on this cpu may be attaching too so push with a cas
+        m->links[idx].owner = start_cpu;
+        uint32_t old_head   = m->head[start_cpu];
+        do {
+            m->links[idx].next = old_head;
+        } while (!__atomic_compare_exchange_n(m->head + start_cpu,
+                                              &old_head,
+                                              idx,
+                                              false,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        m->active[start_cpu] = idx;
+
+        // on FAILED_RSEQ the retry will find idx as active
+        return m->slabs[idx].template _allocate<zero>(start_cpu);
+    }
+
+    // zero is for _allocate_zeroed
+    template<bool zero = false>
+    T *
+    _allocate() {
+        uint64_t ptr;
+        do {
+            const uint32_t start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ptr = m->slabs[m->active[start_cpu]].template _allocate<zero>(
+                start_cpu);
+            if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
+                ptr = grow<zero>(start_cpu);
+            }
+            if (BRANCH_UNLIKELY(ptr == FAILED_RSEQ)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
+        } while (BRANCH_UNLIKELY(ptr == FAILED_RSEQ));
+        ALLOC_STAT_INCR(ALLOCS);
+        if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
+            ALLOC_STAT_INCR(FULL);
+        }
+        return (T *)(ptr & (~(0x1UL)));
+    }
+
+    // calloc, see obj_slab::hand_out. Attached slabs are zero because the
+    // reserved range is only ever touched by slabs in use
+    T *
+    _allocate_zeroed() {
+        return _allocate<true>();
+    }
+
+    // calls f(T *) for every live object in every attached slab (see
+    // obj_slab::for_each_live). Slabs attached while this runs may or may not
+    // be visited
+    template<typename func_t>
+    void
+    for_each_live(func_t && f) const {
+        const uint32_t nslabs = __atomic_load_n(&(m->nslabs), __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < nslabs; ++i) {
+            m->slabs[i].for_each_live(f);
+        }
+    }
+
+    void
+    _free(T * addr) {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m->slabs)));
+        const uint32_t idx =
+            (((uint64_t)addr) - ((uint64_t)(m->slabs))) / sizeof(slab_t);
+
+        IMPOSSIBLE_VALUES(idx >= m->max_slabs);
+        ALLOC_STAT_INCR(FREES);
+        const uint32_t owner = m->links[idx].owner;
+        if (owner == get_start_cpu()) {
+            m->slabs[idx]._optimistic_free(addr, owner);
+        }
+        else {
+            ALLOC_STAT_INCR(REMOTE_FREES);
+            m->slabs[idx]._free(addr);
+        }
+    }
+};
+
+#endif
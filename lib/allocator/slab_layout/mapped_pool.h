@@ -0,0 +1,152 @@
+#ifndef _MAPPED_POOL_H_
+#define _MAPPED_POOL_H_
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <type_traits>
+#include <utility>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include "slab_config.h"
+
+//////////////////////////////////////////////////////////////////////
+// What persistent_pool.h and shared_pool.h have in common: a slab manager
+// whose region is a MAP_SHARED mapping of fd, laid out as one header page
+// followed by the manager's region. The derived pools only decide where fd
+// comes from and whether to build a new manager in the region or reattach
+// to the one already there (reattach_region, see slab_config.h).
+//
+// manager_t is anything with a (void * base, args...) constructor, a
+// matching (void * base, args..., reattach_region) one and
+// region_size(args...): sharded_fixed_slab_manager (fixed / depot /
+// sharded) and dynamic_slab_manager.
+//
+// The mapping can be at a different address in every process / run so
+// objects are referred to by offset (to_offset / from_offset, 0 is NULL) or
+// by manager handle, never by T *. roots[] in the header is where the
+// application keeps the offsets / handles it needs to find its data.
+
+static constexpr const uint32_t MAPPED_POOL_NROOTS = 32;
+
+struct mapped_pool_header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t obj_size;
+    uint64_t region_size;
+    uint32_t nprocs;
+    // up to the derived pool (persistent_pool: clean, shared_pool: ready)
+    uint32_t state;
+    uint64_t roots[MAPPED_POOL_NROOTS];
+};
+static_assert(sizeof(mapped_pool_header) <= PAGE_SIZE,
+              "Pool header has to fit before the region");
+
+template<typename manager_t>
+struct mapped_pool {
+    using T = typename std::remove_pointer<decltype(
+        std::declval<manager_t &>()._allocate())>::type;
+
+    int32_t              fd;
+    uint64_t             map_size;
+    mapped_pool_header * hdr;
+    manager_t *          mgr;
+
+    // the manager's destructor unmaps this process's mapping of the region
+    ~mapped_pool() {
+        delete mgr;
+        safe_munmap(hdr, PAGE_SIZE);
+        close(fd);
+    }
+
+    template<typename... args_t>
+    static uint64_t
+    pool_size(args_t... args) {
+        return PAGE_SIZE + manager_t::region_size(args...);
+    }
+
+    mapped_pool_header *
+    map() {
+        return (mapped_pool_header *)safe_mmap(NULL,
+                                               map_size,
+                                               (PROT_READ | PROT_WRITE),
+                                               MAP_SHARED,
+                                               fd,
+                                               0);
+    }
+
+    // layout of a new pool, state is left to the caller
+    void
+    init_header(const uint64_t magic, const uint64_t version) {
+        hdr->magic       = magic;
+        hdr->version     = version;
+        hdr->obj_size    = sizeof(T);
+        hdr->region_size = map_size - PAGE_SIZE;
+        hdr->nprocs      = sysi::runtime_nprocs();
+    }
+
+    // 1 if the pool in the mapping was built by this build on this host
+    uint32_t
+    header_matches(const uint64_t magic, const uint64_t version) const {
+        return hdr->magic == magic && hdr->version == version &&
+               hdr->obj_size == sizeof(T) &&
+               hdr->region_size == map_size - PAGE_SIZE &&
+               hdr->nprocs == sysi::runtime_nprocs();
+    }
+
+    // builds a new manager in the region or takes over the one in it
+    template<typename... args_t>
+    void
+    init_manager(const uint32_t reattach, args_t... args) {
+        if (reattach) {
+            mgr = new manager_t(region(), args..., reattach_region{});
+        }
+        else {
+            mgr = new manager_t(region(), args...);
+        }
+    }
+
+    void *
+    region() const {
+        return (void *)(((uint64_t)hdr) + PAGE_SIZE);
+    }
+
+    uint64_t *
+    roots() {
+        return hdr->roots;
+    }
+
+    // the same object has the same offset in every mapping. The header page
+    // is never an object so offset 0 is free to mean NULL
+    uint64_t ALWAYS_INLINE
+    to_offset(const T * const ptr) const {
+        return ptr == NULL ? 0 : ((uint64_t)ptr) - ((uint64_t)hdr);
+    }
+
+    ALWAYS_INLINE T *
+    from_offset(const uint64_t offset) const {
+        return offset == 0 ? NULL : (T *)(((uint64_t)hdr) + offset);
+    }
+
+    T *
+    _allocate() {
+        return mgr->_allocate();
+    }
+
+    T *
+    _allocate_zeroed() {
+        return mgr->_allocate_zeroed();
+    }
+
+    void
+    _free(T * const ptr) {
+        mgr->_free(ptr);
+    }
+};
+
+#endif
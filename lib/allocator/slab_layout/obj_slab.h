@@ -2,6 +2,7 @@
 #define _OBJ_SLAB_H_
 
 #include <stdint.h>
+#include <string.h>
 
 #include <misc/cpp_attributes.h>
 
@@ -16,9 +17,12 @@
 
 #include <allocator/common/internal_returns.h>
 #include <allocator/common/safe_atomics.h>
+#include <allocator/common/slab_ops.h>
 #include <allocator/common/vec_constants.h>
 
-template<typename T, uint32_t nvec = 7>
+// ops_t is rseq_slab_ops when the slab belongs to a single cpu and
+// locked_slab_ops when it is shared (see slab_ops.h)
+template<typename T, uint32_t nvec = 7, typename ops_t = rseq_slab_ops>
 struct obj_slab {
 
     uint64_t available_slots[nvec] ALIGN_ATTR(CACHE_LINE_SIZE);
@@ -34,12 +38,54 @@ struct obj_slab {
     // returned by thread C's allocation.
     uint64_t freed_slots_lock;
 
+    // 1 + highest slot ever handed out. Slots at or above it have never been
+    // written so are still zero from mmap (see hand_out). With rseq ops this
+    // is also the bump cursor: slots below it are handed out in order before
+    // the bitmap is ever searched (see _allocate)
+    uint64_t high_water;
+
     uint64_t freed_slots[nvec] ALIGN_ATTR(CACHE_LINE_SIZE);
     T        obj_arr[64 * nvec];
 
 
     obj_slab() = default;
 
+    // dense index of every object in the slab ([0, nslots)) and back. Used
+    // for 32 bit handles
+    static constexpr const uint32_t nslots = 64 * nvec;
+
+    uint32_t ALWAYS_INLINE
+    slot_of(const T * const addr) const {
+        return addr - obj_arr;
+    }
+
+    ALWAYS_INLINE T *
+    at_slot(const uint32_t slot) {
+        return obj_arr + slot;
+    }
+
+    // calls f(T *) on every object that is allocated right now (set in
+    // available_slots, not waiting in freed_slots and below high_water, the
+    // bump cursor's word is marked taken ahead of it). Only a snapshot, an
+    // object allocated / freed concurrently may or may not be seen
+    template<typename func_t>
+    void
+    for_each_live(func_t && f) {
+        const uint64_t hw = __atomic_load_n(&high_water, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < nvec && 64 * i < hw; ++i) {
+            uint64_t live =
+                __atomic_load_n(available_slots + i, __ATOMIC_ACQUIRE) &
+                (~__atomic_load_n(freed_slots + i, __ATOMIC_ACQUIRE));
+            if (hw < 64 * (i + 1)) {
+                live &= ((1UL) << (hw % 64)) - 1;
+            }
+            while (live) {
+                f(obj_arr + 64 * i + bits::find_first_one<uint64_t>(live));
+                live &= live - 1;
+            }
+        }
+    }
+
     void
     _optimistic_free(T * const addr, const uint32_t start_cpu) {
         IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(&obj_arr[0])));
@@ -48,9 +94,9 @@ struct obj_slab {
 
         IMPOSSIBLE_VALUES(pos_idx >= nvec * 64);
 
-        if (BRANCH_UNLIKELY(rseq_xor(available_slots + (pos_idx / 64),
-                                     ((1UL) << (pos_idx % 64)),
-                                     start_cpu))) {
+        if (BRANCH_UNLIKELY(ops_t::xor_bits(available_slots + (pos_idx / 64),
+                                            ((1UL) << (pos_idx % 64)),
+                                            start_cpu))) {
             atomic_or(freed_slots + (pos_idx / 64), ((1UL) << (pos_idx % 64)));
         }
     }
@@ -65,8 +111,55 @@ struct obj_slab {
         atomic_or(freed_slots + (pos_idx / 64), ((1UL) << (pos_idx % 64)));
     }
 
+    // called once slot is ours. Moves high_water past it and, if zero, clears
+    // the object unless it was never handed out before. high_water only
+    // needs to be ordered with the slot's own bitmap ops (nobody else can get
+    // slot until we free it) so a relaxed cas is enough
+    template<bool zero>
+    uint64_t ALWAYS_INLINE
+    hand_out(const uint32_t slot) {
+        uint64_t hw    = __atomic_load_n(&high_water, __ATOMIC_RELAXED);
+        uint32_t fresh = 0;
+        while (hw <= slot) {
+            if (__atomic_compare_exchange_n(&high_water,
+                                            &hw,
+                                            (uint64_t)(slot + 1),
+                                            false,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                fresh = 1;
+                break;
+            }
+        }
+        if constexpr (zero) {
+            if (!fresh) {
+                memset((void *)(obj_arr + slot), 0, sizeof(T));
+            }
+        }
+        return ((uint64_t)&obj_arr[slot]);
+    }
+
+    // zero is for _allocate_zeroed, the returned object is all 0s
+    template<bool zero = false>
     uint64_t
     _allocate(const uint32_t start_cpu) {
+        // until the cursor runs out slots come straight off it: no bitmap
+        // search, pages are touched in order and nothing needs zeroing.
+        // Slots freed in the meantime wait for the bitmap path below, which
+        // only runs once every slot has been handed out (and so always
+        // clears for zero)
+        if constexpr (ops_t::can_bump) {
+            if (BRANCH_LIKELY(high_water < nslots)) {
+                const uint64_t slot =
+                    ops_t::bump(&high_water, available_slots, nslots, start_cpu);
+                if (BRANCH_LIKELY(slot < nslots)) {
+                    return ((uint64_t)&obj_arr[slot]);
+                }
+                if (BRANCH_UNLIKELY(slot == (~(0UL)))) {
+                    return FAILED_RSEQ;
+                }
+            }
+        }
         for (uint32_t i = 0; i < nvec; ++i) {
             // try allocate
             if (BRANCH_LIKELY(available_slots[i] != vec::FULL)) {
@@ -79,15 +172,16 @@ struct obj_slab {
                     return FAILED_RSEQ;
                 }
 
-                if (BRANCH_UNLIKELY(or_if_unset(available_slots + i,
-                                                ((1UL) << idx),
-                                                start_cpu))) {
+                if (BRANCH_UNLIKELY(ops_t::or_if_unset(available_slots + i,
+                                                       ((1UL) << idx),
+                                                       start_cpu))) {
                     return FAILED_RSEQ;
                 }
-                return ((uint64_t)&obj_arr[64 * i + idx]);
+                return hand_out<zero>(64 * i + idx);
             }
             // try free
-            if (BRANCH_UNLIKELY(acquire_lock(&freed_slots_lock, start_cpu))) {
+            if (BRANCH_UNLIKELY(
+                    ops_t::acquire_lock(&freed_slots_lock, start_cpu))) {
                 return FAILED_RSEQ;
             }
 
@@ -96,15 +190,14 @@ struct obj_slab {
 #ifdef CONTINUE_RSEQ
             if (freed_slots[i] != vec::EMPTY) {
                 const uint64_t reclaimed_slots =
-                    try_reclaim_free_slots(available_slots + i,
-                                           freed_slots + i,
-                                           start_cpu);
+                    ops_t::try_reclaim_free_slots(available_slots + i,
+                                                  freed_slots + i,
+                                                  start_cpu);
                 if (BRANCH_LIKELY(reclaimed_slots)) {
                     atomic_xor(freed_slots + i, reclaimed_slots);
                     freed_slots_lock = 0;
-                    return ((uint64_t)(
-                        &obj_arr[64 * i + bits::find_first_one<uint64_t>(
-                                              reclaimed_slots)]));
+                    return hand_out<zero>(
+                        64 * i + bits::find_first_one<uint64_t>(reclaimed_slots));
                 }
                 freed_slots_lock = 0;
                 return FAILED_RSEQ;
@@ -120,13 +213,17 @@ struct obj_slab {
             }
 
             if (freed_slots[i] != vec::EMPTY) {
+                // unset all reclaimed slots except the lowest which we return.
+                // This is atomic because an optimistic free from this CPU
+                // (preempted before the lock) can still clear a bit in
+                // available_slots and a plain store would drop it.
                 const uint64_t reclaimed_slots = freed_slots[i];
-                available_slots[i] = reclaimed_slots & (reclaimed_slots - 1);
+                atomic_unset(available_slots + i,
+                             reclaimed_slots & (reclaimed_slots - 1));
                 atomic_xor(freed_slots + i, reclaimed_slots);
                 freed_slots_lock = 0;
-                return ((uint64_t)(
-                    &obj_arr[64 * i +
-                             bits::find_first_one<uint64_t>(reclaimed_slots)]));
+                return hand_out<zero>(
+                    64 * i + bits::find_first_one<uint64_t>(reclaimed_slots));
             }
 #endif
             freed_slots_lock = 0;
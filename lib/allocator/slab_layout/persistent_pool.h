@@ -0,0 +1,97 @@
+#ifndef _PERSISTENT_POOL_H_
+#define _PERSISTENT_POOL_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/mmap_helpers.h>
+#include <system/sys_info.h>
+
+#include "mapped_pool.h"
+
+//////////////////////////////////////////////////////////////////////
+// A slab manager whose region (bitmaps and objects) is a MAP_SHARED mapping
+// of a file, so a restarted process gets the pool back with every live
+// object in it instead of rebuilding it. manager_t is anything
+// mapped_pool.h takes.
+//
+// File layout is one header page followed by the manager's region. The
+// region is reattached only if the header matches (same version, object
+// size, region size and cpu count) and the last process to have it open
+// closed it cleanly. Anything else (new file, crash, different build or
+// host) starts from an empty pool, which is what a cache wants.
+//
+// The mapping can land at a different address every run so anything stored
+// in the pool has to refer to other objects by offset or manager handle,
+// see mapped_pool.h.
+//
+// Only one process at a time and the pool must not be in use by any thread
+// when it is destroyed.
+
+static constexpr const uint64_t PERSISTENT_POOL_MAGIC = 0x6c6f6f7062616c73UL;
+
+template<typename manager_t>
+struct persistent_pool : mapped_pool<manager_t> {
+    // 1 if the objects from the last run are still here
+    uint32_t reattached;
+
+    // version is the application's, bump it whenever what is stored in T
+    // changes meaning
+    template<typename... args_t>
+    persistent_pool(const char * const path,
+                    const uint64_t     version,
+                    args_t... args) {
+        this->map_size = this->pool_size(args...);
+
+        this->fd = open(path, O_RDWR | O_CREAT, 0644);
+        ERROR_ASSERT(this->fd >= 0, "open(%s) failed\n", path);
+
+        struct stat st;
+        ERROR_ASSERT(!fstat(this->fd, &st), "fstat(%s) failed\n", path);
+
+        // header state is 1 once the last process to open it closed it
+        reattached = 0;
+        if (((uint64_t)st.st_size) == this->map_size) {
+            this->hdr  = this->map();
+            reattached = this->header_matches(PERSISTENT_POOL_MAGIC, version) &&
+                         this->hdr->state;
+            if (!reattached) {
+                safe_munmap(this->hdr, this->map_size);
+            }
+        }
+        if (!reattached) {
+            // truncating first drops the old contents, the region has to
+            // start out all zero like a fresh mmap
+            ERROR_ASSERT(!ftruncate(this->fd, 0),
+                         "ftruncate(%s) failed\n",
+                         path);
+            ERROR_ASSERT(!ftruncate(this->fd, this->map_size),
+                         "ftruncate(%s) failed\n",
+                         path);
+            this->hdr = this->map();
+            this->init_header(PERSISTENT_POOL_MAGIC, version);
+        }
+
+        // a crash from here on leaves the pool marked unclean
+        this->hdr->state = 0;
+        ERROR_ASSERT(!msync(this->hdr, PAGE_SIZE, MS_SYNC), "msync failed\n");
+
+        this->init_manager(reattached, args...);
+    }
+
+    // the manager's destructor (in ~mapped_pool) unmaps the region so
+    // everything is written back (and only then marked clean) first
+    ~persistent_pool() {
+        ERROR_ASSERT(!msync(this->hdr, this->map_size, MS_SYNC),
+                     "msync failed\n");
+        this->hdr->state = 1;
+        ERROR_ASSERT(!msync(this->hdr, PAGE_SIZE, MS_SYNC), "msync failed\n");
+    }
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef _SHARED_POOL_H_
+#define _SHARED_POOL_H_
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/mmap_helpers.h>
+#include <system/sys_info.h>
+
+#include "mapped_pool.h"
+
+//////////////////////////////////////////////////////////////////////
+// A slab manager whose region lives in shared memory (shm_open or memfd)
+// mapped by several processes at once, so an object allocated in one
+// process can be handed to and freed by another without copying it.
+//
+// Nothing in a manager's region refers to process local memory: bitmaps are
+// indexed by cpu and every op is either an rseq sequence (which only cares
+// about the cpu, not which process the thread belongs to) or lock prefixed.
+// So the first process to get the region builds the manager in it and
+// everyone else attaches with the reattach_region constructor, see
+// slab_config.h. manager_t is anything mapped_pool.h takes.
+//
+// The region is mapped at a different address in every process so objects
+// are passed around as offsets or manager handles and turned back into a
+// T * by whoever receives them (see mapped_pool.h). roots[] in the header is
+// there for processes to find each other's data.
+//
+// All processes have to be built with the same T / manager_t / version and
+// run on the same host, attaching to a pool that doesn't match dies.
+//
+// An attacher waits for the creator to size the memory and build the
+// manager. If that hasn't happened within SHARED_POOL_ATTACH_TIMEOUT_MS the
+// creator is assumed to have died part way and the attacher dies too (the
+// shm name has to be unlinked by hand before it can be reused).
+
+#ifndef SHARED_POOL_ATTACH_TIMEOUT_MS
+#define SHARED_POOL_ATTACH_TIMEOUT_MS 10000
+#endif
+
+static constexpr const uint64_t SHARED_POOL_MAGIC = 0x6c6f6f7064726873UL;
+
+template<typename manager_t>
+struct shared_pool : mapped_pool<manager_t> {
+    // 1 if this process built the manager
+    uint32_t creator;
+    // shm name to unlink on destruction (creator by name only)
+    char unlink_name[NAME_MAX];
+
+    // shm_open(name). The first process to open it creates it, everyone
+    // after attaches. The creator unlinks the name when it is destroyed,
+    // processes that already have it mapped are unaffected
+    template<typename... args_t>
+    shared_pool(const char * const name,
+                const uint64_t     version,
+                args_t... args) {
+        unlink_name[0] = '\0';
+        this->fd       = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (this->fd >= 0) {
+            creator = 1;
+            strncpy(unlink_name, name, NAME_MAX - 1);
+            unlink_name[NAME_MAX - 1] = '\0';
+        }
+        else {
+            ERROR_ASSERT(errno == EEXIST, "shm_open(%s) failed\n", name);
+            this->fd = shm_open(name, O_RDWR, 0600);
+            ERROR_ASSERT(this->fd >= 0, "shm_open(%s) failed\n", name);
+            creator = 0;
+        }
+        setup(version, args...);
+    }
+
+    // an fd from create_memfd(), shared by fork or SCM_RIGHTS. Whoever
+    // created the memfd has to construct the first shared_pool on it before
+    // passing it on. The pool closes _fd when it is destroyed
+    template<typename... args_t>
+    shared_pool(const int32_t _fd, const uint64_t version, args_t... args) {
+        struct stat st;
+        ERROR_ASSERT(!fstat(_fd, &st), "fstat failed\n");
+        this->fd       = _fd;
+        creator        = st.st_size == 0;
+        unlink_name[0] = '\0';
+        setup(version, args...);
+    }
+
+    static int32_t
+    create_memfd(const char * const name) {
+        const int32_t memfd = memfd_create(name, MFD_CLOEXEC);
+        ERROR_ASSERT(memfd >= 0, "memfd_create(%s) failed\n", name);
+        return memfd;
+    }
+
+    static uint64_t
+    now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t)ts.tv_sec) * 1000 + ((uint64_t)ts.tv_nsec) / 1000000;
+    }
+
+    static void
+    wait_for_creator(const uint64_t deadline) {
+        DIE_ASSERT(now_ms() < deadline,
+                   "Shared pool creator died while building pool\n");
+        sched_yield();
+    }
+
+    // header state is 1 once the creator has built the manager
+    template<typename... args_t>
+    void
+    setup(const uint64_t version, args_t... args) {
+        this->map_size = this->pool_size(args...);
+
+        if (creator) {
+            // new shm / memfd is all zero, same as a fresh mmap
+            ERROR_ASSERT(!ftruncate(this->fd, this->map_size),
+                         "ftruncate failed\n");
+            this->hdr = this->map();
+            this->init_header(SHARED_POOL_MAGIC, version);
+            this->init_manager(0, args...);
+            __atomic_store_n(&(this->hdr->state), 1, __ATOMIC_RELEASE);
+            return;
+        }
+
+        // the creator may not have sized it yet
+        const uint64_t deadline = now_ms() + SHARED_POOL_ATTACH_TIMEOUT_MS;
+        struct stat    st;
+        do {
+            ERROR_ASSERT(!fstat(this->fd, &st), "fstat failed\n");
+            if (((uint64_t)st.st_size) == this->map_size) {
+                break;
+            }
+            DIE_ASSERT(st.st_size == 0,
+                       "Shared pool is %lu bytes, expected %lu\n",
+                       (uint64_t)st.st_size,
+                       this->map_size);
+            wait_for_creator(deadline);
+        } while (1);
+
+        this->hdr = this->map();
+        while (!__atomic_load_n(&(this->hdr->state), __ATOMIC_ACQUIRE)) {
+            wait_for_creator(deadline);
+        }
+        DIE_ASSERT(this->header_matches(SHARED_POOL_MAGIC, version),
+                   "Shared pool was built for a different layout\n");
+        this->init_manager(1, args...);
+    }
+
+    // the memory itself goes away with the last mapping / fd. Processes
+    // that already have it mapped are unaffected by the unlink
+    ~shared_pool() {
+        if (unlink_name[0] != '\0') {
+            shm_unlink(unlink_name);
+        }
+    }
+};
+
+#endif
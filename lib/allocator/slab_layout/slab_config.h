@@ -1,13 +1,44 @@
 #ifndef _SLAB_CONFIG_
 #define _SLAB_CONFIG_
 
+#include <system/sys_info.h>
+
 #define SAFER_FREE
 //#define CONTINUE_RSEQ
 
+// PERCPU reclaim keeps a free vector for every cpu (8 uint64_t apart so
+// rseq_any_cpu_or can index them) inside the slab / region so the number of
+// cpus it supports is fixed when compiled. Managers using it refuse to start on
+// a host with more cpus than this
+#ifndef PERCPU_RECLAIM_MAX_CPUS
+#ifdef HAVE_CONST_SYS_INFO
+#define PERCPU_RECLAIM_MAX_CPUS NPROCS
+#else
+#define PERCPU_RECLAIM_MAX_CPUS 64
+#endif
+#endif
+
 enum reclaim_policy {
     PERCPU = 0,  // This will result in faster freeing but slower reclaiming
     SHARED = 1   // this will result in slower freeing but faster reclaiming
 };
 
+// which cpus share a slab. PER_CPU slabs are updated with rseq, anything wider
+// has to use lock prefixed ops (see common/slab_ops.h) but needs fewer slabs
+// and keeps memory freed on one SMT sibling / cpu in the LLC usable by the
+// others
+enum shard_granularity {
+    PER_CPU  = 0,
+    PER_CORE = 1,  // SMT siblings share
+    PER_LLC  = 2,
+    PER_NODE = 3
+};
+
+// passed to a manager's base constructor to take over a region that already
+// holds a manager of the same type (a reopened file, shared memory mapped by
+// another process) instead of initializing it. The region's contents,
+// including every live object, are used as they are
+struct reattach_region {};
+
 
 #endif
@@ -0,0 +1,147 @@
+#ifndef _SLAB_DEPOT_H_
+#define _SLAB_DEPOT_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <optimized/bits.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/internal_returns.h>
+#include <allocator/common/safe_atomics.h>
+#include <allocator/common/slab_ops.h>
+
+#include "obj_slab.h"
+
+//////////////////////////////////////////////////////////////////////
+// Global pool of obj_slabs shared by all shards of a fixed slab manager. A
+// shard whose own slab is full borrows one depot slab and allocates from it
+// until it is full, then hands it back to the depot (frees into it make it
+// useful to whoever borrows it next) and borrows another.
+//
+// A per cpu slab can't change owner safely (a thread preempted between
+// reading the owner and starting its rseq would commit to a slab now owned
+// by another cpu) so depot slabs always use locked_slab_ops and borrowed[] is
+// only a locality hint. Nothing here is touched unless the shard's own slab
+// returned FAILED_VEC_FULL.
+
+template<typename T, uint32_t nslabs, uint32_t nvec>
+struct slab_depot {
+    using slab_t = obj_slab<T, nvec, locked_slab_ops>;
+
+    static constexpr const uint32_t nwords   = (nslabs + 63) / 64;
+    static constexpr const uint32_t NONE     = 0;
+    static constexpr const uint32_t capacity = nslabs * 64 * nvec;
+
+    // set bit means the slab is in the depot (not borrowed)
+    uint64_t in_depot[nwords] ALIGN_ATTR(CACHE_LINE_SIZE);
+    slab_t   slabs[nslabs] ALIGN_ATTR(PAGE_SIZE);
+
+    // per shard, index + 1 of the depot slab it is using (NONE if none)
+    uint32_t borrowed[] ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    slab_depot() {
+        for (uint32_t i = 0; i < nslabs; ++i) {
+            in_depot[i / 64] |= ((1UL) << (i % 64));
+        }
+    }
+
+    static uint64_t
+    size(const uint32_t nshards) {
+        return sizeof(slab_depot) + nshards * sizeof(uint32_t);
+    }
+
+    // returns index + 1 of a slab taken out of the depot (NONE if empty).
+    // Search starts after start so a full slab that was just handed back isn't
+    // immediately taken again
+    uint32_t
+    take(const uint32_t start) {
+        // start is index + 1 so start % 64 masks off everything up to and
+        // including the slab at index start - 1. The last iteration wraps
+        // back around to the bits that were skipped
+        for (uint32_t i = 0; i <= nwords; ++i) {
+            const uint32_t w    = (start / 64 + i) % nwords;
+            const uint64_t mask = i == 0 ? ~((1UL << (start % 64)) - 1) : ~0UL;
+            uint64_t       v;
+            while ((v = __atomic_load_n(in_depot + w, __ATOMIC_RELAXED) &
+                        mask)) {
+                const uint64_t bit = v & (-v);
+                if (__atomic_fetch_and(in_depot + w, ~bit, __ATOMIC_RELAXED) &
+                    bit) {
+                    return 64 * w + bits::find_first_one<uint64_t>(bit) + 1;
+                }
+            }
+        }
+        return NONE;
+    }
+
+    void
+    give(const uint32_t idx) {
+        atomic_or(in_depot + ((idx - 1) / 64), ((1UL) << ((idx - 1) % 64)));
+    }
+
+    template<bool zero = false>
+    uint64_t
+    _allocate(const uint32_t shard) {
+        uint32_t cur = __atomic_load_n(borrowed + shard, __ATOMIC_RELAXED);
+        // every slab gets at most one try
+        for (uint32_t tries = 0; tries <= nslabs; ++tries) {
+            if (cur != NONE) {
+                uint64_t ret;
+                do {
+                    ret = slabs[cur - 1].template _allocate<zero>(0);
+                } while (BRANCH_UNLIKELY(ret == FAILED_RSEQ));
+                if (BRANCH_LIKELY(successful(ret))) {
+                    return ret;
+                }
+            }
+
+            const uint32_t next = take(cur);
+            if (next == NONE) {
+                return FAILED_VEC_FULL;
+            }
+            ALLOC_STAT_INCR(DEPOT_BORROWS);
+
+            uint32_t expected = cur;
+            if (__atomic_compare_exchange_n(borrowed + shard,
+                                            &expected,
+                                            next,
+                                            false,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                if (cur != NONE) {
+                    give(cur);
+                }
+                cur = next;
+            }
+            else {
+                // another cpu in the shard swapped first, use theirs
+                give(next);
+                cur = expected;
+            }
+        }
+        return FAILED_VEC_FULL;
+    }
+
+    template<typename func_t>
+    void
+    for_each_live(func_t && f) {
+        for (uint32_t i = 0; i < nslabs; ++i) {
+            slabs[i].for_each_live(f);
+        }
+    }
+
+    void
+    _free(T * const addr) {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)slabs));
+        const uint32_t idx =
+            (((uint64_t)addr) - ((uint64_t)slabs)) / sizeof(slab_t);
+        IMPOSSIBLE_VALUES(idx >= nslabs);
+
+        // locked ops so this is safe no matter who (if anyone) has it borrowed
+        slabs[idx]._optimistic_free(addr, 0);
+    }
+};
+
+#endif
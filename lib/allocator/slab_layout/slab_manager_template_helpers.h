@@ -20,29 +20,44 @@ get_N(uint32_t n) {
 }
 
 template<typename T,
+         typename ops_t,
          uint32_t nlevels,
          uint32_t level,
          uint32_t... per_level_nvec>
-struct type_helper;
+struct ops_type_helper;
 
 
-template<typename T, uint32_t nlevel, uint32_t... per_level_nvec>
-struct type_helper<T, nlevel, nlevel, per_level_nvec...> {
-    typedef obj_slab<T, get_N<per_level_nvec...>(nlevel)> type;
+template<typename T, typename ops_t, uint32_t nlevel, uint32_t... per_level_nvec>
+struct ops_type_helper<T, ops_t, nlevel, nlevel, per_level_nvec...> {
+    typedef obj_slab<T, get_N<per_level_nvec...>(nlevel), ops_t> type;
 };
 
 template<typename T,
+         typename ops_t,
          uint32_t nlevels,
          uint32_t level,
          uint32_t... per_level_nvec>
-struct type_helper {
-    typedef super_slab<
-        T,
-        get_N<per_level_nvec...>(level),
-        typename type_helper<T, nlevels, level + 1, per_level_nvec...>::type>
+struct ops_type_helper {
+    typedef super_slab<T,
+                       get_N<per_level_nvec...>(level),
+                       typename ops_type_helper<T,
+                                                ops_t,
+                                                nlevels,
+                                                level + 1,
+                                                per_level_nvec...>::type,
+                       reclaim_policy::SHARED,
+                       ops_t>
         type;
 };
 
+// slabs owned by a single cpu
+template<typename T,
+         uint32_t nlevels,
+         uint32_t level,
+         uint32_t... per_level_nvec>
+using type_helper =
+    ops_type_helper<T, rseq_slab_ops, nlevels, level, per_level_nvec...>;
+
 
 template<typename T1, typename T2>
 struct same_base_type : std::is_same<T1, T2> {};
@@ -14,6 +14,7 @@
 
 #include <allocator/common/internal_returns.h>
 #include <allocator/common/safe_atomics.h>
+#include <allocator/common/slab_ops.h>
 #include <allocator/common/vec_constants.h>
 
 #include "obj_slab.h"
@@ -23,10 +24,11 @@
 template<typename T,
          uint32_t nvec         = 7,
          typename inner_slab_t = obj_slab<T>,
-         reclaim_policy rp     = reclaim_policy::SHARED>
+         reclaim_policy rp     = reclaim_policy::SHARED,
+         typename ops_t        = rseq_slab_ops>
 struct super_slab {
     static constexpr const uint32_t nfree_vec =
-        rp == reclaim_policy::PERCPU ? 8 * NPROCS : nvec;
+        rp == reclaim_policy::PERCPU ? 8 * PERCPU_RECLAIM_MAX_CPUS : nvec;
 
     uint64_t available_slabs[nvec] ALIGN_ATTR(CACHE_LINE_SIZE);
 
@@ -43,6 +45,32 @@ struct super_slab {
 
     super_slab() = default;
 
+    static constexpr const uint32_t nslots = 64 * nvec * inner_slab_t::nslots;
+
+    uint32_t ALWAYS_INLINE
+    slot_of(const T * const addr) const {
+        const uint32_t pos_idx =
+            (((uint64_t)addr) - ((uint64_t)(&inner_slabs[0]))) /
+            sizeof(inner_slab_t);
+        return pos_idx * inner_slab_t::nslots +
+               inner_slabs[pos_idx].slot_of(addr);
+    }
+
+    ALWAYS_INLINE T *
+    at_slot(const uint32_t slot) {
+        return inner_slabs[slot / inner_slab_t::nslots].at_slot(
+            slot % inner_slab_t::nslots);
+    }
+
+    // see obj_slab::for_each_live
+    template<typename func_t>
+    void
+    for_each_live(func_t && f) {
+        for (uint32_t i = 0; i < 64 * nvec; ++i) {
+            inner_slabs[i].for_each_live(f);
+        }
+    }
+
 
     void
     _optimistic_free(T * const addr, const uint32_t start_cpu) {
@@ -56,9 +84,9 @@ struct super_slab {
         IMPOSSIBLE_VALUES(pos_idx >= nvec * 64);
 
         (inner_slabs + pos_idx)->_optimistic_free(addr, start_cpu);
-        if (BRANCH_UNLIKELY(rseq_and(available_slabs + (pos_idx / 64),
-                                     ~((1UL) << (pos_idx % 64)),
-                                     start_cpu))) {
+        if (BRANCH_UNLIKELY(ops_t::and_bits(available_slabs + (pos_idx / 64),
+                                            ~((1UL) << (pos_idx % 64)),
+                                            start_cpu))) {
 
             if constexpr (rp == reclaim_policy::SHARED) {
                 atomic_or(freed_slabs + (pos_idx / 64),
@@ -66,7 +94,8 @@ struct super_slab {
             }
             else {
                 while (BRANCH_UNLIKELY(
-                    rseq_any_cpu_or(freed_slabs, (1UL) << (pos_idx % 64))))
+                    rseq_any_cpu_or(freed_slabs + (pos_idx / 64),
+                                    (1UL) << (pos_idx % 64))))
                     ;
             }
         }
@@ -89,11 +118,13 @@ struct super_slab {
         }
         else {
             while (BRANCH_UNLIKELY(
-                rseq_any_cpu_or(freed_slabs, (1UL) << (pos_idx % 64))))
+                rseq_any_cpu_or(freed_slabs + (pos_idx / 64),
+                                (1UL) << (pos_idx % 64))))
                 ;
         }
     }
 
+    template<bool zero = false>
     uint64_t
     _allocate(const uint32_t start_cpu) {
         for (uint32_t i = 0; i < nvec; ++i) {
@@ -120,7 +151,8 @@ struct super_slab {
                     }
 
                     const uint64_t ret =
-                        (inner_slabs + 64 * i + idx)->_allocate(start_cpu);
+                        (inner_slabs + 64 * i + idx)
+                            ->template _allocate<zero>(start_cpu);
 
                     DBG_PRINT(
                         "RETURN RECEIVED\n\t"
@@ -149,9 +181,9 @@ struct super_slab {
                             "UNSETTING\n\t"
                             "avail_slabs      : 0x%016lx\n",
                             available_slabs[i]);
-                        if (or_if_unset(available_slabs + i,
-                                        ((1UL) << idx),
-                                        start_cpu)) {
+                        if (ops_t::or_if_unset(available_slabs + i,
+                                               ((1UL) << idx),
+                                               start_cpu)) {
                             DBG_PRINT("FAILED TO UNSET\n\n");
                             return FAILED_RSEQ;
                         }
@@ -165,7 +197,8 @@ struct super_slab {
                     DBG_PRINT("TRYING TO POP FREE\n");
 #ifdef SAFER_FREE
                     if (BRANCH_UNLIKELY(
-                            acquire_lock(&freed_slabs_lock, start_cpu))) {
+                            ops_t::acquire_lock(&freed_slabs_lock,
+                                                start_cpu))) {
                         return FAILED_RSEQ;
                     }
 
@@ -174,9 +207,10 @@ struct super_slab {
                     // availabe_slabs and acquiring the lock
                     if (freed_slabs[i] != vec::EMPTY) {
                         const uint64_t reclaimed_slabs =
-                            try_reclaim_all_free_slabs(available_slabs + i,
-                                                       freed_slabs + i,
-                                                       start_cpu);
+                            ops_t::try_reclaim_all_free_slabs(
+                                available_slabs + i,
+                                freed_slabs + i,
+                                start_cpu);
                         if (BRANCH_LIKELY(reclaimed_slabs)) {
                             atomic_xor(freed_slabs + i, reclaimed_slabs);
                             freed_slabs_lock = 0;
@@ -199,8 +233,10 @@ struct super_slab {
                     }
 
                     if (freed_slabs[i] != vec::EMPTY) {
+                        // unset (not xor) as an optimistic free may have
+                        // already cleared some of these
                         const uint64_t reclaimed_slabs = freed_slabs[i];
-                        available_slabs[i]             = reclaimed_slabs;
+                        atomic_unset(available_slabs + i, reclaimed_slabs);
                         atomic_xor(freed_slabs + i, reclaimed_slabs);
                     }
 #endif
@@ -209,9 +245,10 @@ struct super_slab {
 #ifndef SAFER_FREE
                     if (freed_slabs[i] != vec::EMPTY) {
                         const uint64_t reclaimed_slabs =
-                            try_reclaim_all_free_slabs(available_slabs + i,
-                                                       freed_slabs + i,
-                                                       start_cpu);
+                            ops_t::try_reclaim_all_free_slabs(
+                                available_slabs + i,
+                                freed_slabs + i,
+                                start_cpu);
                         if (BRANCH_LIKELY(reclaimed_slabs)) {
                             atomic_xor(freed_slabs + i, reclaimed_slabs);
                             continue;
@@ -224,16 +261,18 @@ struct super_slab {
                 else {
 #ifdef SAFER_FREE
                     if (BRANCH_UNLIKELY(
-                            acquire_lock(&freed_slabs_lock, start_cpu))) {
+                            ops_t::acquire_lock(&freed_slabs_lock,
+                                                start_cpu))) {
                         return FAILED_RSEQ;
                     }
 #ifdef CONTINUE_RSEQ
-                    for (uint32_t _i = 0; _i < 8 * NPROCS; _i += 8) {
+                    for (uint32_t _i = 0; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
                         if (freed_slabs[_i + i] != vec::EMPTY) {
                             const uint64_t reclaimed_slabs =
-                                try_reclaim_all_free_slabs(available_slabs + i,
-                                                           freed_slabs + _i + i,
-                                                           start_cpu);
+                                ops_t::try_reclaim_all_free_slabs(
+                                    available_slabs + i,
+                                    freed_slabs + _i + i,
+                                    start_cpu);
                             if (BRANCH_LIKELY(reclaimed_slabs)) {
                                 atomic_xor(freed_slabs + _i + i,
                                            reclaimed_slabs);
@@ -258,14 +297,14 @@ struct super_slab {
 
                     // I think since we don't need to worry about being
                     // preempted its best to get them all
-                    for (uint32_t _i = 8; _i < 8 * NPROCS; _i += 8) {
+                    for (uint32_t _i = 8; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
                         const uint64_t _reclaimed_slabs = freed_slabs[_i + i];
                         if (_reclaimed_slabs) {
                             atomic_xor(freed_slabs + _i + i, _reclaimed_slabs);
                             reclaimed_slabs |= _reclaimed_slabs;
                         }
                     }
-                    available_slabs[i] = reclaimed_slabs;
+                    atomic_unset(available_slabs + i, reclaimed_slabs);
 
 #endif
                     freed_slabs_lock = 0;
@@ -273,12 +312,13 @@ struct super_slab {
 #ifndef SAFER_FREE
                     // this a very expensive loop due to the fact that all
                     // other freed_slabs are "owned" by other CPUS
-                    for (uint32_t _i = 0; _i < 8 * NPROCS; _i += 8) {
+                    for (uint32_t _i = 0; _i < 8 * PERCPU_RECLAIM_MAX_CPUS; _i += 8) {
                         if (freed_slabs[_i + i] != vec::EMPTY) {
                             const uint64_t reclaimed_slabs =
-                                try_reclaim_all_free_slabs(available_slabs + i,
-                                                           freed_slabs + _i + i,
-                                                           start_cpu);
+                                ops_t::try_reclaim_all_free_slabs(
+                                    available_slabs + i,
+                                    freed_slabs + _i + i,
+                                    start_cpu);
                             if (BRANCH_LIKELY(reclaimed_slabs)) {
                                 atomic_xor(freed_slabs + _i + i,
                                            reclaimed_slabs);
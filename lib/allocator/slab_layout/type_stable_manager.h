@@ -0,0 +1,104 @@
+#ifndef _TYPE_STABLE_MANAGER_H_
+#define _TYPE_STABLE_MANAGER_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+
+#include <allocator/slab_layout/TUNED_SLAB_CONFIG.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+//////////////////////////////////////////////////////////////////////
+// Type stable memory (Greenwald / Cheriton): once a slot has held a T it
+// holds a T forever, freed or not. Optimistic readers (seqlocks, version
+// validated reads) can dereference a node that may have been freed and
+// reallocated concurrently without hazard pointers or epochs, as long as
+// they validate what they read before acting on it.
+//
+// The slab managers already keep all their state in bitmaps so freeing
+// never writes into the object. What this adds:
+//     - the backing manager is never destroyed, so its region is never
+//       unmapped (it is leaked on purpose when the type_stable_manager
+//       goes away)
+//     - no reset(), the region can't be cleared or handed to anything else
+//     - T has to be trivially destructible (destructors are never run) and
+//       trivially copyable (readers may copy it mid-update)
+//     - in debug builds (no NDEBUG) _free() and stable() assert that the
+//       ptr is a slot of this manager, so a T * from anywhere else that
+//       would not stay a T is caught
+//
+// manager_t is any sharded_fixed_slab_manager (fixed / depot / sharded).
+
+template<typename T, typename manager_t = tuned_slab_manager<T>>
+struct type_stable_manager {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Type stable objects never have their destructor run");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Optimistic readers copy objects that may be mid update");
+
+    static constexpr const uint32_t capacity = manager_t::capacity;
+
+    using handle_t = typename manager_t::handle_t;
+    static constexpr const handle_t NULL_HANDLE = manager_t::NULL_HANDLE;
+
+    manager_t * const backing;
+
+    type_stable_manager() : backing(new manager_t()) {}
+
+    // backing is intentionally leaked, readers may still be looking at
+    // freed objects
+    ~type_stable_manager() = default;
+
+    // 1 if ptr is a slot of this manager (and so is a T whether or not it
+    // has been freed)
+    uint32_t
+    owns(const T * const ptr) const {
+        return backing->is_slot(ptr);
+    }
+
+    // for optimistic readers, returns ptr after checking (debug builds only)
+    // that it will stay a T
+    ALWAYS_INLINE const T *
+    stable(const T * const ptr) const {
+        assert(ptr == NULL || owns(ptr));
+        return ptr;
+    }
+
+    T *
+    _allocate() {
+        return backing->_allocate();
+    }
+
+    void
+    _free(T * const ptr) {
+        assert(owns(ptr));
+        backing->_free(ptr);
+    }
+
+    // handles are stable too, to_ptr of a freed handle is still a T
+    handle_t
+    _allocate_handle() {
+        return backing->_allocate_handle();
+    }
+
+    void
+    _free_handle(const handle_t h) {
+        backing->_free_handle(h);
+    }
+
+    ALWAYS_INLINE T *
+    to_ptr(const handle_t h) const {
+        return backing->to_ptr(h);
+    }
+
+    handle_t ALWAYS_INLINE
+    to_handle(const T * const ptr) const {
+        assert(owns(ptr));
+        return backing->to_handle(ptr);
+    }
+};
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef _ALLOC_TRACE_H_
+#define _ALLOC_TRACE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <type_traits>
+#include <utility>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/rseq/rseq_base.h>
+
+//////////////////////////////////////////////////////////////////////
+// Allocation trace recorder. traced_manager wraps any slab manager and
+// logs (thread, cpu, op, object id, timestamp) for every alloc and free into
+// per-cpu ring files "<prefix>.cpu<N>.trace". Each file is a header followed
+// by a ring of fixed size records, mmapped MAP_SHARED so the trace survives a
+// crash and costs no syscalls to write. When a ring wraps the oldest records
+// are overwritten.
+//
+// Object id is the address returned by the manager. Allocs are stamped after
+// the allocation and frees before the free so for any object alloc < free and
+// an address is never reused before the record freeing it (this is what lets
+// the replayer in trace_replay.h run threads independently).
+
+namespace atrace {
+
+static constexpr const uint64_t TRACE_MAGIC   = 0x45434152544a424fUL;  // "OBJTRACE"
+static constexpr const uint32_t TRACE_VERSION = 1;
+
+static constexpr const uint32_t DEFAULT_RING_LOG = 20;
+
+enum op_type { ALLOC = 0, FREE = 1 };
+
+struct trace_record {
+    uint64_t timestamp_ns;
+    uint64_t obj_id;
+    uint32_t tid;
+    uint16_t cpu;
+    uint8_t  op;
+    uint8_t  pad;
+};
+static_assert(sizeof(trace_record) == 24);
+
+struct trace_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t obj_size;
+    uint64_t capacity;
+    uint64_t start_ns;
+    uint32_t cpu;
+    uint32_t pad;
+
+    // total records ever written. Ring position is head % capacity
+    uint64_t head ALIGN_ATTR(CACHE_LINE_SIZE);
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+uint64_t ALWAYS_INLINE
+now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000UL * 1000UL * 1000UL * ts.tv_sec + ts.tv_nsec;
+}
+
+__thread uint32_t cached_tid;
+
+uint32_t ALWAYS_INLINE
+get_tid() {
+    if (BRANCH_UNLIKELY(cached_tid == 0)) {
+        cached_tid = syscall(SYS_gettid);
+    }
+    return cached_tid;
+}
+
+void
+trace_path(char * const       buf,
+           const uint32_t     buf_len,
+           const char * const prefix,
+           const uint32_t     cpu) {
+    snprintf(buf, buf_len, "%s.cpu%u.trace", prefix, cpu);
+}
+
+uint64_t
+trace_file_size(const uint64_t capacity) {
+    return sizeof(trace_header) + capacity * sizeof(trace_record);
+}
+
+//////////////////////////////////////////////////////////////////////
+// writer side
+struct trace_writer {
+    trace_header ** rings;
+    uint64_t        capacity;
+    uint32_t        nprocs;
+
+    void
+    init(const char * const prefix,
+         const uint32_t     obj_size,
+         const uint32_t     ring_log = DEFAULT_RING_LOG) {
+        capacity              = (1UL) << ring_log;
+        const uint64_t length = trace_file_size(capacity);
+        const uint64_t start  = now_ns();
+
+        nprocs = sysi::runtime_nprocs();
+        rings  = (trace_header **)calloc(nprocs, sizeof(trace_header *));
+        ERROR_ASSERT(rings);
+
+        char path[256];
+        for (uint32_t i = 0; i < nprocs; ++i) {
+            trace_path(path, 256, prefix, i);
+            const int32_t fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            ERROR_ASSERT(fd >= 0, "Unable to open trace file: %s\n", path);
+            ERROR_ASSERT(!ftruncate(fd, length),
+                         "Unable to size trace file: %s\n",
+                         path);
+
+            rings[i] = (trace_header *)safe_mmap(NULL,
+                                                 length,
+                                                 (PROT_READ | PROT_WRITE),
+                                                 MAP_SHARED,
+                                                 fd,
+                                                 0);
+            close(fd);
+
+            rings[i]->version  = TRACE_VERSION;
+            rings[i]->obj_size = obj_size;
+            rings[i]->capacity = capacity;
+            rings[i]->start_ns = start;
+            rings[i]->cpu      = i;
+            rings[i]->head     = 0;
+
+            // magic last so a reader never sees a half initialized header
+            __atomic_store_n(&(rings[i]->magic), TRACE_MAGIC, __ATOMIC_RELEASE);
+        }
+    }
+
+    void
+    destroy() {
+        for (uint32_t i = 0; i < nprocs; ++i) {
+            msync(rings[i], trace_file_size(capacity), MS_ASYNC);
+            safe_munmap(rings[i], trace_file_size(capacity));
+        }
+        free(rings);
+    }
+
+    void ALWAYS_INLINE
+    record(const uint64_t obj_id, const uint8_t op) {
+        const uint64_t ts  = now_ns();
+        uint32_t       cpu = get_cur_cpu();
+
+        // unregistered threads (or anything odd) go to ring 0
+        if (BRANCH_UNLIKELY(cpu >= nprocs)) {
+            cpu = 0;
+        }
+        trace_header * const ring = rings[cpu];
+
+        // not rseq, a migration between reading cpu and here only costs a
+        // shared cache line
+        const uint64_t pos =
+            __atomic_fetch_add(&(ring->head), 1, __ATOMIC_RELAXED);
+        trace_record * const rec =
+            ((trace_record *)(ring + 1)) + (pos & (capacity - 1));
+
+        rec->timestamp_ns = ts;
+        rec->obj_id       = obj_id;
+        rec->tid          = get_tid();
+        rec->cpu          = cpu;
+        rec->op           = op;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////
+// reader side. Returns the records in one cpu file in ring order (oldest
+// first). Caller frees the returned array
+trace_record *
+read_trace_file(const char * const path,
+                uint64_t * const   nrecords,
+                uint32_t * const   obj_size) {
+    const int32_t fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *nrecords = 0;
+        return NULL;
+    }
+
+    struct stat st;
+    ERROR_ASSERT(!fstat(fd, &st));
+    DIE_ASSERT((uint64_t)st.st_size >= sizeof(trace_header),
+               "Trace file too small: %s\n",
+               path);
+
+    trace_header * const hdr = (trace_header *)safe_mmap(NULL,
+                                                         st.st_size,
+                                                         PROT_READ,
+                                                         MAP_SHARED,
+                                                         fd,
+                                                         0);
+    close(fd);
+    DIE_ASSERT(hdr->magic == TRACE_MAGIC && hdr->version == TRACE_VERSION,
+               "Bad trace header: %s\n",
+               path);
+    DIE_ASSERT((uint64_t)st.st_size >= trace_file_size(hdr->capacity),
+               "Truncated trace file: %s\n",
+               path);
+
+    const uint64_t head     = hdr->head;
+    const uint64_t capacity = hdr->capacity;
+    const uint64_t count    = head < capacity ? head : capacity;
+    const uint64_t first    = head < capacity ? 0 : (head & (capacity - 1));
+
+    trace_record * const records =
+        (trace_record *)calloc(count ? count : 1, sizeof(trace_record));
+    ERROR_ASSERT(records);
+
+    const trace_record * const ring = (const trace_record *)(hdr + 1);
+    memcpy(records, ring + first, (count - first) * sizeof(trace_record));
+    memcpy(records + (count - first), ring, first * sizeof(trace_record));
+
+    *nrecords = count;
+    *obj_size = hdr->obj_size;
+    safe_munmap(hdr, st.st_size);
+    return records;
+}
+
+}  // namespace atrace
+
+//////////////////////////////////////////////////////////////////////
+// opt-in wrapper, same interface as the manager it wraps
+template<typename manager_t>
+struct traced_manager {
+    using T = typename std::remove_pointer<decltype(
+        std::declval<manager_t &>()._allocate())>::type;
+
+    static constexpr const uint32_t capacity = manager_t::capacity;
+
+    manager_t            allocator;
+    atrace::trace_writer writer;
+
+    traced_manager(const char * const prefix,
+                   const uint32_t     ring_log = atrace::DEFAULT_RING_LOG)
+        : allocator() {
+        writer.init(prefix, sizeof(T), ring_log);
+    }
+
+    ~traced_manager() {
+        writer.destroy();
+    }
+
+    void
+    reset() {
+        allocator.reset();
+    }
+
+    T *
+    _allocate() {
+        T * const ret = allocator._allocate();
+        if (BRANCH_LIKELY(ret != NULL)) {
+            writer.record((uint64_t)ret, atrace::ALLOC);
+        }
+        return ret;
+    }
+
+    void
+    _free(T * addr) {
+        writer.record((uint64_t)addr, atrace::FREE);
+        allocator._free(addr);
+    }
+};
+
+#endif
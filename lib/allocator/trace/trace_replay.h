@@ -0,0 +1,266 @@
+#ifndef _TRACE_REPLAY_H_
+#define _TRACE_REPLAY_H_
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <type_traits>
+#include <utility>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/sys_info.h>
+
+#include <allocator/rseq/rseq_base.h>
+#include <allocator/trace/alloc_trace.h>
+
+//////////////////////////////////////////////////////////////////////
+// Replays a trace written by traced_manager (see alloc_trace.h) against any
+// allocator_t with the slab manager interface. Each traced thread gets its
+// own replay thread. Object ids are resolved to dense slots up front so a
+// free on one thread of an object allocated on another just waits for that
+// slot to be filled. Alloc timestamps always precede the free of the same
+// object so this can't deadlock.
+//
+// With timing the original inter-op delays (relative to the first record) are
+// preserved, otherwise everything runs at full speed.
+
+// sentinel for slots whose allocation failed during replay
+static constexpr const uint64_t FAILED_SLOT = 0x1;
+
+struct replay_op {
+    uint64_t offset_ns;
+    uint32_t slot;
+    uint32_t op;
+};
+
+struct replay_thread {
+    std::vector<replay_op> ops;
+    uint64_t               nfailed;
+    uint64_t               start_ns;
+    uint64_t               end_ns;
+} ALIGN_ATTR(CACHE_LINE_SIZE);
+
+struct replay_trace {
+    std::vector<replay_thread> threads;
+    uint64_t                   nslots;
+    uint64_t                   nops;
+    uint64_t                   nskipped;
+    uint32_t                   obj_size;
+
+    void
+    load(const char * const prefix) {
+        std::vector<atrace::trace_record> records;
+        obj_size = 0;
+
+        // the writer creates a file for every cpu on the traced host (which
+        // need not match this one) so read until one is missing
+        char path[256];
+        for (uint32_t i = 0;; ++i) {
+            atrace::trace_path(path, 256, prefix, i);
+            uint64_t                     n;
+            uint32_t                     _obj_size;
+            atrace::trace_record * const r =
+                atrace::read_trace_file(path, &n, &_obj_size);
+            if (r == NULL) {
+                break;
+            }
+            records.insert(records.end(), r, r + n);
+            obj_size = _obj_size;
+            free(r);
+        }
+        DIE_ASSERT(records.size(), "No records found for prefix: %s\n", prefix);
+
+        std::stable_sort(
+            records.begin(),
+            records.end(),
+            [](const atrace::trace_record & a, const atrace::trace_record & b) {
+                return a.timestamp_ns < b.timestamp_ns;
+            });
+
+        const uint64_t start_ns = records[0].timestamp_ns;
+
+        std::unordered_map<uint32_t, uint32_t> tid_to_thread;
+        std::unordered_map<uint64_t, uint32_t> live_ids;
+        nslots   = 0;
+        nops     = 0;
+        nskipped = 0;
+        for (const atrace::trace_record & r : records) {
+            replay_op op;
+            op.offset_ns = r.timestamp_ns - start_ns;
+            op.op        = r.op;
+            if (r.op == atrace::ALLOC) {
+                op.slot           = nslots++;
+                live_ids[r.obj_id] = op.slot;
+            }
+            else {
+                auto it = live_ids.find(r.obj_id);
+                if (it == live_ids.end()) {
+                    // the alloc was overwritten when the ring wrapped
+                    ++nskipped;
+                    continue;
+                }
+                op.slot = it->second;
+                live_ids.erase(it);
+            }
+
+            auto t_it = tid_to_thread.find(r.tid);
+            if (t_it == tid_to_thread.end()) {
+                t_it = tid_to_thread.emplace(r.tid, threads.size()).first;
+                threads.emplace_back();
+            }
+            threads[t_it->second].ops.push_back(op);
+            ++nops;
+        }
+    }
+};
+
+// what a single replay measured
+struct replay_result {
+    uint32_t nthreads;
+    uint64_t nops;
+    uint64_t ns;
+    uint64_t nfailed;
+
+    double
+    mops() const {
+        return ((double)nops * 1000.0) / ((double)ns);
+    }
+
+    double
+    ns_per_op() const {
+        return ((double)ns * nthreads) / ((double)nops);
+    }
+};
+
+template<typename allocator_t>
+struct replayer;
+
+template<typename allocator_t>
+struct replay_arg {
+    replayer<allocator_t> * rp;
+    uint32_t                tid;
+};
+
+template<typename allocator_t>
+struct replayer {
+    using T = typename std::remove_pointer<decltype(
+        std::declval<allocator_t &>()._allocate())>::type;
+
+    allocator_t       allocator;
+    replay_trace *    trace;
+    uint64_t *        slots;
+    bool              timing;
+    pthread_barrier_t b;
+    uint64_t          replay_start_ns;
+
+    void
+    run_thread(const uint32_t tid) {
+        replay_thread * const rt = &(trace->threads[tid]);
+        pthread_barrier_wait(&b);
+        rt->start_ns = atrace::now_ns();
+
+        for (const replay_op & op : rt->ops) {
+            if (timing) {
+                while (atrace::now_ns() - replay_start_ns < op.offset_ns) {
+                    sched_yield();
+                }
+            }
+            if (op.op == atrace::ALLOC) {
+                T * const p = allocator._allocate();
+                if (BRANCH_UNLIKELY(p == NULL)) {
+                    ++rt->nfailed;
+                    __atomic_store_n(slots + op.slot,
+                                     FAILED_SLOT,
+                                     __ATOMIC_RELEASE);
+                }
+                else {
+                    // touch it so replay sees the same cache behavior as a
+                    // real user of the memory
+                    *((volatile uint8_t *)p) = 0;
+                    __atomic_store_n(slots + op.slot,
+                                     (uint64_t)p,
+                                     __ATOMIC_RELEASE);
+                }
+            }
+            else {
+                uint64_t p;
+                while ((p = __atomic_load_n(slots + op.slot,
+                                            __ATOMIC_ACQUIRE)) == 0) {
+                    sched_yield();
+                }
+                if (BRANCH_LIKELY(p != FAILED_SLOT)) {
+                    allocator._free((T *)p);
+                }
+            }
+        }
+        rt->end_ns = atrace::now_ns();
+    }
+
+    static void *
+    run_thread_wrapper(void * targ) {
+        init_thread();
+        replay_arg<allocator_t> * const arg = (replay_arg<allocator_t> *)targ;
+        arg->rp->run_thread(arg->tid);
+        return NULL;
+    }
+
+    replay_result
+    run(replay_trace * const _trace, const bool _timing) {
+        trace  = _trace;
+        timing = _timing;
+
+        const uint32_t nthreads = trace->threads.size();
+        slots = (uint64_t *)calloc(trace->nslots ? trace->nslots : 1,
+                                   sizeof(uint64_t));
+        replay_arg<allocator_t> * targs = (replay_arg<allocator_t> *)calloc(
+            nthreads,
+            sizeof(replay_arg<allocator_t>));
+        pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+        ERROR_ASSERT(slots && targs && tids);
+
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            trace->threads[i].nfailed = 0;
+        }
+
+        ERROR_ASSERT(!pthread_barrier_init(&b, NULL, nthreads));
+        replay_start_ns = atrace::now_ns();
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            targs[i].rp  = this;
+            targs[i].tid = i;
+            ERROR_ASSERT(!pthread_create(tids + i,
+                                         NULL,
+                                         &replayer<allocator_t>::run_thread_wrapper,
+                                         (void *)(targs + i)));
+        }
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        pthread_barrier_destroy(&b);
+
+        uint64_t start = ~(0UL), end = 0, nfailed = 0;
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            start = cmath::min<uint64_t>(start, trace->threads[i].start_ns);
+            end   = cmath::max<uint64_t>(end, trace->threads[i].end_ns);
+            nfailed += trace->threads[i].nfailed;
+        }
+        replay_result res;
+        res.nthreads = nthreads;
+        res.nops     = trace->nops;
+        res.ns       = end > start ? end - start : 1;
+        res.nfailed  = nfailed;
+
+        free(tids);
+        free(targs);
+        free(slots);
+        return res;
+    }
+};
+
+#endif
@@ -15,105 +15,87 @@
 
 #include "const_obj_vec_helpers.h"
 
+//////////////////////////////////////////////////////////////////////
+// Same hierarchy as super_slab -> obj_slab but every level's bit vectors
+// are packed into one array (and all objects into another). At level n a set
+// bit in alloc_vecs means the object (n == levels) or the entire subtree
+// below it (n < levels) is taken. free_vecs has the same shape and collects
+// remote frees which are reclaimed (under freed_lock) once the alloc vec they
+// correspond to is full.
+
 template<typename T, uint32_t levels, uint32_t... per_level_nvec>
 struct obj_vec {
     template<uint32_t n>
     using const_vals = detail::cvals<T, n, per_level_nvec...>;
 
+    static constexpr const uint32_t nobjs =
+        64 * const_vals<levels>::calculate_alloc_arr_size;
+    static constexpr const uint32_t nvecs =
+        _total_alloc_arr_size<per_level_nvec...>(levels + 1);
+
+    // number of objects covered by a single bit at level n
+    template<uint32_t n>
+    static constexpr const uint32_t objs_per_bit =
+        const_vals<levels>::calculate_alloc_arr_size /
+        const_vals<n>::calculate_alloc_arr_size;
+
     template<uint32_t n>
-    ALWAYS_INLINE CONST_ATTR uint64_t *
-                  get_alloc_vec(const uint32_t v_idx) const {
+    ALWAYS_INLINE uint64_t *
+    get_alloc_vec(const uint32_t v_idx) {
         return alloc_vecs + const_vals<n>::total_alloc_arr_size + v_idx;
     }
 
     template<uint32_t n>
-    ALWAYS_INLINE CONST_ATTR uint64_t *
-                  get_free_vec(const uint32_t v_idx) const {
-
+    ALWAYS_INLINE uint64_t *
+    get_free_vec(const uint32_t v_idx) {
         return free_vecs + const_vals<n>::total_free_arr_size + v_idx;
     }
 
-    uint64_t
-        alloc_vecs[const_vals<levels + 1>::total_alloc_arr_size] ALIGN_ATTR(
-            CACHE_LINE_SIZE);
-    uint64_t free_vecs[const_vals<levels + 1>::total_free_arr_size] ALIGN_ATTR(
-        CACHE_LINE_SIZE);
-    T obj[const_vals<levels + 1>::total_alloc_arr_size] ALIGN_ATTR(
-        CACHE_LINE_SIZE);
+    uint64_t alloc_vecs[nvecs] ALIGN_ATTR(CACHE_LINE_SIZE);
 
+    // see obj_slab.h for why this lock is necessary
+    uint64_t freed_lock ALIGN_ATTR(CACHE_LINE_SIZE);
 
-    obj_vec() = default;
+    uint64_t free_vecs[nvecs] ALIGN_ATTR(CACHE_LINE_SIZE);
+    T obj[nobjs] ALIGN_ATTR(CACHE_LINE_SIZE);
 
-    uint64_t
-    _allocate_final(const uint32_t vec_idx, const uint32_t start_cpu) {
-
-        for (uint32_t i = 0; i < const_vals<levels>::get_nvecs; ++i) {
-            if (BRANCH_LIKELY(get_alloc_vec<levels>(vec_idx + i)[0] !=
-                              vec::FULL)) {
-                const uint32_t idx = bits::find_first_zero<uint64_t>(
-                    get_alloc_vec<levels>(vec_idx + i)[0]);
-                if (BRANCH_UNLIKELY(
-                        or_if_unset(get_alloc_vec<levels>(vec_idx + i),
-                                    ((1UL) << idx),
-                                    start_cpu))) {
-                    return FAILED_RSEQ;
-                }
-                return (uint64_t)(&obj[vec_idx + 64 * i + idx]);
-            }
-            else if (get_free_vec<levels>(vec_idx + i)[0] != vec::EMPTY) {
-                const uint64_t reclaimed_slots =
-                    try_reclaim_free_slots(get_alloc_vec<levels>(vec_idx + i),
-                                           get_free_vec<levels>(vec_idx + i),
-                                           start_cpu);
-                if (reclaimed_slots) {
-                    atomic_xor(get_free_vec<levels>(vec_idx + i),
-                               reclaimed_slots);
-                    return (uint64_t)(
-                        &obj[vec_idx + 64 * i +
-                             bits::find_first_zero<uint64_t>(reclaimed_slots)]);
-                }
-            }
-        }
-        return FAILED_VEC_FULL;
-    }
+
+    obj_vec() = default;
 
     template<uint32_t n>
     uint64_t
     _allocate_inner(const uint32_t vec_idx, const uint32_t start_cpu) {
         for (uint32_t i = 0; i < const_vals<n>::get_nvecs; ++i) {
+            uint64_t * const alloc_vec = get_alloc_vec<n>(vec_idx + i);
+            uint64_t * const free_vec  = get_free_vec<n>(vec_idx + i);
             while (1) {
-                while (BRANCH_LIKELY(get_alloc_vec<n>(vec_idx + i)[0] !=
-                                     vec::FULL)) {
-                    const uint32_t idx = bits::find_first_zero<uint64_t>(
-                        get_alloc_vec<n>(vec_idx + i)[0]);
-                    if constexpr (n == levels - 1) {
-                        const uint64_t ret = _allocate_final(
-                            _get_nvecs<per_level_nvec...>(levels) *
-                                (64 * (vec_idx + i) + idx),
-                            start_cpu);
-                        if (BRANCH_LIKELY(successful(ret))) {
-                            return ret;
-                        }
-                        else if (failed_full(ret)) {
-                            if (or_if_unset(get_alloc_vec<n>(vec_idx + i),
-                                            ((1UL) << idx),
-                                            start_cpu)) {
-                                return FAILED_RSEQ;
-                            }
-                            continue;
-                        }
+                while (BRANCH_LIKELY(alloc_vec[0] != vec::FULL)) {
+                    const uint32_t idx =
+                        bits::find_first_zero<uint64_t>(alloc_vec[0]);
+
+                    // we were preempted between while statement and ffz
+                    if (BRANCH_UNLIKELY(idx == 64)) {
                         return FAILED_RSEQ;
                     }
+
+                    if constexpr (n == levels) {
+                        if (BRANCH_UNLIKELY(or_if_unset(alloc_vec,
+                                                        ((1UL) << idx),
+                                                        start_cpu))) {
+                            return FAILED_RSEQ;
+                        }
+                        return (uint64_t)(&obj[64 * (vec_idx + i) + idx]);
+                    }
                     else {
                         const uint64_t ret = _allocate_inner<n + 1>(
-                            _get_nvecs<per_level_nvec...>(n + 1) *
-                                (64 * (i + vec_idx) + idx),
+                            const_vals<n + 1>::get_nvecs *
+                                (64 * (vec_idx + i) + idx),
                             start_cpu);
                         if (BRANCH_LIKELY(successful(ret))) {
                             return ret;
                         }
                         else if (failed_full(ret)) {
-                            if (or_if_unset(get_alloc_vec<n>(vec_idx + i),
+                            if (or_if_unset(alloc_vec,
                                             ((1UL) << idx),
                                             start_cpu)) {
                                 return FAILED_RSEQ;
@@ -123,18 +105,38 @@ struct obj_vec {
                         return FAILED_RSEQ;
                     }
                 }
-                if (get_free_vec<n>(vec_idx + i)[0] != vec::EMPTY) {
-                    const uint64_t reclaimed_slabs = try_reclaim_all_free_slabs(
-                        get_alloc_vec<n>(vec_idx + i),
-                        get_free_vec<n>(vec_idx + i),
-                        start_cpu);
-                    if (BRANCH_LIKELY(reclaimed_slabs)) {
-                        atomic_xor(get_free_vec<n>(vec_idx + i),
-                                   reclaimed_slabs);
+
+                if (BRANCH_UNLIKELY(acquire_lock(&freed_lock, start_cpu))) {
+                    return FAILED_RSEQ;
+                }
+                if (BRANCH_UNLIKELY(alloc_vec[0] != vec::FULL)) {
+                    freed_lock = 0;
+                    return FAILED_RSEQ;
+                }
+
+                if (free_vec[0] != vec::EMPTY) {
+                    const uint64_t reclaimed = free_vec[0];
+                    if constexpr (n == levels) {
+                        // keep the lowest reclaimed slot set, that is the one
+                        // we return
+                        atomic_unset(alloc_vec, reclaimed & (reclaimed - 1));
+                        atomic_xor(free_vec, reclaimed);
+                        freed_lock = 0;
+                        return (uint64_t)(
+                            &obj[64 * (vec_idx + i) +
+                                 bits::find_first_one<uint64_t>(reclaimed)]);
+                    }
+                    else {
+                        // unset (not xor) as an optimistic free may have
+                        // already cleared some of these
+                        atomic_unset(alloc_vec, reclaimed);
+                        atomic_xor(free_vec, reclaimed);
+                        freed_lock = 0;
                         continue;
                     }
-                    return FAILED_RSEQ;
                 }
+                freed_lock = 0;
+
                 // continues will reset, if we ever faill through to here we
                 // want to stop
                 break;
@@ -145,59 +147,63 @@ struct obj_vec {
 
     uint64_t
     _allocate(const uint32_t start_cpu) {
-        if constexpr (levels) {
-            return _allocate_inner<0>(0, start_cpu);
-        }
-        else {
-            return _allocate_final(0, start_cpu);
-        }
+        return _allocate_inner<0>(0, start_cpu);
     }
 
 
+    // frees go bottom up so that by the time a subtree is marked non-full
+    // the object is actually available
     template<uint32_t n>
     void
-    _free(const uint64_t addr_dif) {
-        const uint64_t pos_idx = addr_dif / const_vals<n>::region_size;
-
-        // this enables compiler to optimize out the math if
-        // const_vals<n>::get_nvecs == 1
-        IMPOSSIBLE_VALUES(pos_idx >= 64 * const_vals<n>::get_nvecs);
-        if constexpr (n < levels) {
-            _free<n + 1>(addr_dif);
+    _free_level(const uint32_t pos_idx) {
+        const uint32_t bit_idx = pos_idx / objs_per_bit<n>;
+        atomic_or(get_free_vec<n>(bit_idx / 64), (1UL) << (bit_idx % 64));
+        if constexpr (n) {
+            _free_level<n - 1>(pos_idx);
         }
-        atomic_or(get_free_vec<n>(pos_idx / 64),
-                  (1UL) << (pos_idx % 64));
     }
 
-    void
-    _free(T * const addr) {
-        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(&obj[0])));
-        _free<0>((uint64_t)addr - ((uint64_t)&obj[0]));
-    }
-
-
     template<uint32_t n>
     void
-    _optimistic_free(const uint64_t addr_dif, const uint32_t start_cpu) {
-        if constexpr (n < levels) {
-            _free<n + 1>(addr_dif);
+    _optimistic_free_level(const uint32_t pos_idx, const uint32_t start_cpu) {
+        const uint32_t bit_idx = pos_idx / objs_per_bit<n>;
+        uint32_t       failed;
+        if constexpr (n == levels) {
+            failed = rseq_xor(get_alloc_vec<n>(bit_idx / 64),
+                              (1UL) << (bit_idx % 64),
+                              start_cpu);
+        }
+        else {
+            failed = rseq_and(get_alloc_vec<n>(bit_idx / 64),
+                              ~((1UL) << (bit_idx % 64)),
+                              start_cpu);
         }
-        if (BRANCH_UNLIKELY(rseq_xor(
-                get_alloc_vec<n>(addr_dif /
-                                 _region_size<T, per_level_nvec...>(n)),
-                (1UL) << (addr_dif % _region_size<T, per_level_nvec...>(n)),
-                start_cpu))) {
-            atomic_or(
-                get_free_vec<n>(addr_dif /
-                                _region_size<T, per_level_nvec...>(n)),
-                (1UL) << (addr_dif % _region_size<T, per_level_nvec...>(n)));
+        if (BRANCH_UNLIKELY(failed)) {
+            atomic_or(get_free_vec<n>(bit_idx / 64), (1UL) << (bit_idx % 64));
         }
+        if constexpr (n) {
+            _optimistic_free_level<n - 1>(pos_idx, start_cpu);
+        }
+    }
+
+    void
+    _free(T * const addr) {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(&obj[0])));
+        const uint32_t pos_idx =
+            (((uint64_t)addr) - ((uint64_t)(&obj[0]))) / sizeof(T);
+        IMPOSSIBLE_VALUES(pos_idx >= nobjs);
+
+        _free_level<levels>(pos_idx);
     }
 
     void
-    _optimistic_free(T * const addr) {
+    _optimistic_free(T * const addr, const uint32_t start_cpu) {
         IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(&obj[0])));
-        _optimistic_free<0>((uint64_t)addr - ((uint64_t)&obj[0]));
+        const uint32_t pos_idx =
+            (((uint64_t)addr) - ((uint64_t)(&obj[0]))) / sizeof(T);
+        IMPOSSIBLE_VALUES(pos_idx >= nobjs);
+
+        _optimistic_free_level<levels>(pos_idx, start_cpu);
     }
 };
 
@@ -0,0 +1,113 @@
+#ifndef _VEC_MANAGER_H_
+#define _VEC_MANAGER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <new>
+
+#include <misc/cpp_attributes.h>
+#include <system/mmap_helpers.h>
+#include <system/runtime_sys_info.h>
+#include <system/sys_info.h>
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/internal_returns.h>
+#include <allocator/rseq/rseq_base.h>
+
+#include <allocator/vec_layout/obj_vec.h>
+
+//////////////////////////////////////////////////////////////////////
+// obj_vec analogue of fixed_slab_manager. 1 obj_vec per processor (sized at
+// construction with sysi::runtime_nprocs()), region size set with template
+// parameters
+
+template<typename T, uint32_t levels, uint32_t... per_level_nvec>
+struct internal_fixed_vec_manager {
+    using vec_t = obj_vec<T, levels, per_level_nvec...>;
+
+    // only read on construction / destruction
+    uint32_t nprocs;
+    vec_t    obj_vecs[] ALIGN_ATTR(PAGE_SIZE);
+
+    internal_fixed_vec_manager(const uint32_t _nprocs) : nprocs(_nprocs) {}
+
+    static uint64_t
+    size(const uint32_t _nprocs) {
+        return sizeof(internal_fixed_vec_manager) + _nprocs * sizeof(vec_t);
+    }
+};
+
+template<typename T, uint32_t levels, uint32_t... per_level_nvec>
+struct fixed_vec_manager {
+    using internal_manager_t =
+        internal_fixed_vec_manager<T, levels, per_level_nvec...>;
+    using vec_t = typename internal_manager_t::vec_t;
+
+    static constexpr const uint32_t capacity = vec_t::nobjs;
+
+    internal_manager_t * m;
+
+    fixed_vec_manager()
+        : fixed_vec_manager(mmap_alloc_noreserve(
+              internal_manager_t::size(sysi::runtime_nprocs()))) {}
+
+    // base must be at least region_size() bytes
+    fixed_vec_manager(void * const base) {
+        m = (internal_manager_t *)base;
+        new ((void * const)base) internal_manager_t(sysi::runtime_nprocs());
+    }
+
+    ~fixed_vec_manager() {
+        safe_munmap(m, internal_manager_t::size(m->nprocs));
+    }
+
+    static uint64_t
+    region_size() {
+        return internal_manager_t::size(sysi::runtime_nprocs());
+    }
+
+    void
+    reset() {
+        const uint32_t nprocs = m->nprocs;
+        memset((void *)m, 0, internal_manager_t::size(nprocs));
+        m->nprocs = nprocs;
+    }
+
+    T *
+    _allocate() {
+        uint64_t ptr;
+        do {
+            const uint32_t start_cpu = get_start_cpu();
+            IMPOSSIBLE_VALUES(start_cpu >= m->nprocs);
+            ptr = m->obj_vecs[start_cpu]._allocate(start_cpu);
+            if (BRANCH_UNLIKELY(ptr == FAILED_RSEQ)) {
+                ALLOC_STAT_INCR(RSEQ_ABORTS);
+            }
+        } while (BRANCH_UNLIKELY(ptr == FAILED_RSEQ));
+        ALLOC_STAT_INCR(ALLOCS);
+        if (BRANCH_UNLIKELY(ptr == FAILED_VEC_FULL)) {
+            ALLOC_STAT_INCR(FULL);
+        }
+        return (T *)(ptr & (~(0x1UL)));
+    }
+
+    void
+    _free(T * addr) {
+        IMPOSSIBLE_VALUES(((uint64_t)addr) < ((uint64_t)(m->obj_vecs)));
+        const uint32_t from_cpu =
+            (((uint64_t)addr) - ((uint64_t)(m->obj_vecs))) / sizeof(vec_t);
+
+        IMPOSSIBLE_VALUES(from_cpu >= m->nprocs);
+        ALLOC_STAT_INCR(FREES);
+        if (from_cpu == get_start_cpu()) {
+            m->obj_vecs[from_cpu]._optimistic_free(addr, from_cpu);
+        }
+        else {
+            ALLOC_STAT_INCR(REMOTE_FREES);
+            m->obj_vecs[from_cpu]._free(addr);
+        }
+    }
+};
+
+
+#endif
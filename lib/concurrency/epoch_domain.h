@@ -0,0 +1,194 @@
+#ifndef _EPOCH_DOMAIN_H_
+#define _EPOCH_DOMAIN_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/atomic_bit_vector.h>
+#include <system/sys_info.h>
+
+//////////////////////////////////////////////////////////////////////
+// Epoch based reclamation (Fraser). Threads reading a lock free structure do
+// so between enter() and exit() and memory unlinked from the structure is
+// retired (see allocator/reclaim/epoch_reclaimer.h) instead of freed.
+//
+// Each registered thread has a record with the global epoch it saw on
+// enter() and an active bit. The global epoch only moves from e to e + 1
+// once every active thread has seen e so anything retired at epoch x is
+// unreachable by every reader once the global epoch is >= x + 2.
+//
+// Threads register on their first enter() (slots come from an
+// atomic_bit_set) and unregister when they exit. Thread state is one
+// __thread so a thread can only be registered with one domain at a time.
+
+static constexpr const uint32_t EPOCH_MAX_THREADS = 1024;
+
+struct epoch_domain {
+    // (epoch << 1) | active, 0 if the thread is outside any critical section
+    struct epoch_record {
+        uint64_t local ALIGN_ATTR(CACHE_LINE_SIZE);
+    };
+
+    struct thread_state {
+        epoch_domain * domain;
+        uint32_t       slot;
+        uint32_t       nesting;
+    };
+    static __thread thread_state tstate;
+
+    uint64_t global_epoch ALIGN_ATTR(CACHE_LINE_SIZE);
+
+    // 1 + highest slot ever handed out, try_advance() scans this many
+    uint32_t nslots ALIGN_ATTR(CACHE_LINE_SIZE);
+    pthread_key_t exit_key;
+
+    vatm::atomic_bit_set<EPOCH_MAX_THREADS> slots;
+    epoch_record                            records[EPOCH_MAX_THREADS];
+
+    epoch_domain() : global_epoch(0), nslots(0) {
+        for (uint32_t i = 0; i < EPOCH_MAX_THREADS; ++i) {
+            records[i].local = 0;
+        }
+        ERROR_ASSERT(!pthread_key_create(&exit_key, thread_exit));
+    }
+
+    ~epoch_domain() {
+        if (tstate.domain == this) {
+            tstate.domain = NULL;
+        }
+        pthread_key_delete(exit_key);
+    }
+
+    static void
+    thread_exit(void * const arg) {
+        ((epoch_domain *)arg)->unregister_thread();
+    }
+
+    void
+    register_thread() {
+        DIE_ASSERT(tstate.domain == NULL || tstate.domain == this,
+                   "Thread already registered with another epoch domain\n");
+        if (tstate.domain == this) {
+            return;
+        }
+        const uint32_t slot = slots.set();
+        DIE_ASSERT(slot != slots.bit_scan_failure(),
+                   "More than %u threads in epoch domain\n",
+                   EPOCH_MAX_THREADS);
+
+        uint32_t n = __atomic_load_n(&nslots, __ATOMIC_RELAXED);
+        while (n <= slot && !__atomic_compare_exchange_n(&nslots,
+                                                         &n,
+                                                         slot + 1,
+                                                         false,
+                                                         __ATOMIC_RELEASE,
+                                                         __ATOMIC_RELAXED)) {
+        }
+        tstate.domain  = this;
+        tstate.slot    = slot;
+        tstate.nesting = 0;
+        ERROR_ASSERT(!pthread_setspecific(exit_key, (void *)this));
+    }
+
+    // must be outside any critical section
+    void
+    unregister_thread() {
+        if (tstate.domain != this) {
+            return;
+        }
+        IMPOSSIBLE_VALUES(tstate.nesting);
+        __atomic_store_n(&(records[tstate.slot].local), 0, __ATOMIC_RELEASE);
+        slots.unset(tstate.slot);
+        tstate.domain = NULL;
+        pthread_setspecific(exit_key, NULL);
+    }
+
+    uint64_t ALWAYS_INLINE
+    epoch() const {
+        return __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    }
+
+    uint32_t ALWAYS_INLINE
+    in_critical_section() const {
+        return tstate.domain == this && tstate.nesting;
+    }
+
+    // critical sections nest, only the outermost publishes
+    void ALWAYS_INLINE
+    enter() {
+        if (BRANCH_UNLIKELY(tstate.domain != this)) {
+            register_thread();
+        }
+        if (tstate.nesting++ == 0) {
+            __atomic_store_n(&(records[tstate.slot].local),
+                             (epoch() << 1) | 0x1,
+                             __ATOMIC_RELAXED);
+            // the record has to be visible before any load from the
+            // structure (pairs with the fence in try_advance)
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+    }
+
+    void ALWAYS_INLINE
+    exit() {
+        IMPOSSIBLE_VALUES(tstate.domain != this || tstate.nesting == 0);
+        if (--tstate.nesting == 0) {
+            __atomic_store_n(&(records[tstate.slot].local), 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    // moves the global epoch forward if every active thread has seen the
+    // current one. Returns the global epoch after the attempt
+    uint64_t
+    try_advance() {
+        uint64_t e = epoch();
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        const uint32_t n = __atomic_load_n(&nslots, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < n; ++i) {
+            const uint64_t local =
+                __atomic_load_n(&(records[i].local), __ATOMIC_ACQUIRE);
+            if ((local & 0x1) && (local >> 1) != e) {
+                return e;
+            }
+        }
+        if (__atomic_compare_exchange_n(&global_epoch,
+                                        &e,
+                                        e + 1,
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return e + 1;
+        }
+        // someone else advanced it
+        return e;
+    }
+
+    // waits until everything retired before this call is safe to free. Must
+    // be called outside a critical section
+    void
+    synchronize() {
+        const uint64_t target = epoch() + 2;
+        while (try_advance() < target) {
+            sched_yield();
+        }
+    }
+};
+
+__thread epoch_domain::thread_state epoch_domain::tstate;
+
+// critical section for the lifetime of the guard
+struct epoch_guard {
+    epoch_domain * const domain;
+
+    epoch_guard(epoch_domain * const _domain) : domain(_domain) {
+        domain->enter();
+    }
+    ~epoch_guard() {
+        domain->exit();
+    }
+};
+
+#endif
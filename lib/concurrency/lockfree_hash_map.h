@@ -0,0 +1,317 @@
+#ifndef _LOCKFREE_HASH_MAP_H_
+#define _LOCKFREE_HASH_MAP_H_
+
+#include <stdint.h>
+#include <functional>
+#include <type_traits>
+
+#include <concurrency/epoch_domain.h>
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <system/mmap_helpers.h>
+#include <system/sys_info.h>
+
+#include <allocator/reclaim/epoch_reclaimer.h>
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+
+//////////////////////////////////////////////////////////////////////
+// Lock free chained hash map. Each bucket is a lock free sorted list
+// (Michael, "High Performance Dynamic Lock-Free Hash Tables and List-Based
+// Sets"): nodes are ordered by (hash, key), erase() marks the low bit of the
+// node's next ptr and whoever cas's the node out of its predecessor retires
+// it. The number of buckets is fixed at construction.
+//
+// Nodes come from node_manager_t, by default a dynamic_slab_manager so an
+// insert allocates from the inserting cpu's regions and an erase on another
+// cpu goes through the manager's remote free path. Unlinked nodes are
+// retired to an epoch_reclaimer and every operation runs in an
+// epoch_domain critical section. Nodes unlinked during an operation are
+// only retired after its critical section ends so a thread that is
+// preempted in one never stops the retiring thread (see epoch_reclaimer.h).
+//
+// K and V must be trivially copyable (and K have == and <): nodes are raw
+// slab memory that insert() copies the key and value into, and the reclaimer
+// hands them back to the manager without running any destructor. Values are
+// set on insert and never updated in place.
+
+template<typename node_t>
+using default_hash_node_manager =
+    dynamic_slab_manager<node_t, 1, reclaim_policy::SHARED, 1, 8>;
+
+// std::hash is the identity for integers, mix it so sequential keys spread
+// over the buckets
+template<typename K>
+struct mixed_hash {
+    uint64_t ALWAYS_INLINE
+    operator()(const K & key) const {
+        uint64_t h = std::hash<K>{}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdUL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53UL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+template<typename K, typename V>
+struct hash_map_node {
+    // low bit set once the node is logically erased
+    uint64_t next;
+    uint64_t hash;
+    K        key;
+    V        val;
+};
+
+template<typename K,
+         typename V,
+         template<typename> typename node_manager_t = default_hash_node_manager,
+         typename hash_t = mixed_hash<K>>
+struct lockfree_hash_map {
+    using node_t      = hash_map_node<K, V>;
+    using manager_t   = node_manager_t<node_t>;
+    using reclaimer_t = epoch_reclaimer<node_t, manager_t>;
+
+    static_assert(std::is_trivially_copyable<K>::value &&
+                      std::is_trivially_copyable<V>::value,
+                  "Nodes are never constructed or destroyed, K and V must be "
+                  "trivially copyable");
+
+    static constexpr const uint64_t MARK_BIT = 0x1;
+
+    // nodes an operation can unlink before it has to leave its critical
+    // section to retire them
+    static constexpr const uint32_t max_unlinked = 8;
+
+    struct unlinked_nodes {
+        uint32_t n;
+        node_t * nodes[max_unlinked];
+    };
+
+    // search() results
+    enum { FOUND = 0, NOT_FOUND = 1, RESTART = 2 };
+
+    epoch_domain * domain;
+    manager_t      nodes;
+    reclaimer_t    reclaimer;
+    hash_t         hasher;
+    uint64_t       bucket_mask;
+    uint64_t *     buckets;
+
+    lockfree_hash_map(epoch_domain * const _domain, const uint32_t log_nbuckets)
+        : domain(_domain), nodes(), reclaimer(_domain, &nodes) {
+        bucket_mask = ((1UL) << log_nbuckets) - 1;
+        buckets     = (uint64_t *)mmap_alloc_noreserve(buckets_size());
+    }
+
+    // only safe once no other thread is using the map
+    ~lockfree_hash_map() {
+        reclaimer.drain();
+        for (uint64_t i = 0; i <= bucket_mask; ++i) {
+            for (node_t * n = (node_t *)buckets[i]; n != NULL;) {
+                node_t * const next = to_node(n->next);
+                nodes._free(n);
+                n = next;
+            }
+        }
+        safe_munmap(buckets, buckets_size());
+    }
+
+    uint64_t
+    buckets_size() const {
+        return cmath::roundup<uint64_t>((bucket_mask + 1) * sizeof(uint64_t),
+                                        PAGE_SIZE);
+    }
+
+    static ALWAYS_INLINE node_t *
+    to_node(const uint64_t next) {
+        return (node_t *)(next & (~MARK_BIT));
+    }
+
+    static uint32_t ALWAYS_INLINE
+    is_marked(const uint64_t next) {
+        return next & MARK_BIT;
+    }
+
+    // (hash, key) order of the bucket lists
+    static uint32_t ALWAYS_INLINE
+    before(const node_t * const n, const uint64_t h, const K & key) {
+        return n->hash < h || (n->hash == h && n->key < key);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // finds the first node >= (h, key) in the bucket. On return *prev_out is
+    // the unmarked link that pointed at it (*cur_out, may be NULL) when it was
+    // read. Marked nodes on the way are unlinked into ul, if ul fills up
+    // returns RESTART so the caller can retire them. Must be in a critical
+    // section
+    uint32_t
+    search(const uint64_t   h,
+           const K &        key,
+           uint64_t ** const prev_out,
+           node_t ** const   cur_out,
+           unlinked_nodes * const ul) {
+    retry:
+        uint64_t * prev = buckets + (h & bucket_mask);
+        node_t *   cur  = to_node(__atomic_load_n(prev, __ATOMIC_ACQUIRE));
+        while (cur != NULL) {
+            const uint64_t next = __atomic_load_n(&(cur->next), __ATOMIC_ACQUIRE);
+            if (BRANCH_UNLIKELY(is_marked(next))) {
+                if (ul->n == max_unlinked) {
+                    return RESTART;
+                }
+                uint64_t expected = (uint64_t)cur;
+                if (!__atomic_compare_exchange_n(prev,
+                                                 &expected,
+                                                 next & (~MARK_BIT),
+                                                 false,
+                                                 __ATOMIC_ACQ_REL,
+                                                 __ATOMIC_RELAXED)) {
+                    goto retry;
+                }
+                ul->nodes[ul->n++] = cur;
+                cur                = to_node(next);
+                continue;
+            }
+            if (!before(cur, h, key)) {
+                break;
+            }
+            prev = &(cur->next);
+            cur  = to_node(next);
+        }
+        *prev_out = prev;
+        *cur_out  = cur;
+        return (cur != NULL && cur->hash == h && cur->key == key) ? FOUND
+                                                                   : NOT_FOUND;
+    }
+
+    void
+    retire_unlinked(unlinked_nodes * const ul) {
+        for (uint32_t i = 0; i < ul->n; ++i) {
+            reclaimer.retire(ul->nodes[i]);
+        }
+        ul->n = 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // api
+
+    // copies the value for key into *val_out. Returns 1 if key was found
+    uint32_t
+    find(const K & key, V * const val_out) {
+        const uint64_t h = hasher(key);
+        unlinked_nodes ul;
+        uint64_t *     prev;
+        node_t *       cur;
+        uint32_t       ret;
+        ul.n = 0;
+        do {
+            {
+                epoch_guard g(domain);
+                ret = search(h, key, &prev, &cur, &ul);
+                if (ret == FOUND) {
+                    *val_out = cur->val;
+                }
+            }
+            retire_unlinked(&ul);
+        } while (BRANCH_UNLIKELY(ret == RESTART));
+        return ret == FOUND;
+    }
+
+    // Returns 1 if key was inserted, 0 if it was already in the map (or the
+    // node manager is out of memory)
+    uint32_t
+    insert(const K & key, const V & val) {
+        node_t * const n = nodes._allocate();
+        if (BRANCH_UNLIKELY(n == NULL)) {
+            return 0;
+        }
+        n->hash = hasher(key);
+        n->key  = key;
+        n->val  = val;
+
+        unlinked_nodes ul;
+        uint64_t *     prev;
+        node_t *       cur;
+        uint32_t       ret;
+        ul.n = 0;
+        do {
+            {
+                epoch_guard g(domain);
+                while ((ret = search(n->hash, key, &prev, &cur, &ul)) ==
+                       NOT_FOUND) {
+                    n->next           = (uint64_t)cur;
+                    uint64_t expected = (uint64_t)cur;
+                    if (__atomic_compare_exchange_n(prev,
+                                                    &expected,
+                                                    (uint64_t)n,
+                                                    false,
+                                                    __ATOMIC_RELEASE,
+                                                    __ATOMIC_RELAXED)) {
+                        break;
+                    }
+                }
+            }
+            retire_unlinked(&ul);
+        } while (BRANCH_UNLIKELY(ret == RESTART));
+
+        if (ret == FOUND) {
+            // never published
+            nodes._free(n);
+            return 0;
+        }
+        return 1;
+    }
+
+    // Returns 1 if key was in the map and this call erased it
+    uint32_t
+    erase(const K & key) {
+        const uint64_t h = hasher(key);
+        unlinked_nodes ul;
+        uint64_t *     prev;
+        node_t *       cur;
+        uint32_t       ret;
+        uint32_t       erased = 0;
+        ul.n                  = 0;
+        do {
+            {
+                epoch_guard g(domain);
+                while ((ret = search(h, key, &prev, &cur, &ul)) == FOUND) {
+                    uint64_t next =
+                        __atomic_load_n(&(cur->next), __ATOMIC_ACQUIRE);
+                    if (is_marked(next)) {
+                        // someone else erased it first, search will unlink
+                        continue;
+                    }
+                    if (!__atomic_compare_exchange_n(&(cur->next),
+                                                     &next,
+                                                     next | MARK_BIT,
+                                                     false,
+                                                     __ATOMIC_ACQ_REL,
+                                                     __ATOMIC_RELAXED)) {
+                        continue;
+                    }
+                    erased = 1;
+                    // try to unlink it ourselves, otherwise the next search
+                    // through this bucket will
+                    uint64_t expected = (uint64_t)cur;
+                    if (ul.n < max_unlinked &&
+                        __atomic_compare_exchange_n(prev,
+                                                    &expected,
+                                                    next,
+                                                    false,
+                                                    __ATOMIC_ACQ_REL,
+                                                    __ATOMIC_RELAXED)) {
+                        ul.nodes[ul.n++] = cur;
+                    }
+                    break;
+                }
+            }
+            retire_unlinked(&ul);
+        } while (BRANCH_UNLIKELY(ret == RESTART && !erased));
+        return erased;
+    }
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _MIXED_ATOMIC_H_
+#define _MIXED_ATOMIC_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+#include <util/atomic_utils.h>
+
+//////////////////////////////////////////////////////////////////////
+// Thin wrapper over the gcc __atomic builtins so a type can be made atomic or
+// not (safety) with the memory order either fixed at compile time
+// (m_default / template arg) or passed at runtime. Used by atomic_packed_ptr.
+
+namespace matm {
+
+template<typename T, atomics::safety s, int32_t m_default = __ATOMIC_RELAXED>
+struct c_atomic {
+    T v;
+
+    c_atomic() noexcept  = default;
+    ~c_atomic() noexcept = default;
+
+    constexpr ALWAYS_INLINE
+    c_atomic(const T seed) noexcept
+        : v(seed) {}
+
+    T ALWAYS_INLINE
+    load(const int32_t m = m_default) const noexcept {
+        if constexpr (s == atomics::safe) {
+            return __atomic_load_n(&v, m);
+        }
+        else {
+            return v;
+            (void)m;
+        }
+    }
+
+    void ALWAYS_INLINE
+    store(const T new_v, const int32_t m = m_default) noexcept {
+        if constexpr (s == atomics::safe) {
+            __atomic_store_n(&v, new_v, m);
+        }
+        else {
+            v = new_v;
+            (void)m;
+        }
+    }
+
+    bool ALWAYS_INLINE
+    compare_exchange_weak(T &           expected,
+                          const T       desired,
+                          const int32_t m1 = m_default,
+                          const int32_t m2 = m_default) noexcept {
+        if constexpr (s == atomics::safe) {
+            return __atomic_compare_exchange_n(&v,
+                                               &expected,
+                                               desired,
+                                               true,
+                                               m1,
+                                               m2);
+        }
+        else {
+            if (v == expected) {
+                v = desired;
+                return true;
+            }
+            expected = v;
+            return false;
+            (void)m1;
+            (void)m2;
+        }
+    }
+
+#define MATM_FETCH_OP(op, cop)                                                 \
+    template<int32_t m = m_default>                                            \
+    T ALWAYS_INLINE fetch_##op(const T other) noexcept {                       \
+        return fetch_##op(other, m);                                           \
+    }                                                                          \
+    T ALWAYS_INLINE fetch_##op(const T other, const int32_t m) noexcept {      \
+        if constexpr (s == atomics::safe) {                                    \
+            return __atomic_fetch_##op(&v, other, m);                          \
+        }                                                                      \
+        else {                                                                 \
+            const T old = v;                                                   \
+            v           = old cop other;                                       \
+            return old;                                                        \
+            (void)m;                                                           \
+        }                                                                      \
+    }
+
+    MATM_FETCH_OP(add, +)
+    MATM_FETCH_OP(sub, -)
+    MATM_FETCH_OP(and, &)
+    MATM_FETCH_OP(or, |)
+    MATM_FETCH_OP(xor, ^)
+
+#undef MATM_FETCH_OP
+};
+
+}  // namespace matm
+
+#endif
@@ -1,87 +1,294 @@
 #ifndef _ATOMIC_BIT_VECTOR_H_
 #define _ATOMIC_BIT_VECTOR_H_
 
+#include <assert.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
 #include <misc/cpp_attributes.h>
+#include <optimized/bits.h>
 #include <util/atomic_utils.h>
 #include <util/const_utils.h>
 
+#include <allocator/common/vec_constants.h>
+
+//////////////////////////////////////////////////////////////////////
+// Bit vectors where set() finds a free bit and claims it atomically. Same
+// bitmap convention as the slabs (a set bit means claimed, vec::FULL means
+// nothing left) in set_1s mode. set_0s flips it for callers that start from
+// all ones.
+//
+// atomic_bit_vector is one word. atomic_bit_set is nbits of them with a
+// summary level on top (a set bit means that word is full) so set() only
+// touches words that have a free bit. The summary is scanned 4 words at a
+// time with AVX2 when it is available.
+
 namespace vatm {
 enum atomic_bvec_modes { set_1s = 0, set_0s = 1 };
 using mem_order = int32_t;
 
-template<atomics::safety s = safe, atomic_bvec_modes mode = set_1s>
+template<atomics::safety s = atomics::safe, atomic_bvec_modes mode = set_1s>
 struct atomic_bit_vector {
+    uint64_t vec;
 
-    using internal_T = atomics::atomic_t<s>::type;
+    static constexpr uint32_t ALWAYS_INLINE
+    bit_scan_failure() {
+        // tzcnt of 0
+        return cutil::sizeof_bits<uint64_t>();
+    }
 
-    static constexpr int32_t
-    bit_scan_failure() const {
-        if constexpr {
-            return cutil::sizeof_bits<uint64_t>();
+    // value of vec with nothing claimed
+    static constexpr uint64_t ALWAYS_INLINE
+    empty_vec() {
+        if constexpr (mode == set_1s) {
+            return vec::EMPTY;
         }
         else {
-            return (-1);
+            return vec::FULL;
         }
     }
 
-    constexpr atomic_bit_vector(const uint64_t seed) {
-        vec = seed;
+    constexpr atomic_bit_vector() : vec(empty_vec()) {}
+    constexpr atomic_bit_vector(const uint64_t _vec) : vec(_vec) {}
+    constexpr atomic_bit_vector(const atomic_bit_vector & other)
+        : vec(other.vec) {}
+    ~atomic_bit_vector() = default;
+
+    uint64_t ALWAYS_INLINE
+    load(mem_order m = __ATOMIC_RELAXED) const {
+        if constexpr (s == atomics::safe) {
+            return __atomic_load_n(&vec, m);
+        }
+        else {
+            return vec;
+        }
     }
 
-    ~atomic_bit_vector() = default;
-    constexpr atomic_bit_vector() {
+    // claimed bits as 1s regardless of mode
+    static constexpr uint64_t ALWAYS_INLINE
+    claimed_bits(const uint64_t v) {
         if constexpr (mode == set_1s) {
-            vec = 0;
+            return v;
         }
         else {
-            vec = ~(0UL);
+            return ~v;
         }
     }
-    constexpr atomic_bit_vector(const uint64_t _vec) : vec(_vec) {}
-    constexpr atomic_bit_vector(const atomic_bit_vector other)
-        : vec(other.vec) {}
 
+    uint32_t ALWAYS_INLINE
+    full(mem_order m = __ATOMIC_RELAXED) const {
+        return claimed_bits(load(m)) == vec::FULL;
+    }
+
+    uint32_t ALWAYS_INLINE
+    is_set(const uint32_t pos, mem_order m = __ATOMIC_RELAXED) const {
+        return (claimed_bits(load(m)) >> pos) & 0x1;
+    }
 
-    constexpr uint32_t ALWAYS_INLINE
-    find() const {
+    // first free bit or bit_scan_failure()
+    uint32_t ALWAYS_INLINE
+    find(mem_order m = __ATOMIC_RELAXED) const {
         if constexpr (mode == set_1s) {
-            return bits::find_first_one<uint64_t>(vec);
+            return bits::find_first_zero<uint64_t>(load(m));
         }
         else {
-            return bits::find_first_zero<uint64_t>(vec);
+            return bits::find_first_one<uint64_t>(load(m));
         }
     }
 
-    constexpr uint32_t ALWAYS_INLINE
-    set_inner(const uint64_t pos, mem_order m = __ATOMIC_RELAXED) {
-        // idea is this returns 0 if the fetch was 0 (i.e that means this call
-        // set the bit), otherwise returns 1
-        if constexpr (mode == set_1s) {
-            // if this or didnt set then then pos & result will be 1
-            return __builtin_atomic_fetch_or(&vec, pos, m) & pos;
+    // returns 0 if this call claimed bit, otherwise (someone else got there
+    // first) non-zero
+    uint64_t ALWAYS_INLINE
+    set_inner(const uint64_t bit, mem_order m = __ATOMIC_RELAXED) {
+        if constexpr (s == atomics::safe) {
+            if constexpr (mode == set_1s) {
+                return __atomic_fetch_or(&vec, bit, m) & bit;
+            }
+            else {
+                return (~__atomic_fetch_and(&vec, ~bit, m)) & bit;
+            }
         }
         else {
-            // if this and didnt set then bit at pos will be 0 (there may be a
-            // way to do this will xor)
-            return !(__builtin_atomic_fetch_and(&vec, ~pos, m) & pos);
+            const uint64_t ret = claimed_bits(vec) & bit;
+            vec ^= (ret ^ bit);
+            return ret;
         }
     }
 
-    constexpr uint32_t ALWAYS_INLINE
+    // claims the first free bit and returns its position or
+    // bit_scan_failure() if everything is claimed
+    uint32_t ALWAYS_INLINE
     set(mem_order m = __ATOMIC_RELAXED) {
-        int32_t pos;
+        uint32_t pos;
         do {
-            pos = this->find();
+            pos = find();
             if (BRANCH_UNLIKELY(pos == bit_scan_failure())) {
                 return bit_scan_failure();
             }
-        } while (BRANK_UNLIKELY(set_inner((1UL) << pos, m)));
+        } while (BRANCH_UNLIKELY(set_inner((1UL) << pos, m)));
         return pos;
     }
 
-    constexpr void ALWAYS_INLINE
+    // pos must have been claimed (xor just flips it back). Returns whether
+    // the vector was full before this
+    uint32_t ALWAYS_INLINE
     unset(const uint32_t pos, mem_order m = __ATOMIC_RELAXED) {
-        __builtin_atomic_fetch_xor(&vec, (1UL) << pos, m);
+        uint64_t old;
+        if constexpr (s == atomics::safe) {
+            old = __atomic_fetch_xor(&vec, (1UL) << pos, m);
+        }
+        else {
+            old = vec;
+            vec ^= (1UL) << pos;
+        }
+        return claimed_bits(old) == vec::FULL;
+    }
+};
+
+// index of the first word in [from, to) that isn't vec::FULL or to if there
+// is none. words must be 32 byte aligned and readable up to to rounded up to
+// a multiple of 4 (callers pad with vec::FULL)
+uint32_t ALWAYS_INLINE
+find_first_nonfull(const uint64_t * const words,
+                   uint32_t               from,
+                   const uint32_t         to) {
+#ifdef __AVX2__
+    // scalar up to the first 4 word boundary
+    for (; (from & 0x3) && from < to; ++from) {
+        if (__atomic_load_n(words + from, __ATOMIC_RELAXED) != vec::FULL) {
+            return from;
+        }
+    }
+    const __m256i full = _mm256_set1_epi64x(vec::FULL);
+    for (; from < to; from += 4) {
+        // the words are only hints so a torn read across words is fine
+        const __m256i v   = _mm256_load_si256((const __m256i *)(words + from));
+        const uint32_t neq = (~_mm256_movemask_pd(
+                                 _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, full)))) &
+                             0xf;
+        if (neq) {
+            from += bits::find_first_one<uint32_t>(neq);
+            return from < to ? from : to;
+        }
+    }
+    return to;
+#else
+    for (; from < to; ++from) {
+        if (__atomic_load_n(words + from, __ATOMIC_RELAXED) != vec::FULL) {
+            return from;
+        }
+    }
+    return to;
+#endif
+}
+
+template<uint32_t nbits>
+struct atomic_bit_set {
+    static_assert(nbits, "Empty bit set");
+    using leaf_t = atomic_bit_vector<atomics::safe, set_1s>;
+
+    static constexpr const uint32_t nleaves  = (nbits + 63) / 64;
+    static constexpr const uint32_t nsummary = (nleaves + 63) / 64;
+    // padded so the simd scan never reads past the end
+    static constexpr const uint32_t nsummary_padded = (nsummary + 3) & (~3U);
+
+    static constexpr uint32_t ALWAYS_INLINE
+    bit_scan_failure() {
+        return nbits;
+    }
+
+    // hint, set bit means the leaf is (or very recently was) full
+    uint64_t summary[nsummary_padded] ALIGN_ATTR(32);
+    leaf_t   leaves[nleaves] ALIGN_ATTR(64);
+
+    atomic_bit_set() {
+        for (uint32_t i = 0; i < nsummary_padded; ++i) {
+            summary[i] = vec::EMPTY;
+        }
+        for (uint32_t i = 0; i < nleaves; ++i) {
+            leaves[i].vec = vec::EMPTY;
+        }
+        // bits past nbits / leaves past nleaves are permanently claimed
+        if (nbits % 64) {
+            leaves[nleaves - 1].vec = ~((1UL << (nbits % 64)) - 1);
+        }
+        if (nleaves % 64) {
+            summary[nsummary - 1] = ~((1UL << (nleaves % 64)) - 1);
+        }
+        for (uint32_t i = nsummary; i < nsummary_padded; ++i) {
+            summary[i] = vec::FULL;
+        }
+    }
+
+    uint32_t ALWAYS_INLINE
+    is_set(const uint32_t pos) const {
+        IMPOSSIBLE_VALUES(pos >= nbits);
+        return leaves[pos / 64].is_set(pos % 64);
+    }
+
+    // leaf looked full to set(). The summary bit and leaf are written and
+    // read in opposite orders here and in unset() so with seq_cst at least
+    // one of them sees the other and a leaf can't be left marked full after
+    // it stopped being full
+    void
+    mark_full(const uint32_t leaf) {
+        const uint64_t bit = (1UL) << (leaf % 64);
+        __atomic_fetch_or(summary + (leaf / 64), bit, __ATOMIC_SEQ_CST);
+        if (!leaves[leaf].full(__ATOMIC_SEQ_CST)) {
+            __atomic_fetch_and(summary + (leaf / 64), ~bit, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    // claims a free bit and returns its position, bit_scan_failure() if all
+    // nbits are claimed. Search starts at leaf start_leaf and wraps, callers
+    // that want the lowest free bit (fd style) use 0. Spreading threads out
+    // with start_leaf keeps them off each other's leaves
+    uint32_t
+    set(const uint32_t start_leaf = 0, mem_order m = __ATOMIC_ACQUIRE) {
+        IMPOSSIBLE_VALUES(start_leaf >= nleaves);
+        const uint32_t start_word = start_leaf / 64;
+        const uint64_t skip       = ((1UL) << (start_leaf % 64)) - 1;
+
+        // second pass covers the leaves before start_leaf
+        for (uint32_t i = 0; i < (start_leaf ? 2U : 1U); ++i) {
+            const uint32_t end = i ? start_word + 1 : nsummary;
+            for (uint32_t sw = i ? 0 : start_word;
+                 (sw = find_first_nonfull(summary, sw, end)) < end;
+                 ++sw) {
+                const uint64_t mask = (i == 0 && sw == start_word) ? skip : 0;
+                uint64_t       v;
+                while ((v = (__atomic_load_n(summary + sw, __ATOMIC_RELAXED) |
+                             mask)) != vec::FULL) {
+                    const uint32_t leaf =
+                        64 * sw + bits::find_first_zero<uint64_t>(v);
+                    const uint32_t pos = leaves[leaf].set(m);
+                    if (BRANCH_LIKELY(pos != leaf_t::bit_scan_failure())) {
+                        return 64 * leaf + pos;
+                    }
+                    mark_full(leaf);
+                }
+            }
+        }
+        return bit_scan_failure();
+    }
+
+    // pos must have been returned by set()
+    void
+    unset(const uint32_t pos) {
+        IMPOSSIBLE_VALUES(pos >= nbits);
+        IMPOSSIBLE_VALUES(!is_set(pos));
+        const uint32_t leaf = pos / 64;
+
+        // only the unset that takes the leaf from full to not full has to
+        // look at the summary
+        if (BRANCH_UNLIKELY(leaves[leaf].unset(pos % 64, __ATOMIC_SEQ_CST))) {
+            const uint64_t bit = (1UL) << (leaf % 64);
+            if (__atomic_load_n(summary + (leaf / 64), __ATOMIC_SEQ_CST) & bit) {
+                __atomic_fetch_and(summary + (leaf / 64),
+                                   ~bit,
+                                   __ATOMIC_SEQ_CST);
+            }
+        }
     }
 };
 
@@ -107,7 +107,7 @@ struct packed_ptr {
     static constexpr ALWAYS_INLINE CONST_ATTR
         typename std::enable_if<_low_bits || _high_bits, uint64_t>::type
         to_not_ptr(const uint64_t v) noexcept {
-        return v & (high_bits_mask() | low_bits_mask());
+        return v & (~ptr_mask());
     }
 
     template<uint32_t _low_bits = low_bits>
@@ -862,7 +862,7 @@ struct atomic_packed_ptr {
     static constexpr ALWAYS_INLINE CONST_ATTR
         typename std::enable_if<_low_bits || _high_bits, uint64_t>::type
         to_not_ptr(const uint64_t v) noexcept {
-        return v & (high_bits_mask() | low_bits_mask());
+        return v & (~ptr_mask());
     }
 
 
@@ -914,12 +914,12 @@ struct atomic_packed_ptr {
 
     template<mem_order m = m_default>
     constexpr void ALWAYS_INLINE
-    _store(const uint64_t _v) const noexcept {
+    _store(const uint64_t _v) noexcept {
         if constexpr (m == __ATOMIC_RELAXED) {
             return this->ptr.store(_v);
         }
         else {
-            return this->ptr.load(_v, m);
+            return this->ptr.store(_v, m);
         }
     }
 
@@ -965,6 +965,23 @@ struct atomic_packed_ptr {
         }
     }
 
+    // single cas that sets ptr and increments the high bits (wrapping) if the
+    // value is still expected. With the high bits as a version tag this is
+    // the ABA safe update a lock free stack needs. expected is updated on
+    // failure
+    template<mem_order m1        = m_default,
+             mem_order m2        = m_default,
+             uint32_t  _high_bits = high_bits>
+    constexpr ALWAYS_INLINE typename std::enable_if<_high_bits, bool>::type
+    cas_ptr_incr_high_bits(uint64_t & expected, T * const new_ptr) noexcept {
+        return this->ptr.compare_exchange_weak(
+            expected,
+            ((expected & (~ptr_mask())) + ((1UL) << high_bits_shift())) |
+                ((uint64_t)new_ptr),
+            m1,
+            m2);
+    }
+
     template<mem_order m = m_default>
     constexpr ALWAYS_INLINE packed_ptr<T, low_bits, high_bits>
                             set_ptr_known(T * const new_ptr, T * const guranteed_old_val) noexcept {
@@ -997,7 +1014,7 @@ struct atomic_packed_ptr {
     constexpr packed_ptr<T, low_bits, high_bits> ALWAYS_INLINE PURE_ATTR
     add_eq_ptr(const uint64_t plus_ptr) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>((sizeof(T) * plus_ptr)));
+            this->ptr.template fetch_add<m>((sizeof(T) * plus_ptr)));
     }
 
 
@@ -1005,21 +1022,21 @@ struct atomic_packed_ptr {
     constexpr packed_ptr<T, low_bits, high_bits> ALWAYS_INLINE
     sub_eq_ptr(const uint64_t minus_ptr) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>((sizeof(T) * minus_ptr)));
+            this->ptr.template fetch_sub<m>((sizeof(T) * minus_ptr)));
     }
 
     template<mem_order m = m_default>
     constexpr packed_ptr<T, low_bits, high_bits> ALWAYS_INLINE
     incr_eq_ptr() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>((sizeof(T))));
+            this->ptr.template fetch_add<m>((sizeof(T))));
     }
 
     template<mem_order m = m_default>
     constexpr packed_ptr<T, low_bits, high_bits> ALWAYS_INLINE
     decr_eq_ptr() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>((sizeof(T))));
+            this->ptr.template fetch_sub<m>((sizeof(T))));
     }
 
     template<mem_order m = m_default>
@@ -1084,7 +1101,7 @@ struct atomic_packed_ptr {
 
 
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_xor<m1>(new_low_bits ^ guranteed_old_val));
+            this->ptr.template fetch_xor<m1>(new_low_bits ^ guranteed_old_val));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1099,7 +1116,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         add_eq_low_bits(const uint64_t plus_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>(plus_low_bits));
+            this->ptr.template fetch_add<m>(plus_low_bits));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1108,7 +1125,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         sub_eq_low_bits(const uint64_t minus_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>(minus_low_bits));
+            this->ptr.template fetch_sub<m>(minus_low_bits));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1117,7 +1134,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         incr_eq_low_bits() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>(1));
+            this->ptr.template fetch_add<m>(1));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1126,7 +1143,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         decr_eq_low_bits() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>(1));
+            this->ptr.template fetch_sub<m>(1));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1135,7 +1152,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         and_eq_low_bits(const uint64_t and_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_and<m>(and_low_bits | (~low_bits_mask())));
+            this->ptr.template fetch_and<m>(and_low_bits | (~low_bits_mask())));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1144,7 +1161,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         or_eq_low_bits(const uint64_t or_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_or<m>(or_low_bits));
+            this->ptr.template fetch_or<m>(or_low_bits));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1153,7 +1170,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         xor_eq_low_bits(const uint64_t xor_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_xor<m>(xor_low_bits));
+            this->ptr.template fetch_xor<m>(xor_low_bits));
     }
 
     template<uint32_t _low_bits = low_bits, mem_order m = m_default>
@@ -1162,7 +1179,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         nand_eq_low_bits(const uint64_t nand_low_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_and<m>(~nand_low_bits));
+            this->ptr.template fetch_and<m>(~nand_low_bits));
     }
 
     template<uint32_t  _low_bits = low_bits,
@@ -1375,7 +1392,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         add_eq_high_bits(const uint64_t plus_high_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>((plus_high_bits << high_bits_shift())));
+            this->ptr.template fetch_add<m>((plus_high_bits << high_bits_shift())));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1384,7 +1401,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         sub_eq_high_bits(const uint64_t minus_high_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>((minus_high_bits << high_bits_shift())));
+            this->ptr.template fetch_sub<m>((minus_high_bits << high_bits_shift())));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1393,7 +1410,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         incr_eq_high_bits() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_add<m>((1UL) << high_bits_shift()));
+            this->ptr.template fetch_add<m>((1UL) << high_bits_shift()));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1402,7 +1419,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         decr_eq_high_bits() noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_sub<m>((1UL) << high_bits_shift()));
+            this->ptr.template fetch_sub<m>((1UL) << high_bits_shift()));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1410,7 +1427,7 @@ struct atomic_packed_ptr {
         typename std::enable_if<_high_bits,
                                 packed_ptr<T, low_bits, high_bits>>::type
         and_eq_high_bits(const uint64_t and_high_bits) noexcept {
-        return this->ptr.fetch_and<m>((and_high_bits << high_bits_shift()) |
+        return this->ptr.template fetch_and<m>((and_high_bits << high_bits_shift()) |
                                       (~high_bits_mask()));
     }
 
@@ -1420,7 +1437,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         or_eq_high_bits(const uint64_t or_high_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_or<m>(or_high_bits << high_bits_shift()));
+            this->ptr.template fetch_or<m>(or_high_bits << high_bits_shift()));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1429,7 +1446,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         xor_eq_high_bits(const uint64_t xor_high_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_xor<m>(xor_high_bits << high_bits_shift()));
+            this->ptr.template fetch_xor<m>(xor_high_bits << high_bits_shift()));
     }
 
     template<uint32_t _high_bits = high_bits, mem_order m = m_default>
@@ -1438,7 +1455,7 @@ struct atomic_packed_ptr {
                                 packed_ptr<T, low_bits, high_bits>>::type
         nand_eq_high_bits(const uint64_t nand_high_bits) noexcept {
         return static_cast<packed_ptr<T, low_bits, high_bits>>(
-            this->ptr.fetch_and<m>(~(nand_high_bits << high_bits_shift())));
+            this->ptr.template fetch_and<m>(~(nand_high_bits << high_bits_shift())));
     }
 
     template<uint32_t  _high_bits = high_bits,
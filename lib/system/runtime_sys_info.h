@@ -0,0 +1,400 @@
+#ifndef _RUNTIME_SYS_INFO_H_
+#define _RUNTIME_SYS_INFO_H_
+
+#include <misc/cpp_attributes.h>
+#include <misc/error_handling.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include <dirent.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////////////////////////////
+// Values that have to be read when the program runs instead of being baked in
+// by gen_sys_header. A binary built on an 8 cpu box may well run on a 96
+// cpu host so anything indexed by cpu id has to be sized with
+// runtime_nprocs(), not NPROCS.
+//
+// Everything is read once (sysfs + CPUID) into cached_info, either by a
+// constructor before main or on first use if something needs it earlier,
+// and from then on get_sys_info() is a plain load. sys_info.h points its
+// macros here when there is no PRECOMPUTED_SYS_INFO.h.
+
+namespace sysi {
+
+static constexpr const char * const possible_cpus_file =
+    "/sys/devices/system/cpu/possible";
+
+// cpu lists in sysfs / cgroupfs look like "0-3,8,10-11\n". Sets every cpu in
+// the list in cset and returns max cpu id + 1 (0 if nothing was parsed)
+uint32_t
+parse_cpu_list(const char * buf, cpu_set_t * const cset) {
+    uint32_t max_cpu = 0;
+    CPU_ZERO(cset);
+    while (*buf) {
+        char *         end;
+        const uint32_t lo = strtoul(buf, &end, 10);
+        if (end == buf) {
+            break;
+        }
+        uint32_t hi = lo;
+        buf         = end;
+        if (*buf == '-') {
+            hi = strtoul(buf + 1, &end, 10);
+            if (end == buf + 1) {
+                break;
+            }
+            buf = end;
+        }
+        for (uint32_t i = lo; i <= hi && i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, cset);
+        }
+        max_cpu = hi + 1 > max_cpu ? hi + 1 : max_cpu;
+        if (*buf != ',') {
+            break;
+        }
+        ++buf;
+    }
+    return max_cpu;
+}
+
+// returns 0 if the file can't be read
+uint32_t
+read_cpu_list_file(const char * const path, cpu_set_t * const cset) {
+    char   buf[1024] = { 0 };
+    FILE * fp        = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    const char * const ret = fgets(buf, 1024, fp);
+    fclose(fp);
+    return ret == NULL ? 0 : parse_cpu_list(buf, cset);
+}
+
+// max cpu id the kernel can ever give us + 1. This is fixed at boot so
+// hotplugged cpus are included
+uint32_t
+read_possible_cpus() {
+    cpu_set_t      cset;
+    const uint32_t ret = read_cpu_list_file(possible_cpus_file, &cset);
+    if (ret) {
+        return ret;
+    }
+    return sysconf(_SC_NPROCESSORS_CONF);
+}
+
+// cpus this process is allowed to run on. This is the cgroup cpuset if we
+// can find it (so it is not narrowed by whatever affinity the calling thread
+// has) and otherwise the affinity mask. Returns max allowed cpu id + 1
+uint32_t
+read_allowed_cpus(cpu_set_t * const cset) {
+    char   buf[512] = { 0 };
+    char   path[640];
+    FILE * fp = fopen("/proc/self/cgroup", "r");
+    if (fp != NULL) {
+        uint32_t ret = 0;
+        while (ret == 0 && fgets(buf, 512, fp)) {
+            buf[strcspn(buf, "\n")] = '\0';
+            // v2: "0::<path>"
+            if (!strncmp(buf, "0::", 3)) {
+                snprintf(path,
+                         640,
+                         "/sys/fs/cgroup%s/cpuset.cpus.effective",
+                         buf + 3);
+                ret = read_cpu_list_file(path, cset);
+            }
+            // v1: "<N>:cpuset:<path>"
+            else if (strstr(buf, ":cpuset:") != NULL) {
+                snprintf(path,
+                         640,
+                         "/sys/fs/cgroup/cpuset%s/cpuset.effective_cpus",
+                         strstr(buf, ":cpuset:") + strlen(":cpuset:"));
+                ret = read_cpu_list_file(path, cset);
+            }
+        }
+        fclose(fp);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    CPU_ZERO(cset);
+    ERROR_ASSERT(!sched_getaffinity(0, sizeof(cpu_set_t), cset));
+    uint32_t max_cpu = 0;
+    for (uint32_t i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, cset)) {
+            max_cpu = i + 1;
+        }
+    }
+    return max_cpu;
+}
+
+// returns 0 if the file can't be read
+uint32_t
+read_uint_file(const char * const path) {
+    char   buf[32] = { 0 };
+    FILE * fp      = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    const char * const ret = fgets(buf, 32, fp);
+    fclose(fp);
+    return ret == NULL ? 0 : (uint32_t)strtoul(buf, NULL, 10);
+}
+
+// sys_info_cache::initialized. Only the thread that moves it from NONE to
+// BUILDING fills in cached_info, everyone else waits for READY
+enum sys_info_state : uint32_t {
+    SYS_INFO_NONE     = 0,
+    SYS_INFO_BUILDING = 1,
+    SYS_INFO_READY    = 2
+};
+
+struct sys_info_cache {
+    uint32_t initialized;
+
+    // online processors (what sysconf(_SC_NPROCESSORS_ONLN) returns)
+    uint32_t nprocs;
+
+    // max possible cpu id + 1. What per cpu structures should be sized
+    // with as it (unlike the cpuset) can't grow while we are running and a
+    // cpu id past the end of a per cpu array is not something the fast path
+    // checks for
+    uint32_t nprocs_possible;
+
+    uint32_t ncores;
+    uint32_t nllcs;
+    uint32_t nnodes;
+    uint32_t page_size;
+    uint32_t cache_line_size;
+    uint32_t vm_nbits;
+    uint32_t phys_m_nbits;
+
+    // logical cpu -> ... maps, all nprocs_possible entries. phys_core is the
+    // core id sysfs gives (only unique within a package). core_of, llc_of
+    // and node_of are dense ([0, ncores), [0, nllcs), [0, nnodes)) so they
+    // can index arrays
+    uint32_t * phys_core;
+    uint32_t * core_of;
+    uint32_t * llc_of;
+    uint32_t * node_of;
+};
+
+sys_info_cache cached_info;
+
+void
+read_cpuid_info(sys_info_cache * const info) {
+    // safe defaults for x86_64 4 level paging
+    info->vm_nbits        = 48;
+    info->phys_m_nbits    = 46;
+    info->cache_line_size = 64;
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        // clflush line size in 8 byte units
+        const uint32_t clflush_size = ((ebx >> 8) & 0xff) * 8;
+        if (clflush_size) {
+            info->cache_line_size = clflush_size;
+        }
+    }
+    if (__get_cpuid(0x80000008, &eax, &ebx, &ecx, &edx)) {
+        info->phys_m_nbits = eax & 0xff;
+        info->vm_nbits     = (eax >> 8) & 0xff;
+    }
+#endif
+}
+
+// replaces each key with its index among the distinct keys (in order of first
+// appearance) and returns the number of distinct keys
+uint32_t
+densify(uint64_t * const keys, uint32_t * const out, const uint32_t n) {
+    uint32_t ndistinct = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t j = 0;
+        for (; j < i && keys[j] != keys[i]; ++j) {
+        }
+        out[i] = j == i ? ndistinct++ : out[j];
+    }
+    return ndistinct;
+}
+
+// id of the last level cache cpu shares (the lowest cpu sharing it). Returns
+// cpu if there is no cache info
+uint32_t
+read_llc_id(const uint32_t cpu) {
+    char      path[128];
+    cpu_set_t cset;
+    uint32_t  best_level = 0, llc = cpu;
+    for (uint32_t idx = 0;; ++idx) {
+        snprintf(path,
+                 128,
+                 "/sys/devices/system/cpu/cpu%u/cache/index%u/level",
+                 cpu,
+                 idx);
+        const uint32_t level = read_uint_file(path);
+        if (level == 0) {
+            break;
+        }
+        if (level < best_level) {
+            continue;
+        }
+        snprintf(path,
+                 128,
+                 "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list",
+                 cpu,
+                 idx);
+        if (read_cpu_list_file(path, &cset)) {
+            best_level = level;
+            for (uint32_t i = 0; i < CPU_SETSIZE; ++i) {
+                if (CPU_ISSET(i, &cset)) {
+                    llc = i;
+                    break;
+                }
+            }
+        }
+    }
+    return llc;
+}
+
+// numa node cpu belongs to (0 if not numa)
+uint32_t
+read_node_id(const uint32_t cpu) {
+    char path[128];
+    snprintf(path, 128, "/sys/devices/system/cpu/cpu%u", cpu);
+    DIR * d = opendir(path);
+    if (d == NULL) {
+        return 0;
+    }
+    uint32_t        node = 0;
+    struct dirent * de;
+    while ((de = readdir(d)) != NULL) {
+        if (!strncmp(de->d_name, "node", 4) && de->d_name[4] >= '0' &&
+            de->d_name[4] <= '9') {
+            node = strtoul(de->d_name + 4, NULL, 10);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+void
+read_topology(sys_info_cache * const info) {
+    char           path[128];
+    const uint32_t n = info->nprocs_possible;
+
+    info->phys_core = (uint32_t *)calloc(n, sizeof(uint32_t));
+    info->core_of   = (uint32_t *)calloc(n, sizeof(uint32_t));
+    info->llc_of    = (uint32_t *)calloc(n, sizeof(uint32_t));
+    info->node_of   = (uint32_t *)calloc(n, sizeof(uint32_t));
+    uint64_t * const keys = (uint64_t *)calloc(n, sizeof(uint64_t));
+    ERROR_ASSERT(info->phys_core != NULL && info->core_of != NULL &&
+                 info->llc_of != NULL && info->node_of != NULL &&
+                 keys != NULL);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        snprintf(path,
+                 128,
+                 "/sys/devices/system/cpu/cpu%u/topology/core_id",
+                 i);
+        FILE * fp = fopen(path, "r");
+        if (fp == NULL) {
+            // no topology (offline cpu or a vm that hides it) treat every
+            // cpu as its own core
+            info->phys_core[i] = i;
+            keys[i]            = i;
+        }
+        else {
+            fclose(fp);
+            info->phys_core[i] = read_uint_file(path);
+            snprintf(
+                path,
+                128,
+                "/sys/devices/system/cpu/cpu%u/topology/physical_package_id",
+                i);
+
+            // core ids are only unique within a package
+            keys[i] = (((uint64_t)read_uint_file(path)) << 32) |
+                      info->phys_core[i];
+        }
+    }
+    info->ncores = densify(keys, info->core_of, n);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        keys[i] = read_llc_id(i);
+    }
+    info->nllcs = densify(keys, info->llc_of, n);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        keys[i] = read_node_id(i);
+    }
+    info->nnodes = densify(keys, info->node_of, n);
+    free(keys);
+}
+
+// cached_info is written exactly once, in place, by whoever wins the cas.
+// Racing callers wait for it to be published instead of building (and
+// copying over) their own
+void NEVER_INLINE
+init_sys_info() {
+    uint32_t expected = SYS_INFO_NONE;
+    if (!__atomic_compare_exchange_n(&(cached_info.initialized),
+                                     &expected,
+                                     SYS_INFO_BUILDING,
+                                     false,
+                                     __ATOMIC_ACQUIRE,
+                                     __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&(cached_info.initialized), __ATOMIC_ACQUIRE) !=
+               SYS_INFO_READY) {
+            sched_yield();
+        }
+        return;
+    }
+
+    sys_info_cache * const info = &cached_info;
+    info->nprocs                = sysconf(_SC_NPROCESSORS_ONLN);
+    info->nprocs_possible       = read_possible_cpus();
+    info->page_size             = sysconf(_SC_PAGESIZE);
+    read_cpuid_info(info);
+
+    const uint32_t cache_line_size = read_uint_file(
+        "/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size");
+    if (cache_line_size) {
+        info->cache_line_size = cache_line_size;
+    }
+    read_topology(info);
+
+    __atomic_store_n(&(info->initialized), SYS_INFO_READY, __ATOMIC_RELEASE);
+}
+
+void __attribute__((constructor(101))) init_sys_info_constructor() {
+    if (__atomic_load_n(&(cached_info.initialized), __ATOMIC_ACQUIRE) !=
+        SYS_INFO_READY) {
+        init_sys_info();
+    }
+}
+
+ALWAYS_INLINE const sys_info_cache &
+get_sys_info() {
+    if (BRANCH_UNLIKELY(
+            __atomic_load_n(&(cached_info.initialized), __ATOMIC_ACQUIRE) !=
+            SYS_INFO_READY)) {
+        init_sys_info();
+    }
+    return cached_info;
+}
+
+uint32_t ALWAYS_INLINE
+runtime_nprocs() {
+    return get_sys_info().nprocs_possible;
+}
+
+}  // namespace sysi
+
+#endif
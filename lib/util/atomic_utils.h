@@ -0,0 +1,13 @@
+#ifndef _ATOMIC_UTILS_H_
+#define _ATOMIC_UTILS_H_
+
+namespace atomics {
+
+// whether a wrapper (i.e matm::c_atomic) has to use atomic instructions. unsafe
+// is for types shared with code that knows it has exclusive access (single
+// thread setup, rseq owned data, etc...) so plain loads / stores are enough
+enum safety { unsafe = 0, safe = 1 };
+
+}  // namespace atomics
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <misc/cpp_attributes.h>
 #include <optimized/bits.h>
+#include <optimized/const_math.h>
 namespace cutil {
 
 template<typename T>
@@ -0,0 +1,24 @@
+#ifndef _RAND_UTILS_H_
+#define _RAND_UTILS_H_
+
+#include <stdint.h>
+
+#include <misc/cpp_attributes.h>
+
+namespace rutil {
+
+// xorshift64. Cheap enough for per thread rngs in hot loops (rand() takes a
+// lock). state must never be 0
+static uint64_t ALWAYS_INLINE
+next_rand(uint64_t * const state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+}  // namespace rutil
+
+#endif
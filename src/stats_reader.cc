@@ -0,0 +1,180 @@
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/stats_page.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////////////////////////////
+// Prints the stats page a process exports with astats::stats_exporter (see
+// lib/allocator/common/stats_page.h). Only reads shared memory, the process
+// being watched never knows.
+//
+// -p <pid> finds the page by pid, -f <path> opens any file that is one
+// (/dev/shm/obj_alloc_stats.<pid>, /proc/<pid>/fd/<n> for a memfd). With
+// -i <ms> it keeps printing every interval, counters as rates since the last
+// print. -s also prints every slab, otherwise only the totals.
+//
+// Counters are only there if the watched program was built with
+// -DALLOC_STATS and its threads call publish_thread_counters() (see
+// stats_page.h). A page from a build without ALLOC_STATS prints "counters
+// disabled" instead of a column of zeros, unpublished counts can't be told
+// apart from no activity.
+//
+// A page left mid sample (the process died or is stopped inside
+// stats_exporter::sample()) is reported as stale instead of printed. Once
+// printing the exit status is 1 if the last read was stale.
+
+int32_t  pid         = 0;
+char *   page_path   = NULL;
+uint32_t interval_ms = 0;
+uint32_t count       = 0;
+uint32_t show_slabs  = 0;
+
+static uint64_t
+now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000UL * 1000UL * 1000UL * ts.tv_sec + ts.tv_nsec;
+}
+
+static void
+print_counters(const astats::stats_page * const cur,
+               const astats::stats_page * const prev,
+               const double                     secs) {
+    if (!cur->counters_enabled) {
+        fprintf(stdout, "\tcounters disabled (built without ALLOC_STATS)\n");
+        return;
+    }
+    for (uint32_t i = 0; i < astats::NCOUNTERS; ++i) {
+        if (prev == NULL) {
+            fprintf(stdout,
+                    "\t%-14s: %lu\n",
+                    astats::counter_names[i],
+                    cur->counters[i]);
+        }
+        else {
+            fprintf(stdout,
+                    "\t%-14s: %lu (%.1f/sec)\n",
+                    astats::counter_names[i],
+                    cur->counters[i],
+                    (cur->counters[i] - prev->counters[i]) / secs);
+        }
+    }
+}
+
+static void
+print_occupancy(const astats::stats_page * const cur) {
+    uint64_t live = 0, capacity = 0;
+    for (uint32_t i = 0; i < cur->nslabs; ++i) {
+        live += cur->slabs[i].live;
+        capacity += cur->slabs[i].capacity;
+    }
+    fprintf(stdout,
+            "\tlive          : %lu / %lu (%.2f%%) over %u shards, %u slabs\n",
+            live,
+            capacity,
+            capacity ? (100.0 * live) / capacity : 0.0,
+            cur->nshards,
+            cur->nslabs);
+    if (!show_slabs) {
+        return;
+    }
+    for (uint32_t i = 0; i < cur->nslabs; ++i) {
+        fprintf(stdout,
+                "\t%-6s %4u   : %8lu / %8lu (%6.2f%%)\n",
+                i < cur->nshards ? "shard" : "depot",
+                i < cur->nshards ? i : i - cur->nshards,
+                cur->slabs[i].live,
+                cur->slabs[i].capacity,
+                cur->slabs[i].capacity
+                    ? (100.0 * cur->slabs[i].live) / cur->slabs[i].capacity
+                    : 0.0);
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-p", "--pid", false, Int, pid, "Process to read stats of");
+    ADD_ARG("-f", "--file", false, String, page_path, "Stats page file");
+    ADD_ARG("-i",
+            "--interval",
+            false,
+            Int,
+            interval_ms,
+            "Print every interval ms (0 prints once)");
+    ADD_ARG("-c",
+            "--count",
+            false,
+            Int,
+            count,
+            "Stop after count prints (0 never stops with -i)");
+    ADD_ARG("-s", "--slabs", false, Set, show_slabs, "Print every slab");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(pid || page_path, "Need -p or -f\n");
+
+    astats::stats_reader * reader;
+    if (page_path != NULL) {
+        const int32_t fd = open(page_path, O_RDONLY);
+        ERROR_ASSERT(fd >= 0, "open(%s) failed\n", page_path);
+        reader = new astats::stats_reader(fd);
+    }
+    else {
+        char name[astats::STATS_NAME_LEN];
+        astats::stats_page_name(name, astats::STATS_NAME_LEN, pid);
+        reader = new astats::stats_reader(name);
+    }
+
+    astats::stats_page * cur     = new astats::stats_page();
+    astats::stats_page * prev    = NULL;
+    uint64_t             prev_ns = 0;
+    int32_t              ret     = 0;
+    for (uint32_t n = 0;; ++n) {
+        ret = !reader->snapshot(cur);
+        if (ret) {
+            fprintf(stdout, "Stats page stale (writer stuck in sample)\n");
+            fflush(stdout);
+            if (interval_ms == 0 || (count && n + 1 >= count)) {
+                break;
+            }
+            usleep(1000 * interval_ms);
+            continue;
+        }
+        const uint64_t cur_ns = now_ns();
+        fprintf(stdout,
+                "%s (pid %u), %lu samples\n",
+                cur->label,
+                cur->pid,
+                cur->nsamples);
+        print_counters(cur, prev, (cur_ns - prev_ns) / (1000.0 * 1000 * 1000));
+        print_occupancy(cur);
+        fflush(stdout);
+
+        if (interval_ms == 0 || (count && n + 1 >= count)) {
+            break;
+        }
+        if (prev == NULL) {
+            prev = new astats::stats_page();
+        }
+        astats::stats_page * const tmp = prev;
+        prev                           = cur;
+        cur                            = tmp;
+        prev_ns                        = cur_ns;
+        usleep(1000 * interval_ms);
+    }
+
+    delete cur;
+    delete prev;
+    delete reader;
+    return ret;
+}
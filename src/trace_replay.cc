@@ -0,0 +1,139 @@
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/trace/alloc_trace.h>
+#include <allocator/trace/trace_replay.h>
+#include <allocator/vec_layout/vec_manager.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+// Replays a trace written by traced_manager (see
+// lib/allocator/trace/alloc_trace.h) against each of the manager configs
+// below with the replayer in lib/allocator/trace/trace_replay.h.
+//
+// -T / --timing replays with the original inter-op delays (relative to the first
+// record), otherwise everything runs at full speed.
+
+char *   trace_prefix   = NULL;
+char *   allocator_name = NULL;
+uint32_t use_timing     = 0;
+
+template<uint32_t size>
+struct replay_obj {
+    uint8_t bytes[size];
+};
+
+template<typename allocator_t>
+static void
+replay_with(const char * const name, replay_trace * const trace) {
+    if (allocator_name && strcmp(allocator_name, "all") &&
+        strcmp(allocator_name, name)) {
+        return;
+    }
+    replayer<allocator_t> * rp  = new replayer<allocator_t>();
+    const replay_result     res = rp->run(trace, use_timing);
+    delete rp;
+
+    fprintf(stdout,
+            "%-16s %8u %12lu %12.3f %10.2f %10lu\n",
+            name,
+            res.nthreads,
+            res.nops,
+            res.mops(),
+            res.ns_per_op(),
+            res.nfailed);
+}
+
+// every manager configuration we tune between
+template<uint32_t size>
+static void
+replay_all(replay_trace * const trace) {
+    using obj_t = replay_obj<size>;
+    replay_with<fixed_slab_manager<obj_t, 2, 1, 1, 2>>("fixed-2:1,1,2", trace);
+    replay_with<fixed_slab_manager<obj_t, 1, 4, 8>>("fixed-1:4,8", trace);
+    replay_with<dynamic_slab_manager<obj_t, 1, reclaim_policy::SHARED, 1, 8>>(
+        "dynamic-shared",
+        trace);
+    replay_with<dynamic_slab_manager<obj_t, 1, reclaim_policy::PERCPU, 1, 8>>(
+        "dynamic-percpu",
+        trace);
+    replay_with<fixed_vec_manager<obj_t, 2, 1, 1, 2>>("vec-2:1,1,2", trace);
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-p",
+            "--prefix",
+            true,
+            String,
+            trace_prefix,
+            "Trace file prefix (files are <prefix>.cpu<N>.trace)");
+    ADD_ARG("-a",
+            "--allocator",
+            false,
+            String,
+            allocator_name,
+            "Manager config to replay with (or all)");
+    ADD_ARG("-T",
+            "--timing",
+            false,
+            Set,
+            use_timing,
+            "Replay with original timing");
+    PARSE_ARGUMENTS;
+
+    replay_trace trace;
+    trace.load(trace_prefix);
+
+    lowv_print(
+        "Loaded Trace\n\t"
+        "Threads      : %lu\n\t"
+        "Ops          : %lu\n\t"
+        "Skipped      : %lu\n\t"
+        "Object Size  : %u\n",
+        trace.threads.size(),
+        trace.nops,
+        trace.nskipped,
+        trace.obj_size);
+
+    fprintf(stdout,
+            "%-16s %8s %12s %12s %10s %10s\n",
+            "allocator",
+            "threads",
+            "ops",
+            "Mops/sec",
+            "ns/op",
+            "failed");
+
+    // objects are replayed at the traced size rounded up to a power of 2
+    if (trace.obj_size <= 8) {
+        replay_all<8>(&trace);
+    }
+    else if (trace.obj_size <= 16) {
+        replay_all<16>(&trace);
+    }
+    else if (trace.obj_size <= 32) {
+        replay_all<32>(&trace);
+    }
+    else if (trace.obj_size <= 64) {
+        replay_all<64>(&trace);
+    }
+    else if (trace.obj_size <= 128) {
+        replay_all<128>(&trace);
+    }
+    else if (trace.obj_size <= 256) {
+        replay_all<256>(&trace);
+    }
+    else {
+        DIE("Unsupported object size: %u\n", trace.obj_size);
+    }
+}
@@ -0,0 +1,87 @@
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/trace/alloc_trace.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
+
+uint32_t tsize  = (1 << 16);
+char *   prefix = (char *)"/tmp/alloc_trace_test";
+uint32_t keep   = 0;
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Number of allocations");
+    ADD_ARG("-p", "--prefix", false, String, prefix, "Trace file prefix");
+    ADD_ARG("-k", "--keep", false, Set, keep, "Keep trace files");
+    PARSE_ARGUMENTS;
+
+    init_thread();
+    {
+        traced_manager<fixed_slab_manager<uint64_t, 2, 1, 1, 2>> tm(prefix);
+        tsize = cmath::min<uint32_t>(tsize, tm.capacity);
+
+        uint64_t ** ptrs = (uint64_t **)calloc(tsize, sizeof(uint64_t *));
+        ERROR_ASSERT(ptrs);
+        for (uint32_t i = 0; i < tsize; ++i) {
+            ptrs[i] = tm._allocate();
+            DIE_ASSERT(ptrs[i] != NULL, "Allocation %d failed\n", i);
+        }
+        for (uint32_t i = 0; i < tsize; i += 2) {
+            tm._free(ptrs[i]);
+        }
+        free(ptrs);
+    }
+
+    // read every cpu file back, each object must be allocated before it is
+    // freed and counts must match what we did
+    uint64_t nallocs = 0, nfrees = 0;
+    std::unordered_map<uint64_t, uint64_t> alloc_ts;
+    char path[256];
+    for (uint32_t i = 0; i < sysi::runtime_nprocs(); ++i) {
+        atrace::trace_path(path, 256, prefix, i);
+        uint64_t                     n;
+        uint32_t                     obj_size;
+        atrace::trace_record * const r =
+            atrace::read_trace_file(path, &n, &obj_size);
+        DIE_ASSERT(r != NULL, "Missing trace file: %s\n", path);
+        assert(n == 0 || obj_size == sizeof(uint64_t));
+        for (uint64_t j = 0; j < n; ++j) {
+            if (r[j].op == atrace::ALLOC) {
+                ++nallocs;
+                alloc_ts[r[j].obj_id] = r[j].timestamp_ns;
+            }
+            else {
+                ++nfrees;
+                assert(alloc_ts.count(r[j].obj_id));
+                assert(alloc_ts[r[j].obj_id] <= r[j].timestamp_ns);
+            }
+        }
+        free(r);
+        if (!keep) {
+            unlink(path);
+        }
+    }
+
+    lowv_print(
+        "Trace Read Back\n\t"
+        "Allocs          : %lu (expected %u)\n\t"
+        "Frees           : %lu (expected %u)\n",
+        nallocs,
+        tsize,
+        nfrees,
+        (tsize + 1) / 2);
+    assert(nallocs == tsize);
+    assert(nfrees == (tsize + 1) / 2);
+}
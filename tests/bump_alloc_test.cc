@@ -0,0 +1,123 @@
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct obj {
+    uint64_t data[3];
+};
+
+uint32_t nrounds = 4;
+
+// pin to one cpu so every allocation comes from the same shard
+static void
+pin_to_first_cpu() {
+    cpu_set_t cset;
+    CPU_ZERO(&cset);
+    ERROR_ASSERT(!sched_getaffinity(0, sizeof(cpu_set_t), &cset));
+    uint32_t cpu = 0;
+    while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &cset)) {
+        ++cpu;
+    }
+    DIE_ASSERT(cpu < CPU_SETSIZE, "No allowed cpus\n");
+    CPU_ZERO(&cset);
+    CPU_SET(cpu, &cset);
+    ERROR_ASSERT(!sched_setaffinity(0, sizeof(cpu_set_t), &cset));
+}
+
+template<typename manager_t>
+static uint32_t
+count_live(const manager_t * const mgr) {
+    uint32_t n = 0;
+    mgr->for_each_live([&n](obj *) { ++n; });
+    return n;
+}
+
+// objects within one obj_slab (nslots of them) come out in address order
+// while the slab is fresh, freed objects are only reused once it has run out
+template<typename manager_t>
+static void
+run(const char * const name, const uint32_t nslots) {
+    manager_t * const mgr  = new manager_t();
+    const uint32_t    cap  = manager_t::capacity;
+    obj ** const      ptrs = (obj **)calloc(cap, sizeof(obj *));
+    ERROR_ASSERT(ptrs);
+
+    // part way into the second word of the first slab, the rest of that word
+    // is marked taken but must not show up as live
+    for (uint32_t i = 0; i < 70; ++i) {
+        ptrs[i] = mgr->_allocate();
+        assert(ptrs[i] != NULL);
+        if (i % nslots) {
+            assert(ptrs[i] == ptrs[i - 1] + 1);
+        }
+    }
+    assert(count_live(mgr) == 70);
+
+    // freeing while the cursor still has room does not change where the
+    // next object comes from
+    mgr->_free(ptrs[3]);
+    obj * const next = mgr->_allocate();
+    assert(next == ptrs[69] + 1);
+    ptrs[3] = next;
+    mgr->_free(ptrs[3]);
+    ptrs[3] = mgr->_allocate();
+
+    for (uint32_t i = 70; i < cap; ++i) {
+        ptrs[i] = mgr->_allocate();
+        assert(ptrs[i] != NULL);
+    }
+    assert(mgr->_allocate() == NULL);
+    assert(count_live(mgr) == cap);
+
+    // everything is handed out, frees are picked up by the bitmap
+    for (uint32_t round = 0; round < nrounds; ++round) {
+        for (uint32_t i = round % 2; i < cap; i += 2) {
+            mgr->_free(ptrs[i]);
+        }
+        assert(count_live(mgr) == cap / 2);
+        for (uint32_t i = round % 2; i < cap; i += 2) {
+            ptrs[i] = mgr->_allocate();
+            assert(ptrs[i] != NULL);
+        }
+        assert(mgr->_allocate() == NULL);
+    }
+
+    // no object handed out twice
+    for (uint32_t i = 0; i < cap; ++i) {
+        assert(mgr->is_slot(ptrs[i]));
+        ptrs[i]->data[0] = i;
+    }
+    for (uint32_t i = 0; i < cap; ++i) {
+        assert(ptrs[i]->data[0] == i);
+        mgr->_free(ptrs[i]);
+    }
+    assert(count_live(mgr) == 0);
+
+    free(ptrs);
+    delete mgr;
+    lowv_print("%s passed\n", name);
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-r", "--rounds", false, Int, nrounds, "Free / refill rounds");
+    PARSE_ARGUMENTS;
+
+    pin_to_first_cpu();
+    init_thread();
+
+    using flat_t = fixed_slab_manager<obj, 0, 4>;
+    run<flat_t>("flat", flat_t::capacity);
+
+    using nested_t = fixed_slab_manager<obj, 1, 1, 2>;
+    run<nested_t>("nested", 64 * 2);
+}
@@ -0,0 +1,160 @@
+#include <allocator/reclaim/epoch_reclaimer.h>
+#include <concurrency/epoch_domain.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unordered_set>
+
+#include "poison_manager.h"
+
+using reclaimer_t = epoch_reclaimer<node, poison_manager>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+uint32_t max_objs = 1 << 14;
+
+epoch_domain *    dom;
+poison_manager *  pm;
+reclaimer_t *     rc;
+pthread_barrier_t b;
+
+// Treiber stack with no ABA tag, a popped node can't be reused while
+// another thread still has it as its expected head because it is only
+// retired
+node * head;
+
+void
+push(node * const n) {
+    node * expected = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        n->next = expected;
+    } while (!__atomic_compare_exchange_n(&head,
+                                          &expected,
+                                          n,
+                                          false,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+node *
+pop() {
+    epoch_guard g(dom);
+    node *      expected = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    node *      next;
+    do {
+        if (expected == NULL) {
+            return NULL;
+        }
+        assert(expected->poison == 0);
+        next = expected->next;
+    } while (!__atomic_compare_exchange_n(&head,
+                                          &expected,
+                                          next,
+                                          false,
+                                          __ATOMIC_ACQUIRE,
+                                          __ATOMIC_ACQUIRE));
+    return expected;
+}
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t id = ((uint64_t)arg) + 1;
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; ++i) {
+        node * const n = pm->_allocate();
+        DIE_ASSERT(n != NULL, "Pool empty\n");
+        n->owner = id;
+        push(n);
+
+        node * const popped = pop();
+        if (popped != NULL) {
+            rc->retire(popped);
+        }
+    }
+    rc->collect();
+    // the exiting thread unregisters from dom
+    return NULL;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Push / pops per thread");
+    ADD_ARG("-n", "--nobjs", false, Int, max_objs, "Objects in the pool");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    init_thread();
+    dom = new epoch_domain();
+    pm  = new poison_manager(max_objs);
+    rc  = new reclaimer_t(dom, pm);
+
+    // single thread: a retired node isn't freed until 2 epochs have passed
+    {
+        node * const n = pm->_allocate();
+        assert(n != NULL);
+        dom->enter();
+        const uint64_t e = dom->epoch();
+        rc->retire(n);
+        rc->collect();
+        // we are in a critical section so the epoch can move at most once
+        assert(dom->try_advance() <= e + 1);
+        assert(dom->try_advance() <= e + 1);
+        assert(n->poison == 0);
+        dom->exit();
+
+        dom->synchronize();
+        rc->collect();
+        assert(n->poison == POISON);
+    }
+    lowv_print("Single thread passed\n");
+
+    // multi thread push / pop / retire
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+
+    // once the stack is empty and everything is drained the whole pool is
+    // back
+    for (node * n = head; n != NULL;) {
+        node * const next = n->next;
+        pm->_free(n);
+        n = next;
+    }
+    head = NULL;
+    rc->drain();
+    std::unordered_set<node *> seen;
+    for (uint32_t i = 0; i < max_objs; ++i) {
+        node * const n = pm->_allocate();
+        assert(n != NULL);
+        assert(seen.insert(n).second);
+    }
+    assert(pm->_allocate() == NULL);
+    for (node * const n : seen) {
+        pm->_free(n);
+    }
+    lowv_print("Multi thread passed\n");
+
+    delete rc;
+    delete pm;
+    delete dom;
+}
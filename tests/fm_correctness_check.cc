@@ -1,5 +1,6 @@
 #include <allocator/slab_layout/dynamic_slab_manager.h>
 #include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/growable_slab_manager.h>
 
 #include <misc/error_handling.h>
 #include <optimized/const_math.h>
@@ -11,6 +12,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <unordered_set>
+
 __thread uint32_t sum = 0;
 
 typedef void * (*tfunc_ptr)(void *);
@@ -115,7 +118,8 @@ struct tester {
     alloc() {  // no argument expect implied this
         init_thread();
         expected = cmath::min<uint32_t>(
-            allocator.capacity * cmath::min<uint32_t>(8, current_nthreads),
+            allocator.capacity * cmath::min<uint32_t>(8, current_nthreads) +
+                allocator.extra_capacity(),
             current_nthreads * test_size);
         true_sum = 0;
         sum      = 0;
@@ -294,6 +298,36 @@ struct tester {
     }
 };
 
+// single thread: every object (including the depot) round trips through a
+// unique 32 bit handle and can be freed by handle
+template<typename allocator_t>
+void
+run_handle_test() {
+    init_thread();
+    allocator_t allocator;
+    using handle_t = typename allocator_t::handle_t;
+
+    const uint64_t n = allocator.capacity + allocator.extra_capacity();
+    handle_t *     handles = (handle_t *)calloc(n, sizeof(handle_t));
+    ERROR_ASSERT(handles);
+    std::unordered_set<handle_t> seen;
+    for (uint32_t i = 0; i < n; ++i) {
+        handles[i] = allocator._allocate_handle();
+        assert(handles[i] != allocator_t::NULL_HANDLE);
+        assert(seen.insert(handles[i]).second);
+
+        uint64_t * const ptr = allocator.to_ptr(handles[i]);
+        assert(allocator.to_handle(ptr) == handles[i]);
+        *ptr = i;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        assert(*(allocator.to_ptr(handles[i])) == i);
+        allocator._free_handle(handles[i]);
+    }
+    free(handles);
+    lowv_print("Handle test passed (%lu objects)\n", n);
+}
+
 uint32_t tmin = 1, tmax = 1024;
 int32_t  tincr = (-1);
 uint32_t tsize = (1 << 20);
@@ -328,4 +362,25 @@ main(int argc, char ** argv) {
     for (uint32_t i = tmin; i <= tmax; i += (tincr == (-1) ? i : tincr)) {
         t.run_tests(i, tsize);
     }
+
+    // shared slabs go through the lock prefixed ops
+    tester<sharded_fixed_slab_manager<uint64_t, PER_LLC, 0, 2, 1, 1, 2>> t_llc;
+    for (uint32_t i = tmin; i <= tmax; i += (tincr == (-1) ? i : tincr)) {
+        t_llc.run_tests(i, tsize);
+    }
+
+    // once a cpu's slab is full it has to go through the depot
+    tester<depot_fixed_slab_manager<uint64_t, 8, 2, 1, 1, 2>> t_depot;
+    for (uint32_t i = tmin; i <= tmax; i += (tincr == (-1) ? i : tincr)) {
+        t_depot.run_tests(i, tsize);
+    }
+
+    run_handle_test<fixed_slab_manager<uint64_t, 2, 1, 1, 2>>();
+    run_handle_test<depot_fixed_slab_manager<uint64_t, 8, 2, 1, 1, 2>>();
+
+    // cpus attach more slabs as their first one fills
+    tester<growable_slab_manager<uint64_t, 2, 1, 1, 2>> t_grow;
+    for (uint32_t i = tmin; i <= tmax; i += (tincr == (-1) ? i : tincr)) {
+        t_grow.run_tests(i, tsize);
+    }
 }
@@ -0,0 +1,184 @@
+#include <allocator/list_layout/freelist_manager.h>
+
+#include <misc/error_handling.h>
+#include <optimized/const_math.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unordered_set>
+
+// the 16kb message buffers this pool is meant for
+struct msg_buf {
+    uint64_t data[(16 * 1024) / sizeof(uint64_t)];
+};
+static constexpr const uint32_t last_word =
+    (sizeof(msg_buf) / sizeof(uint64_t)) - 1;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+uint32_t max_objs = 1024;
+
+freelist_manager<msg_buf> * fm;
+pthread_barrier_t           b;
+
+// every thread churns through batches, stamping each buffer with its id and
+// checking nobody else wrote to it. Each buffer is then swapped into the next
+// thread's handoff slot and whatever was there is freed, so most frees happen
+// on a different thread than the allocation
+msg_buf ** handoff;
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t   id         = (uint64_t)arg;
+    const uint32_t   batch_size = max_objs / (2 * nthreads);
+    msg_buf ** const batch = (msg_buf **)calloc(batch_size, sizeof(msg_buf *));
+    ERROR_ASSERT(batch);
+
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; i += batch_size) {
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            batch[j] = fm->_allocate();
+            DIE_ASSERT(batch[j] != NULL, "Pool empty\n");
+            batch[j]->data[0]         = id;
+            batch[j]->data[last_word] = id;
+        }
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            assert(batch[j]->data[0] == id);
+            assert(batch[j]->data[last_word] == id);
+            msg_buf * const other = __atomic_exchange_n(
+                handoff + ((id + 1) % nthreads), batch[j], __ATOMIC_RELAXED);
+            if (other != NULL) {
+                fm->_free(other);
+            }
+        }
+    }
+    pthread_barrier_wait(&b);
+    msg_buf * const last =
+        __atomic_exchange_n(handoff + id, NULL, __ATOMIC_RELAXED);
+    if (last != NULL) {
+        fm->_free(last);
+    }
+    free(batch);
+    return NULL;
+}
+
+static void
+pin_to(const uint32_t cpu) {
+    cpu_set_t cset;
+    CPU_ZERO(&cset);
+    CPU_SET(cpu, &cset);
+    ERROR_ASSERT(!sched_setaffinity(0, sizeof(cpu_set_t), &cset));
+}
+
+// a pool much smaller than percpu_max * nprocs, freed from every cpu and then
+// allocated from one. Objects left in other cpus' lists can't be reached so
+// all of them have to have gone to the global stack
+static void
+small_pool_spread() {
+    cpu_set_t orig;
+    ERROR_ASSERT(!sched_getaffinity(0, sizeof(cpu_set_t), &orig));
+    uint32_t * const cpus = (uint32_t *)calloc(CPU_SETSIZE, sizeof(uint32_t));
+    ERROR_ASSERT(cpus);
+    uint32_t ncpus = 0;
+    for (uint32_t i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &orig)) {
+            cpus[ncpus++] = i;
+        }
+    }
+
+    const uint32_t              nobjs = 4 * sysi::runtime_nprocs();
+    freelist_manager<msg_buf> * small = new freelist_manager<msg_buf>(nobjs);
+
+    msg_buf ** ptrs = (msg_buf **)calloc(nobjs, sizeof(msg_buf *));
+    ERROR_ASSERT(ptrs);
+    for (uint32_t round = 0; round < 2; ++round) {
+        pin_to(cpus[0]);
+        for (uint32_t i = 0; i < nobjs; ++i) {
+            ptrs[i] = small->_allocate();
+            assert(ptrs[i] != NULL);
+        }
+        assert(small->_allocate() == NULL);
+        for (uint32_t i = 0; i < nobjs; ++i) {
+            pin_to(cpus[i % ncpus]);
+            small->_free(ptrs[i]);
+        }
+    }
+    ERROR_ASSERT(!sched_setaffinity(0, sizeof(cpu_set_t), &orig));
+    free(ptrs);
+    free(cpus);
+    delete small;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Allocations per thread");
+    ADD_ARG("-n", "--nobjs", false, Int, max_objs, "Objects in the pool");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads && max_objs >= 2 * nthreads,
+               "Need at least 2 objects per thread\n");
+
+    init_thread();
+    fm = new freelist_manager<msg_buf>(max_objs);
+
+    // single thread: the whole pool, all distinct, then NULL
+    std::unordered_set<msg_buf *> seen;
+    msg_buf ** ptrs = (msg_buf **)calloc(max_objs, sizeof(msg_buf *));
+    ERROR_ASSERT(ptrs);
+    for (uint32_t round = 0; round < 2; ++round) {
+        seen.clear();
+        for (uint32_t i = 0; i < max_objs; ++i) {
+            ptrs[i] = fm->_allocate();
+            assert(ptrs[i] != NULL);
+            assert(seen.insert(ptrs[i]).second);
+        }
+        assert(fm->_allocate() == NULL);
+
+        // more than fits in this cpu's list so some go to the global stack
+        for (uint32_t i = 0; i < max_objs; ++i) {
+            fm->_free(ptrs[i]);
+        }
+    }
+    free(ptrs);
+    small_pool_spread();
+    lowv_print("Single thread passed\n");
+
+    // multi thread churn
+    handoff = (msg_buf **)calloc(nthreads, sizeof(msg_buf *));
+    ERROR_ASSERT(handoff);
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+    free(handoff);
+
+    // everything came back
+    seen.clear();
+    for (uint32_t i = 0; i < max_objs; ++i) {
+        msg_buf * const p = fm->_allocate();
+        assert(p != NULL);
+        assert(seen.insert(p).second);
+    }
+    assert(fm->_allocate() == NULL);
+    lowv_print("Multi thread passed\n");
+
+    delete fm;
+}
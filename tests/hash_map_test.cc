@@ -0,0 +1,162 @@
+#include <concurrency/epoch_domain.h>
+#include <concurrency/lockfree_hash_map.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/rand_utils.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unordered_map>
+
+using map_t = lockfree_hash_map<uint64_t, uint64_t>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+uint32_t nkeys    = 1024;
+
+epoch_domain *    dom;
+map_t *           hmap;
+pthread_barrier_t b;
+
+// net inserts - erases of the shared keys per thread
+int64_t * net_inserts;
+
+// every key's value is a function of the key so a find can check it didn't
+// read a node that was reused for another key
+static uint64_t
+val_of(const uint64_t key) {
+    return key * 31 + 7;
+}
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t tid   = (uint64_t)arg;
+    uint64_t       state = tid + 1;
+    int64_t        net   = 0;
+
+    // keys [nkeys * (tid + 1), nkeys * (tid + 2)) are only touched by this
+    // thread, the keys below nkeys by everyone
+    const uint64_t own_base = nkeys * (tid + 1);
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; ++i) {
+        const uint64_t r   = rutil::next_rand(&state);
+        const uint64_t key = r % nkeys;
+        uint64_t       val;
+        switch ((r >> 32) % 3) {
+            case 0:
+                net += hmap->insert(key, val_of(key));
+                break;
+            case 1:
+                net -= hmap->erase(key);
+                break;
+            default:
+                if (hmap->find(key, &val)) {
+                    assert(val == val_of(key));
+                }
+                break;
+        }
+
+        const uint64_t own = own_base + (i % nkeys);
+        if ((i / nkeys) % 2 == 0) {
+            assert(hmap->insert(own, val_of(own)));
+        }
+        else {
+            assert(hmap->find(own, &val) && val == val_of(own));
+            assert(hmap->erase(own));
+            assert(!hmap->find(own, &val));
+        }
+    }
+    net_inserts[tid] = net;
+    return NULL;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Operations per thread");
+    ADD_ARG("-k", "--keys", false, Int, nkeys, "Shared keys");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    init_thread();
+    dom  = new epoch_domain();
+    hmap = new map_t(dom, 8);
+
+    // single thread against std::unordered_map
+    {
+        std::unordered_map<uint64_t, uint64_t> ref;
+        uint64_t                               state = 12345;
+        for (uint32_t i = 0; i < tsize; ++i) {
+            const uint64_t r   = rutil::next_rand(&state);
+            const uint64_t key = r % nkeys;
+            uint64_t       val;
+            switch ((r >> 32) % 3) {
+                case 0:
+                    assert(hmap->insert(key, val_of(key)) ==
+                           ref.emplace(key, val_of(key)).second);
+                    break;
+                case 1:
+                    assert(hmap->erase(key) == ref.erase(key));
+                    break;
+                default:
+                    assert(hmap->find(key, &val) == ref.count(key));
+                    break;
+            }
+        }
+        for (uint64_t key = 0; key < nkeys; ++key) {
+            uint64_t val;
+            if (hmap->find(key, &val)) {
+                assert(ref.count(key) && val == val_of(key));
+                assert(hmap->erase(key));
+            }
+            else {
+                assert(!ref.count(key));
+            }
+        }
+    }
+    lowv_print("Single thread passed\n");
+
+    // multi thread, the shared keys end up in the map iff net inserts say so
+    net_inserts = (int64_t *)calloc(nthreads, sizeof(int64_t));
+    ERROR_ASSERT(net_inserts);
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+
+    int64_t net = 0;
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        net += net_inserts[i];
+    }
+    int64_t present = 0;
+    for (uint64_t key = 0; key < nkeys; ++key) {
+        uint64_t val;
+        if (hmap->find(key, &val)) {
+            assert(val == val_of(key));
+            ++present;
+        }
+    }
+    assert(net == present);
+    free(net_inserts);
+    lowv_print("Multi thread passed\n");
+
+    dom->unregister_thread();
+    delete hmap;
+    delete dom;
+}
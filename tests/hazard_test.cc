@@ -0,0 +1,276 @@
+#include <allocator/reclaim/hazard_domain.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unordered_set>
+
+#include "poison_manager.h"
+
+using domain_t = hazard_domain<node, poison_manager>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+uint32_t max_objs = 1 << 14;
+
+poison_manager *  pm;
+domain_t *        hp;
+pthread_barrier_t b;
+
+// churn threads still running, the stalled reader holds its hazard until
+// they are all done
+volatile uint32_t nchurning;
+
+// Treiber stack with no ABA tag, a node in a hazard slot can't be freed and
+// reused so the cas can't succeed on a recycled head
+node * head;
+
+void
+push(node * const n) {
+    node * expected = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        n->next = expected;
+    } while (!__atomic_compare_exchange_n(&head,
+                                          &expected,
+                                          n,
+                                          false,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+node *
+pop() {
+    node * n;
+    while (1) {
+        n = hp->protect(0, &head);
+        if (n == NULL) {
+            break;
+        }
+        assert(n->poison == 0);
+        node * expected = n;
+        if (__atomic_compare_exchange_n(&head,
+                                        &expected,
+                                        n->next,
+                                        false,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    hp->clear(0);
+    return n;
+}
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t id = ((uint64_t)arg) + 1;
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; ++i) {
+        node * const n = pm->_allocate();
+        DIE_ASSERT(n != NULL, "Pool empty\n");
+        n->owner = id;
+        push(n);
+
+        node * const popped = pop();
+        if (popped != NULL) {
+            hp->retire(popped);
+        }
+    }
+    __atomic_fetch_sub(&nchurning, 1, __ATOMIC_RELEASE);
+    // the exiting thread gives up its record, orphaning it if the stalled
+    // reader still protects something it retired
+    return NULL;
+}
+
+// protects whatever is on top of the stack and sits on it while every other
+// thread churns
+void *
+stalled_reader(void * arg) {
+    (void)arg;
+    init_thread();
+    pthread_barrier_wait(&b);
+    node * n;
+    while ((n = hp->protect(1, &head)) == NULL) {
+        if (__atomic_load_n(&nchurning, __ATOMIC_ACQUIRE) == 0) {
+            return NULL;
+        }
+        sched_yield();
+    }
+    while (__atomic_load_n(&nchurning, __ATOMIC_ACQUIRE)) {
+        assert(n->poison == 0);
+        sched_yield();
+    }
+    assert(n->poison == 0);
+    hp->clear(1);
+    return NULL;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Push / pops per thread");
+    ADD_ARG("-n", "--nobjs", false, Int, max_objs, "Objects in the pool");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    init_thread();
+    pm = new poison_manager(max_objs);
+    hp = new domain_t(pm);
+
+    // single thread: a retired node isn't freed while it is protected
+    {
+        node * const n = pm->_allocate();
+        assert(n != NULL);
+        node * src = n;
+        assert(hp->protect(0, &src) == n);
+        src = NULL;
+        hp->retire(n);
+        hp->collect();
+        assert(n->poison == 0);
+        hp->clear(0);
+        hp->collect();
+        assert(n->poison == POISON);
+    }
+    lowv_print("Single thread passed\n");
+
+    // a thread that exits with a protected node retired leaves its record
+    // orphaned and the next collect finishes it
+    {
+        node * const n   = pm->_allocate();
+        node *       src = n;
+        assert(n != NULL);
+        assert(hp->protect(0, &src) == n);
+        src = NULL;
+
+        pthread_t tid;
+        ERROR_ASSERT(!pthread_create(
+            &tid,
+            NULL,
+            [](void * arg) -> void * {
+                init_thread();
+                hp->retire((node *)arg);
+                hp->collect();
+                return NULL;
+            },
+            (void *)n));
+        pthread_join(tid, NULL);
+        assert(n->poison == 0);
+
+        hp->clear(0);
+        hp->collect();
+        assert(n->poison == POISON);
+    }
+    lowv_print("Orphaned record passed\n");
+
+    // more threads on one cpu than fit in a slab of records, each holding its
+    // record (and a hazard) at the same time
+    {
+        node * const n = pm->_allocate();
+        assert(n != NULL);
+        head = n;
+
+        cpu_set_t cpus;
+        ERROR_ASSERT(!sched_getaffinity(0, sizeof(cpus), &cpus));
+        uint32_t cpu = 0;
+        while (!CPU_ISSET(cpu, &cpus)) {
+            ++cpu;
+        }
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        pthread_attr_t attr;
+        ERROR_ASSERT(!pthread_attr_init(&attr));
+        ERROR_ASSERT(!pthread_attr_setstacksize(&attr, (1 << 16)));
+        ERROR_ASSERT(!pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus));
+
+        const uint32_t nregistered = 2 * 64 * HP_RECORD_NVEC + 1;
+        pthread_barrier_init(&b, NULL, nregistered + 1);
+        pthread_t * tids =
+            (pthread_t *)calloc(nregistered, sizeof(pthread_t));
+        ERROR_ASSERT(tids);
+        for (uint32_t i = 0; i < nregistered; ++i) {
+            ERROR_ASSERT(!pthread_create(
+                tids + i,
+                &attr,
+                [](void * arg) -> void * {
+                    (void)arg;
+                    init_thread();
+                    assert(hp->protect(0, &head) != NULL);
+                    pthread_barrier_wait(&b);
+                    pthread_barrier_wait(&b);
+                    hp->clear(0);
+                    return NULL;
+                },
+                NULL));
+        }
+        // every thread is registered and protecting n
+        pthread_barrier_wait(&b);
+        head = NULL;
+        hp->retire(n);
+        hp->collect();
+        assert(n->poison == 0);
+        pthread_barrier_wait(&b);
+        for (uint32_t i = 0; i < nregistered; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        pthread_barrier_destroy(&b);
+        pthread_attr_destroy(&attr);
+        free(tids);
+
+        hp->collect();
+        assert(n->poison == POISON);
+    }
+    lowv_print("Oversubscribed cpu passed\n");
+
+    // multi thread push / pop / retire with one reader stalled the whole time
+    nchurning = nthreads;
+    pthread_barrier_init(&b, NULL, nthreads + 1);
+    pthread_t * tids = (pthread_t *)calloc(nthreads + 1, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    ERROR_ASSERT(
+        !pthread_create(tids + nthreads, NULL, stalled_reader, NULL));
+    for (uint32_t i = 0; i <= nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+
+    // once the stack is empty and the orphans are adopted the whole pool is
+    // back
+    for (node * n = head; n != NULL;) {
+        node * const next = n->next;
+        pm->_free(n);
+        n = next;
+    }
+    head = NULL;
+    hp->collect();
+    std::unordered_set<node *> seen;
+    for (uint32_t i = 0; i < max_objs; ++i) {
+        node * const n = pm->_allocate();
+        assert(n != NULL);
+        assert(seen.insert(n).second);
+    }
+    assert(pm->_allocate() == NULL);
+    for (node * const n : seen) {
+        pm->_free(n);
+    }
+    lowv_print("Multi thread passed\n");
+
+    hp->unregister_thread();
+    delete hp;
+    delete pm;
+}
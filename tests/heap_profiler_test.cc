@@ -0,0 +1,85 @@
+#include <allocator/profiling/heap_profiler.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// small period so a single run collects enough samples to check the
+// accounting
+static constexpr const uint64_t test_sample_period = 4096;
+
+uint32_t tsize = (1 << 18);
+char *   outfile = NULL;
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Number of allocations");
+    ADD_ARG("-f", "--file", false, String, outfile, "Write profile to file");
+    PARSE_ARGUMENTS;
+
+    init_thread();
+    profiled_manager<fixed_slab_manager<uint64_t, 2, 1, 1, 2>,
+                     test_sample_period>
+        pm;
+
+    tsize = cmath::min<uint32_t>(tsize, pm.capacity);
+    uint64_t ** ptrs = (uint64_t **)calloc(tsize, sizeof(uint64_t *));
+    ERROR_ASSERT(ptrs);
+
+    for (uint32_t i = 0; i < tsize; ++i) {
+        ptrs[i] = pm._allocate();
+        DIE_ASSERT(ptrs[i] != NULL, "Allocation %d failed\n", i);
+    }
+
+    const uint64_t nlive = pm.profile->nlive;
+    const uint64_t expec = (tsize * sizeof(uint64_t)) / test_sample_period;
+    lowv_print(
+        "Sampled Allocations\n\t"
+        "Allocated Bytes : %lu\n\t"
+        "Expected        : ~%lu\n\t"
+        "Received        : %lu\n",
+        tsize * sizeof(uint64_t),
+        expec,
+        nlive);
+
+    // poisson with this mean is well within a factor of 2
+    assert(nlive > expec / 2 && nlive < 2 * expec);
+
+    if (outfile) {
+        pm.dump(outfile);
+    }
+    else if (verbose >= verb::med_verbose) {
+        pm.dump(stderr);
+    }
+
+    for (uint32_t i = 0; i < tsize; ++i) {
+        pm._free(ptrs[i]);
+    }
+
+    lowv_print(
+        "Freed All\n\t"
+        "Expected        : 0\n\t"
+        "Received        : %lu\n",
+        pm.profile->nlive);
+    assert(pm.profile->nlive == 0);
+    for (uint32_t i = 0; i < hprof::NFILTER; ++i) {
+        assert(pm.profile->filter[i] == 0);
+    }
+
+    uint64_t alloc_count = 0, free_count = 0;
+    for (uint32_t i = 0; i < hprof::NBUCKETS; ++i) {
+        alloc_count += pm.profile->buckets[i].alloc_count;
+        free_count += pm.profile->buckets[i].free_count;
+    }
+    assert(alloc_count == nlive && free_count == nlive);
+
+    free(ptrs);
+}
@@ -0,0 +1,160 @@
+#include <allocator/bitmap_layout/id_allocator.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// not a multiple of 64 or 64 * 64 so the padding in the last leaf / summary
+// word gets tested
+static constexpr const uint32_t max_ids = 64 * 64 * 5 + 17;
+using id_allocator_t                    = id_allocator<max_ids>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+
+id_allocator_t * ida;
+pthread_barrier_t b;
+
+// who holds each id. Every thread checks nobody else has the ids it got
+uint64_t * owner;
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t id         = ((uint64_t)arg) + 1;
+    const uint32_t batch_size = max_ids / (2 * nthreads);
+    uint32_t * const batch = (uint32_t *)calloc(batch_size, sizeof(uint32_t));
+    ERROR_ASSERT(batch);
+
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; i += batch_size) {
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            batch[j] = (j & 0x1) ? ida->_allocate_spread() : ida->_allocate();
+            DIE_ASSERT(batch[j] != id_allocator_t::NO_ID, "Ids exhausted\n");
+            assert(batch[j] < max_ids);
+            assert(__atomic_exchange_n(owner + batch[j], id, __ATOMIC_RELAXED) ==
+                   0);
+        }
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            assert(__atomic_exchange_n(owner + batch[j], 0, __ATOMIC_RELAXED) ==
+                   id);
+            ida->_free(batch[j]);
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+// the single word vector in both modes and without atomics
+template<atomics::safety s, vatm::atomic_bvec_modes mode>
+void
+check_bit_vector() {
+    using bvec_t = vatm::atomic_bit_vector<s, mode>;
+    bvec_t v;
+    for (uint32_t i = 0; i < 64; ++i) {
+        assert(!v.is_set(i));
+        assert(v.set() == i);
+        assert(v.is_set(i));
+    }
+    assert(v.full());
+    assert(v.set() == bvec_t::bit_scan_failure());
+    assert(v.unset(17));
+    assert(!v.unset(5));
+    assert(v.set() == 5);
+    assert(v.set() == 17);
+}
+
+void
+check_all_free() {
+    for (uint32_t i = 0; i < max_ids; ++i) {
+        assert(!ida->is_allocated(i));
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Ids per thread");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads && max_ids >= 2 * nthreads,
+               "Need at least 2 ids per thread\n");
+
+    check_bit_vector<atomics::safe, vatm::set_1s>();
+    check_bit_vector<atomics::safe, vatm::set_0s>();
+    check_bit_vector<atomics::unsafe, vatm::set_1s>();
+    check_bit_vector<atomics::unsafe, vatm::set_0s>();
+
+    init_thread();
+    ida = new id_allocator_t();
+
+    // single thread: lowest free first so ids come out in order
+    for (uint32_t round = 0; round < 2; ++round) {
+        for (uint32_t i = 0; i < max_ids; ++i) {
+            assert(ida->_allocate() == i);
+        }
+        assert(ida->_allocate() == id_allocator_t::NO_ID);
+        assert(ida->_allocate_spread() == id_allocator_t::NO_ID);
+
+        // freed ids are reused lowest first, including ones in leaves that
+        // were marked full
+        for (uint32_t i = max_ids; i-- > 0;) {
+            if (i % 97 == 0) {
+                ida->_free(i);
+            }
+        }
+        for (uint32_t i = 0; i < max_ids; i += 97) {
+            assert(ida->_allocate() == i);
+        }
+        assert(ida->_allocate() == id_allocator_t::NO_ID);
+
+        for (uint32_t i = 0; i < max_ids; ++i) {
+            ida->_free(i);
+        }
+        check_all_free();
+    }
+
+    // spread still hands out every id once
+    for (uint32_t i = 0; i < max_ids; ++i) {
+        assert(ida->_allocate_spread() < max_ids);
+    }
+    assert(ida->_allocate_spread() == id_allocator_t::NO_ID);
+    for (uint32_t i = 0; i < max_ids; ++i) {
+        assert(ida->is_allocated(i));
+        ida->_free(i);
+    }
+    lowv_print("Single thread passed\n");
+
+    // multi thread churn
+    owner = (uint64_t *)calloc(max_ids, sizeof(uint64_t));
+    ERROR_ASSERT(owner);
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+    free(owner);
+
+    // everything came back
+    check_all_free();
+    for (uint32_t i = 0; i < max_ids; ++i) {
+        assert(ida->_allocate() == i);
+    }
+    assert(ida->_allocate() == id_allocator_t::NO_ID);
+    lowv_print("Multi thread passed\n");
+
+    delete ida;
+}
@@ -0,0 +1,167 @@
+#include <allocator/list_layout/freelist_manager.h>
+#include <allocator/magazine/magazine_cache.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unordered_set>
+
+struct obj {
+    uint64_t data[8];
+};
+
+using backing_t  = freelist_manager<obj>;
+using mag_t      = magazine_cache<obj, backing_t, 16>;
+using slab_mgr_t = fixed_slab_manager<obj, 1, 4, 4>;
+using slab_mag_t = magazine_cache<obj, slab_mgr_t>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+uint32_t max_objs = 4096;
+
+backing_t *       fm;
+mag_t *           mc;
+slab_mgr_t *      sm;
+slab_mag_t *      smc;
+pthread_barrier_t b;
+
+// same churn as freelist_test, allocations are handed to the next thread so
+// most frees are into a different thread's magazines
+obj ** handoff;
+
+template<typename cache_t>
+void
+churn_cache(cache_t * const cache, const uint64_t id, obj ** const batch) {
+    const uint32_t batch_size = max_objs / (2 * nthreads);
+    for (uint32_t i = 0; i < tsize; i += batch_size) {
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            batch[j] = cache->_allocate();
+            DIE_ASSERT(batch[j] != NULL, "Pool empty\n");
+            batch[j]->data[0] = id;
+            batch[j]->data[7] = id;
+        }
+        for (uint32_t j = 0; j < batch_size; ++j) {
+            assert(batch[j]->data[0] == id);
+            assert(batch[j]->data[7] == id);
+            obj * const other = __atomic_exchange_n(
+                handoff + ((id + 1) % nthreads), batch[j], __ATOMIC_RELAXED);
+            if (other != NULL) {
+                cache->_free(other);
+            }
+        }
+    }
+    pthread_barrier_wait(&b);
+    obj * const last = __atomic_exchange_n(handoff + id, NULL, __ATOMIC_RELAXED);
+    if (last != NULL) {
+        cache->_free(last);
+    }
+}
+
+void *
+churn(void * arg) {
+    init_thread();
+    const uint64_t id = (uint64_t)arg;
+    obj ** const   batch =
+        (obj **)calloc(max_objs / (2 * nthreads), sizeof(obj *));
+    ERROR_ASSERT(batch);
+
+    pthread_barrier_wait(&b);
+    churn_cache(mc, id, batch);
+    pthread_barrier_wait(&b);
+    churn_cache(smc, id, batch);
+
+    free(batch);
+    // magazines go back to the depot when the thread exits
+    return NULL;
+}
+
+// everything that isn't in a thread's magazines is back in the pool
+void
+check_all_returned() {
+    mc->flush_thread();
+    mc->drain();
+    std::unordered_set<obj *> seen;
+    for (uint32_t i = 0; i < max_objs; ++i) {
+        obj * const p = fm->_allocate();
+        assert(p != NULL);
+        assert(seen.insert(p).second);
+    }
+    assert(fm->_allocate() == NULL);
+    for (obj * const p : seen) {
+        fm->_free(p);
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Allocations per thread");
+    ADD_ARG("-n", "--nobjs", false, Int, max_objs, "Objects in the pool");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads && max_objs >= 2 * nthreads,
+               "Need at least 2 objects per thread\n");
+
+    init_thread();
+    fm  = new backing_t(max_objs);
+    mc  = new mag_t(fm);
+    sm  = new slab_mgr_t();
+    smc = new slab_mag_t(sm);
+
+    // single thread: the whole pool through the magazines, all distinct,
+    // then NULL
+    std::unordered_set<obj *> seen;
+    obj ** ptrs = (obj **)calloc(max_objs, sizeof(obj *));
+    ERROR_ASSERT(ptrs);
+    for (uint32_t round = 0; round < 2; ++round) {
+        seen.clear();
+        for (uint32_t i = 0; i < max_objs; ++i) {
+            ptrs[i] = mc->_allocate();
+            assert(ptrs[i] != NULL);
+            assert(seen.insert(ptrs[i]).second);
+        }
+        assert(mc->_allocate() == NULL);
+
+        // enough to fill both of this thread's magazines and push more into
+        // the depot
+        for (uint32_t i = 0; i < max_objs; ++i) {
+            mc->_free(ptrs[i]);
+        }
+    }
+    free(ptrs);
+    check_all_returned();
+    lowv_print("Single thread passed\n");
+
+    // multi thread churn
+    handoff = (obj **)calloc(nthreads, sizeof(obj *));
+    ERROR_ASSERT(handoff);
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+    free(handoff);
+
+    check_all_returned();
+    lowv_print("Multi thread passed\n");
+
+    delete smc;
+    delete sm;
+    delete mc;
+    delete fm;
+}
@@ -0,0 +1,165 @@
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/persistent_pool.h>
+
+#include <misc/error_handling.h>
+#include <system/mmap_helpers.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// list node linked by offset so it survives the pool moving
+struct node {
+    uint64_t next;
+    uint64_t key;
+    uint64_t check;
+    uint64_t pad;
+};
+
+uint32_t nnodes = 1000;
+
+char     path[64];
+uint64_t version = 1;
+
+template<typename pool_t>
+static uint32_t
+walk(pool_t * const pool) {
+    uint32_t n   = 0;
+    node *   cur = pool->from_offset(pool->roots()[0]);
+    while (cur != NULL) {
+        assert(cur->check == ~(cur->key));
+        cur = pool->from_offset(cur->next);
+        ++n;
+    }
+    return n;
+}
+
+template<typename pool_t>
+static void
+push(pool_t * const pool, const uint64_t key) {
+    node * const n = pool->_allocate();
+    assert(n != NULL);
+    n->key           = key;
+    n->check         = ~key;
+    n->next          = pool->roots()[0];
+    pool->roots()[0] = pool->to_offset(n);
+}
+
+// keeps the pool from landing where it was last time
+static void *
+occupy(const void * const addr, const uint64_t len) {
+    return safe_mmap((void *)addr,
+                     len,
+                     PROT_NONE,
+                     (MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE),
+                     -1,
+                     0);
+}
+
+template<typename manager_t, typename... args_t>
+static void
+run(const char * const name, args_t... args) {
+    using pool_t = persistent_pool<manager_t>;
+    unlink(path);
+
+    // fresh pool
+    void *   last_base;
+    uint64_t last_size;
+    {
+        pool_t pool(path, version, args...);
+        assert(!pool.reattached);
+        assert(pool.roots()[0] == 0);
+        for (uint32_t i = 0; i < nnodes; ++i) {
+            push(&pool, i);
+        }
+        assert(walk(&pool) == nnodes);
+        last_base = pool.hdr;
+        last_size = pool.map_size;
+    }
+
+    // reattach somewhere else, drop every other node and add new ones. New
+    // nodes must not land on a node that is still linked
+    void * const blocker = occupy(last_base, last_size);
+    {
+        pool_t pool(path, version, args...);
+        assert(pool.reattached);
+        assert((void *)pool.hdr != last_base);
+        assert(walk(&pool) == nnodes);
+
+        uint64_t * prev = pool.roots();
+        uint32_t   i    = 0;
+        for (node * cur = pool.from_offset(*prev); cur != NULL; ++i) {
+            node * const next = pool.from_offset(cur->next);
+            if (i % 2) {
+                *prev = cur->next;
+                pool._free(cur);
+            }
+            else {
+                prev = &(cur->next);
+            }
+            cur = next;
+        }
+        assert(walk(&pool) == nnodes - nnodes / 2);
+        for (uint32_t j = 0; j < nnodes / 2; ++j) {
+            push(&pool, nnodes + j);
+        }
+        assert(walk(&pool) == nnodes);
+    }
+    safe_munmap(blocker, last_size);
+    {
+        pool_t pool(path, version, args...);
+        assert(pool.reattached);
+        assert(walk(&pool) == nnodes);
+    }
+
+    // a process that never closes the pool leaves it unclean
+    const pid_t pid = fork();
+    ERROR_ASSERT(pid >= 0, "fork failed\n");
+    if (pid == 0) {
+        pool_t * const pool = new pool_t(path, version, args...);
+        assert(pool->reattached);
+        _exit(0);
+    }
+    int32_t status;
+    ERROR_ASSERT(waitpid(pid, &status, 0) == pid, "waitpid failed\n");
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        pool_t pool(path, version, args...);
+        assert(!pool.reattached);
+        assert(pool.roots()[0] == 0);
+        push(&pool, 0);
+    }
+
+    // so does a different version
+    {
+        pool_t pool(path, version + 1, args...);
+        assert(!pool.reattached);
+        assert(walk(&pool) == 0);
+    }
+
+    unlink(path);
+    lowv_print("%s passed\n", name);
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-n", "--nodes", false, Int, nnodes, "Nodes in the list");
+    PARSE_ARGUMENTS;
+
+    init_thread();
+    snprintf(path, sizeof(path), "/tmp/persistent_pool_test.%d", getpid());
+
+    using fixed_t = fixed_slab_manager<node, 1, 1, 2>;
+    DIE_ASSERT(nnodes + nnodes / 2 <= fixed_t::capacity, "Too many nodes\n");
+    run<fixed_t>("fixed");
+
+    using dynamic_t = dynamic_slab_manager<node, 0, reclaim_policy::SHARED, 2>;
+    run<dynamic_t>("dynamic", (uint32_t)32);
+}
@@ -0,0 +1,46 @@
+#ifndef _POISON_MANAGER_H_
+#define _POISON_MANAGER_H_
+
+#include <stdint.h>
+
+#include <misc/error_handling.h>
+
+#include <allocator/list_layout/freelist_manager.h>
+
+//////////////////////////////////////////////////////////////////////
+// Backing manager for the reclamation tests (epoch_test, hazard_test)
+
+// the freelist_manager writes its link into the first 8 bytes on free so
+// poison goes after it
+struct node {
+    node *   next;
+    uint64_t poison;
+    uint64_t owner;
+    uint64_t pad;
+};
+static constexpr const uint64_t POISON = 0xdeaddeaddeaddeadUL;
+
+// poisons everything it frees so a reader touching freed memory is caught
+struct poison_manager {
+    freelist_manager<node> fm;
+
+    poison_manager(const uint32_t max_objs) : fm(max_objs) {}
+
+    node *
+    _allocate() {
+        node * const n = fm._allocate();
+        if (n != NULL) {
+            n->poison = 0;
+        }
+        return n;
+    }
+
+    void
+    _free(node * const n) {
+        assert(n->poison == 0);
+        n->poison = POISON;
+        fm._free(n);
+    }
+};
+
+#endif
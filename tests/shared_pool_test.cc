@@ -0,0 +1,188 @@
+// a creator that never finishes shouldn't hold up the abandoned pool tests
+#define SHARED_POOL_ATTACH_TIMEOUT_MS 200
+
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/shared_pool.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct msg {
+    uint64_t seq;
+    uint64_t check;
+    uint64_t sender;
+    uint64_t pad;
+};
+
+uint32_t nmsgs   = (1 << 14);
+uint64_t version = 1;
+
+// allocates nmsgs messages and sends their offsets down fd. The pool is
+// small so once it fills up we wait for the other process to free
+template<typename pool_t>
+static void
+produce(pool_t * const pool, const int32_t fd) {
+    for (uint64_t i = 0; i < nmsgs; ++i) {
+        msg * m;
+        while ((m = pool->_allocate()) == NULL) {
+            sched_yield();
+        }
+        m->seq                = i;
+        m->check              = ~i;
+        m->sender             = getpid();
+        const uint64_t offset = pool->to_offset(m);
+        ERROR_ASSERT(write(fd, &offset, sizeof(offset)) == sizeof(offset),
+                     "write failed\n");
+    }
+}
+
+// receives offsets from fd, checks the message and frees it in this process
+template<typename pool_t>
+static void
+consume(pool_t * const pool, const int32_t fd, const pid_t sender) {
+    for (uint64_t i = 0; i < nmsgs; ++i) {
+        uint64_t offset;
+        ERROR_ASSERT(read(fd, &offset, sizeof(offset)) == sizeof(offset),
+                     "read failed\n");
+        msg * const m = pool->from_offset(offset);
+        assert(m->seq == i);
+        assert(m->check == ~i);
+        assert(m->sender == (uint64_t)sender);
+        m->check = 0;
+        pool->_free(m);
+    }
+}
+
+static void
+wait_child(const pid_t pid) {
+    int32_t status;
+    ERROR_ASSERT(waitpid(pid, &status, 0) == pid, "waitpid failed\n");
+    DIE_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+               "Child failed\n");
+}
+
+// parent -> child then child -> parent. make_pool builds the child's own
+// pool object (which attaches to the parent's memory)
+template<typename pool_t, typename make_pool_t>
+static void
+exchange(pool_t * const pool, make_pool_t && make_pool) {
+    int32_t to_child[2], to_parent[2];
+    ERROR_ASSERT(!pipe(to_child), "pipe failed\n");
+    ERROR_ASSERT(!pipe(to_parent), "pipe failed\n");
+
+    const pid_t parent = getpid();
+    const pid_t pid    = fork();
+    ERROR_ASSERT(pid >= 0, "fork failed\n");
+    if (pid == 0) {
+        init_thread();
+        pool_t * const child_pool = make_pool();
+        assert(!child_pool->creator);
+        assert(child_pool->hdr != pool->hdr);
+        consume(child_pool, to_child[0], parent);
+        produce(child_pool, to_parent[1]);
+        delete child_pool;
+        _exit(0);
+    }
+    produce(pool, to_child[1]);
+    consume(pool, to_parent[0], pid);
+    wait_child(pid);
+
+    close(to_child[0]);
+    close(to_child[1]);
+    close(to_parent[0]);
+    close(to_parent[1]);
+}
+
+// attaching to a pool whose creator died before finishing it has to give up
+// instead of waiting forever
+template<typename pool_t>
+static void
+attach_abandoned(const char * const name, const uint64_t size) {
+    const int32_t fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    ERROR_ASSERT(fd >= 0, "shm_open(%s) failed\n", name);
+    ERROR_ASSERT(!ftruncate(fd, size), "ftruncate failed\n");
+
+    const pid_t pid = fork();
+    ERROR_ASSERT(pid >= 0, "fork failed\n");
+    if (pid == 0) {
+        init_thread();
+        // stderr is the expected error, keep it out of the test output
+        close(STDERR_FILENO);
+        new pool_t(name, version);
+        _exit(0);
+    }
+    int32_t status;
+    ERROR_ASSERT(waitpid(pid, &status, 0) == pid, "waitpid failed\n");
+    DIE_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) != 0,
+               "Attached to an abandoned pool\n");
+
+    shm_unlink(name);
+    close(fd);
+}
+
+template<typename manager_t>
+static uint32_t
+count_live(const manager_t * const mgr) {
+    uint32_t n = 0;
+    mgr->for_each_live([&n](msg *) { ++n; });
+    return n;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-n", "--msgs", false, Int, nmsgs, "Messages each way");
+    PARSE_ARGUMENTS;
+
+    init_thread();
+
+    // by name
+    {
+        using pool_t = shared_pool<fixed_slab_manager<msg, 0, 1>>;
+        char name[64];
+        snprintf(name, sizeof(name), "/shared_pool_test.%d", getpid());
+
+        pool_t * const pool = new pool_t(name, version);
+        assert(pool->creator);
+        exchange(pool, [&name]() { return new pool_t(name, version); });
+        assert(count_live(pool->mgr) == 0);
+        delete pool;
+    }
+    lowv_print("shm_open passed\n");
+
+    // memfd handed down by fork
+    {
+        using manager_t =
+            dynamic_slab_manager<msg, 0, reclaim_policy::SHARED, 1>;
+        using pool_t = shared_pool<manager_t>;
+        const int32_t  fd   = pool_t::create_memfd("shared_pool_test");
+        pool_t * const pool = new pool_t(fd, version, (uint32_t)4);
+        assert(pool->creator);
+        exchange(pool, [fd]() { return new pool_t(fd, version, (uint32_t)4); });
+        delete pool;
+    }
+    lowv_print("memfd passed\n");
+
+    // creator died before sizing the memory / before building the manager
+    {
+        using pool_t = shared_pool<fixed_slab_manager<msg, 0, 1>>;
+        char name[64];
+        snprintf(name, sizeof(name), "/shared_pool_test.%d", getpid());
+
+        attach_abandoned<pool_t>(name, 0);
+        attach_abandoned<pool_t>(name, pool_t::pool_size());
+    }
+    lowv_print("Abandoned pool passed\n");
+}
@@ -0,0 +1,152 @@
+#define ALLOC_STATS
+
+#include <allocator/common/alloc_stats.h>
+#include <allocator/common/stats_page.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct obj {
+    uint64_t data[4];
+};
+
+using manager_t = depot_fixed_slab_manager<obj, 2, 1, 1, 2>;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = 1000;
+uint32_t nsamples = 1000;
+
+manager_t *              mgr;
+astats::stats_exporter * exporter;
+
+void *
+alloc_and_publish(void *) {
+    init_thread();
+    for (uint32_t i = 0; i < tsize; ++i) {
+        DIE_ASSERT(mgr->_allocate() != NULL, "Manager full\n");
+    }
+    exporter->publish_thread_counters();
+    // nothing new, publishing again adds nothing
+    exporter->publish_thread_counters();
+    return NULL;
+}
+
+static uint64_t
+total_live(const astats::stats_page * const page) {
+    uint64_t live = 0;
+    for (uint32_t i = 0; i < page->nslabs; ++i) {
+        live += page->slabs[i].live;
+    }
+    return live;
+}
+
+static void
+take_snapshot(const astats::stats_reader * const reader,
+              astats::stats_page * const         snap) {
+    DIE_ASSERT(reader->snapshot(snap), "Stats page stale\n");
+}
+
+manager_t * sample_mgrs[2];
+uint32_t    sampling_done;
+
+// alternates between two managers with different live counts so a torn
+// snapshot would show a mix of the two
+void *
+sampler(void *) {
+    init_thread();
+    for (uint32_t i = 0; i < nsamples; ++i) {
+        exporter->sample(sample_mgrs[i % 2]);
+    }
+    __atomic_store_n(&sampling_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Allocations per thread");
+    ADD_ARG("-n", "--samples", false, Int, nsamples, "Samples to race");
+    PARSE_ARGUMENTS;
+
+    init_thread();
+    mgr      = new manager_t();
+    exporter = new astats::stats_exporter("stats_page_test");
+
+    char name[astats::STATS_NAME_LEN];
+    astats::stats_page_name(name, astats::STATS_NAME_LEN, getpid());
+    astats::stats_reader * const reader = new astats::stats_reader(name);
+    astats::stats_page * const   snap   = new astats::stats_page();
+
+    take_snapshot(reader, snap);
+    assert(snap->pid == (uint32_t)getpid());
+    assert(!strcmp(snap->label, "stats_page_test"));
+    assert(snap->nsamples == 0);
+    assert(snap->counters_enabled);
+
+    // counters only show up once threads publish them
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, alloc_and_publish, NULL));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    take_snapshot(reader, snap);
+    assert(snap->counters[astats::ALLOCS] == nthreads * tsize);
+    assert(snap->counters[astats::FREES] == 0);
+
+    // occupancy only shows up once sampled
+    assert(total_live(snap) == 0);
+    exporter->sample(mgr);
+    take_snapshot(reader, snap);
+    assert(snap->nsamples == 1);
+    assert(snap->nslabs == mgr->nslabs());
+    assert(total_live(snap) == nthreads * tsize);
+    for (uint32_t i = 0; i < snap->nslabs; ++i) {
+        assert(snap->slabs[i].live <= snap->slabs[i].capacity);
+    }
+    lowv_print("Counters / occupancy passed\n");
+
+    // every snapshot taken while sampling is one sample or the other
+    sample_mgrs[0] = new manager_t();
+    sample_mgrs[1] = new manager_t();
+    for (uint32_t i = 0; i < 100; ++i) {
+        assert(sample_mgrs[1]->_allocate() != NULL);
+    }
+    pthread_t sampler_tid;
+    ERROR_ASSERT(!pthread_create(&sampler_tid, NULL, sampler, NULL));
+    while (!__atomic_load_n(&sampling_done, __ATOMIC_ACQUIRE)) {
+        take_snapshot(reader, snap);
+        const uint64_t live = total_live(snap);
+        assert(live == 0 || live == 100 || live == nthreads * tsize);
+    }
+    pthread_join(sampler_tid, NULL);
+    take_snapshot(reader, snap);
+    assert(snap->nsamples == 1 + nsamples);
+    lowv_print("Snapshots passed\n");
+
+    // a writer stuck in sample() leaves seq odd, readers give up
+    exporter->page->seq++;
+    assert(!reader->snapshot(snap));
+    exporter->page->seq++;
+    take_snapshot(reader, snap);
+    lowv_print("Stale page passed\n");
+
+    delete sample_mgrs[0];
+    delete sample_mgrs[1];
+    delete snap;
+    delete reader;
+    delete exporter;
+    delete mgr;
+    free(tids);
+}
@@ -0,0 +1,148 @@
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/type_stable_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/rand_utils.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// seqlock protected pair, a and b are always equal when version is even
+struct versioned {
+    uint64_t version;
+    uint64_t a;
+    uint64_t b;
+    uint64_t pad;
+};
+
+using manager_t =
+    type_stable_manager<versioned, fixed_slab_manager<versioned, 1, 1, 4>>;
+using handle_t = manager_t::handle_t;
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+
+// slots readers pick from, writers keep replacing what is in them
+static constexpr const uint32_t nslots = 256;
+
+manager_t *       tsm;
+handle_t          slots[nslots];
+pthread_barrier_t b;
+
+void
+write_pair(versioned * const v, const uint64_t val) {
+    const uint64_t ver = __atomic_load_n(&(v->version), __ATOMIC_RELAXED);
+    __atomic_store_n(&(v->version), ver + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&(v->a), val, __ATOMIC_RELAXED);
+    __atomic_store_n(&(v->b), val, __ATOMIC_RELAXED);
+    __atomic_store_n(&(v->version), ver + 2, __ATOMIC_RELEASE);
+}
+
+// seqlock read of a node that may be freed and reused at any point. Returns
+// 1 if the read validated
+uint32_t
+read_pair(const versioned * const v, uint64_t * const a, uint64_t * const b) {
+    const uint64_t ver = __atomic_load_n(&(v->version), __ATOMIC_ACQUIRE);
+    if (ver & 0x1) {
+        return 0;
+    }
+    *a = __atomic_load_n(&(v->a), __ATOMIC_RELAXED);
+    *b = __atomic_load_n(&(v->b), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&(v->version), __ATOMIC_RELAXED) == ver;
+}
+
+void *
+churn(void * arg) {
+    init_thread();
+    uint64_t state = ((uint64_t)arg) + 1;
+    pthread_barrier_wait(&b);
+    for (uint32_t i = 0; i < tsize; ++i) {
+        const uint64_t r   = rutil::next_rand(&state);
+        const uint32_t idx = r % nslots;
+        if ((r >> 32) % 4 == 0) {
+            // replace the slot's node and free the old one right away, no
+            // grace period
+            const handle_t h = tsm->_allocate_handle();
+            DIE_ASSERT(h != manager_t::NULL_HANDLE, "Pool empty\n");
+            write_pair(tsm->to_ptr(h), r);
+            const handle_t old =
+                __atomic_exchange_n(slots + idx, h, __ATOMIC_ACQ_REL);
+            write_pair(tsm->to_ptr(old), r + 1);
+            tsm->_free_handle(old);
+        }
+        else {
+            const handle_t h = __atomic_load_n(slots + idx, __ATOMIC_ACQUIRE);
+            const versioned * const v = tsm->stable(tsm->to_ptr(h));
+            uint64_t                a, b;
+            if (read_pair(v, &a, &b)) {
+                assert(a == b);
+            }
+        }
+    }
+    return NULL;
+}
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Operations per thread");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+
+    init_thread();
+    tsm = new manager_t();
+
+    // only slot starts of the manager's region are type stable
+    {
+        versioned * const v = tsm->_allocate();
+        assert(v != NULL);
+        assert(tsm->owns(v));
+        assert(!tsm->owns((versioned *)(((uint64_t)v) + 8)));
+
+        versioned on_stack;
+        assert(!tsm->owns(&on_stack));
+        versioned * const heap = (versioned *)malloc(sizeof(versioned));
+        assert(!tsm->owns(heap));
+        free(heap);
+
+        // a freed slot is still a slot
+        tsm->_free(v);
+        assert(tsm->owns(v));
+        assert(tsm->stable(v) == v);
+    }
+    lowv_print("Ownership checks passed\n");
+
+    // readers validate seqlock reads of nodes writers free without waiting
+    for (uint32_t i = 0; i < nslots; ++i) {
+        slots[i] = tsm->_allocate_handle();
+        assert(slots[i] != manager_t::NULL_HANDLE);
+        write_pair(tsm->to_ptr(slots[i]), i);
+    }
+    pthread_barrier_init(&b, NULL, nthreads);
+    pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    ERROR_ASSERT(tids);
+    for (uint64_t i = 0; i < nthreads; ++i) {
+        ERROR_ASSERT(!pthread_create(tids + i, NULL, churn, (void *)i));
+    }
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_barrier_destroy(&b);
+    free(tids);
+
+    for (uint32_t i = 0; i < nslots; ++i) {
+        tsm->_free_handle(slots[i]);
+    }
+    lowv_print("Optimistic readers passed\n");
+
+    delete tsm;
+}
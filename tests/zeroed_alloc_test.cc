@@ -0,0 +1,150 @@
+#include <allocator/slab_layout/dynamic_slab_manager.h>
+#include <allocator/slab_layout/fixed_slab_manager.h>
+#include <allocator/slab_layout/growable_slab_manager.h>
+
+#include <misc/error_handling.h>
+#include <util/arg.h>
+#include <util/verbosity.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct obj {
+    uint64_t data[6];
+};
+
+uint32_t nthreads = 4;
+uint32_t tsize    = (1 << 16);
+
+pthread_barrier_t b;
+
+// objects are handed to the next thread so most frees are remote
+obj ** handoff;
+
+static void
+check_zero(const obj * const o) {
+    for (uint32_t i = 0; i < sizeof(obj) / sizeof(uint64_t); ++i) {
+        assert(o->data[i] == 0);
+    }
+}
+
+static void
+scribble(obj * const o) {
+    memset((void *)o, 0xff, sizeof(obj));
+}
+
+template<typename manager_t>
+struct zeroed_test {
+    manager_t * mgr;
+
+    // every slot once (fresh), then every slot again after being dirtied
+    void
+    single_thread(const uint32_t nobjs) {
+        obj ** ptrs = (obj **)calloc(nobjs, sizeof(obj *));
+        ERROR_ASSERT(ptrs);
+        for (uint32_t round = 0; round < 3; ++round) {
+            for (uint32_t i = 0; i < nobjs; ++i) {
+                // mix plain allocations in, they still move the high water
+                // mark
+                ptrs[i] = (i % 3) ? mgr->_allocate_zeroed() : mgr->_allocate();
+                assert(ptrs[i] != NULL);
+                if (i % 3) {
+                    check_zero(ptrs[i]);
+                }
+                scribble(ptrs[i]);
+            }
+            for (uint32_t i = 0; i < nobjs; ++i) {
+                mgr->_free(ptrs[i]);
+            }
+        }
+        free(ptrs);
+    }
+
+    static void *
+    churn(void * arg) {
+        init_thread();
+        zeroed_test * const zt  = ((zeroed_test **)arg)[0];
+        const uint64_t      tid = (uint64_t)(((zeroed_test **)arg)[1]);
+        pthread_barrier_wait(&b);
+        for (uint32_t i = 0; i < tsize; ++i) {
+            obj * const o = zt->mgr->_allocate_zeroed();
+            DIE_ASSERT(o != NULL, "Manager full\n");
+            check_zero(o);
+            scribble(o);
+            obj * const prev =
+                __atomic_exchange_n(handoff + ((tid + 1) % nthreads),
+                                    o,
+                                    __ATOMIC_ACQ_REL);
+            if (prev != NULL) {
+                zt->mgr->_free(prev);
+            }
+        }
+        return NULL;
+    }
+
+    void
+    multi_thread() {
+        handoff = (obj **)calloc(nthreads, sizeof(obj *));
+        ERROR_ASSERT(handoff);
+        void ** args = (void **)calloc(2 * nthreads, sizeof(void *));
+        ERROR_ASSERT(args);
+        pthread_barrier_init(&b, NULL, nthreads);
+        pthread_t * tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+        ERROR_ASSERT(tids);
+        for (uint64_t i = 0; i < nthreads; ++i) {
+            args[2 * i]     = (void *)this;
+            args[2 * i + 1] = (void *)i;
+            ERROR_ASSERT(
+                !pthread_create(tids + i, NULL, churn, (void *)(args + 2 * i)));
+        }
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        for (uint32_t i = 0; i < nthreads; ++i) {
+            if (handoff[i] != NULL) {
+                mgr->_free(handoff[i]);
+            }
+        }
+        pthread_barrier_destroy(&b);
+        free(tids);
+        free(args);
+        free(handoff);
+    }
+
+    void
+    run(const char * const name, const uint32_t nobjs) {
+        mgr = new manager_t();
+        single_thread(nobjs);
+        multi_thread();
+        delete mgr;
+        lowv_print("%s passed\n", name);
+    }
+};
+
+int
+main(int argc, char ** argv) {
+    PREPARE_PARSER;
+    ADD_ARG("-v", "--verbose", false, Int, verbose, "Set verbosity");
+    ADD_ARG("-t", "--threads", false, Int, nthreads, "Number of threads");
+    ADD_ARG("-s", "--size", false, Int, tsize, "Allocations per thread");
+    PARSE_ARGUMENTS;
+
+    DIE_ASSERT(nthreads, "Need at least 1 thread\n");
+    init_thread();
+
+    using fixed_t = fixed_slab_manager<obj, 1, 1, 4>;
+    zeroed_test<fixed_t>().run("fixed", fixed_t::capacity);
+
+    using depot_t = depot_fixed_slab_manager<obj, 2, 0, 2>;
+    zeroed_test<depot_t>().run("depot", depot_t::capacity + 64);
+
+    using dynamic_t =
+        dynamic_slab_manager<obj, 1, reclaim_policy::SHARED, 1, 4>;
+    zeroed_test<dynamic_t>().run("dynamic", dynamic_t::capacity);
+
+    using growable_t = growable_slab_manager<obj, 0, 2>;
+    zeroed_test<growable_t>().run("growable", 4 * growable_t::capacity);
+}